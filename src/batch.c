@@ -0,0 +1,504 @@
+/*
+  Termite batch interpreter
+
+  Runs single program over many independent inputs, BATCH_LANES of them at once in lockstep
+  Stacks of all lanes are laid out as structure of arrays: every stack slot is a row holding value of each lane,
+    so every operator is applied to the whole row with fixed width loops, which are vectorized by compiler
+  Lanes share cursor and stack depth, which stay the same for all of them for as long as they agree on jump distances
+  When they don't, lanes that are outnumbered are masked off and are finished by regular scalar interpreter
+    programs are deterministic, so rerunning them from the start gives exactly the same result as resuming would
+
+  Output of every input is written next to it with .out extension, exit codes are listed on stdout
+
+  Usage: termite-batch <program> <input>...
+*/
+
+#define TERM_NO_WORKER_MAIN
+#include "worker.c"
+
+// todo: resume diverged lanes from their state instead of rerunning them
+// todo: wide cells
+
+#define BATCH_LANES       32U
+#define LANE_BUFFER_SIZE  4096U
+#define OUTPUT_EXTENSION  ".out"
+
+typedef struct {
+  const char*   path;
+  TermiteHandle in;
+  TermiteHandle out;
+  _Bool         is_open;
+  _Bool         is_active;
+  _Bool         is_diverged;
+  int           exit_code;
+  unsigned int  in_len;
+  unsigned int  in_pos;
+  unsigned int  out_len;
+  char          in_buffer[LANE_BUFFER_SIZE];
+  char          out_buffer[LANE_BUFFER_SIZE];
+} Lane;
+
+static Program program;
+static Lane lanes[BATCH_LANES];
+
+// row per stack slot, lane per column
+static _Alignas(32) unsigned char stack[STACK_LIMIT][BATCH_LANES];
+static _Alignas(32) unsigned char row_buffer[BATCH_LANES];
+
+static void
+flush_lane(Lane* lane)
+{
+  if (lane->out_len != 0U)
+    write_file(lane->out, lane->out_buffer, lane->out_len);
+  lane->out_len = 0U;
+}
+
+static void
+write_lane(Lane* lane, unsigned char ch)
+{
+  if (lane->out_len == LANE_BUFFER_SIZE)
+    flush_lane(lane);
+  lane->out_buffer[lane->out_len++] = (char)ch;
+}
+
+// returns 0 on read error
+static _Bool
+read_lane(Lane* lane, unsigned char* ch, _Bool* is_read)
+{
+  if (lane->in_pos == lane->in_len) {
+    lane->in_pos = 0U;
+    if (!read_file(lane->in, lane->in_buffer, LANE_BUFFER_SIZE, &lane->in_len)) {
+      lane->in_len = 0U;
+      return (_Bool)0;
+    }
+  }
+  if (lane->in_pos == lane->in_len) {
+    *is_read = (_Bool)0;
+    return (_Bool)1;
+  }
+  *ch = (unsigned char)lane->in_buffer[lane->in_pos++];
+  *is_read = (_Bool)1;
+  return (_Bool)1;
+}
+
+// "<input>.out", returns 0 if it doesn't fit
+static _Bool
+form_output_path(const char* input_path, char* path)
+{
+  unsigned int len = 0U;
+  for (const char* ch = input_path; *ch != '\0'; ch++) {
+    if (len == FILEPATH_LIMIT - sizeof(OUTPUT_EXTENSION))
+      return (_Bool)0;
+    path[len++] = *ch;
+  }
+  for (const char* ch = OUTPUT_EXTENSION; *ch != '\0'; ch++)
+    path[len++] = *ch;
+  path[len] = '\0';
+  return (_Bool)1;
+}
+
+// returns 0 if either file couldn't be opened, lane is left closed in such case
+static _Bool
+open_lane(Lane* lane)
+{
+  char path[FILEPATH_LIMIT];
+  if (!form_output_path(lane->path, path))
+    return (_Bool)0;
+  if (!open_file(lane->path, &lane->in, foFileRead))
+    return (_Bool)0;
+  if (!open_file(path, &lane->out, foFileCreate)) {
+    close_file(lane->in);
+    return (_Bool)0;
+  }
+  lane->in_len = 0U;
+  lane->in_pos = 0U;
+  lane->out_len = 0U;
+  lane->is_open = (_Bool)1;
+  return (_Bool)1;
+}
+
+static void
+close_lane(Lane* lane)
+{
+  flush_lane(lane);
+  close_file(lane->in);
+  close_file(lane->out);
+  lane->is_open = (_Bool)0;
+}
+
+static void
+stop_lane(Lane* lane, int exit_code)
+{
+  lane->exit_code = exit_code;
+  lane->is_active = (_Bool)0;
+}
+
+// masks off lanes that want to jump by other distance than the most of them
+// returns distance that is taken by those that are left
+static unsigned char
+settle_distance(const unsigned char* distances, unsigned int lane_count)
+{
+  unsigned int first = 0U;
+  while (!lanes[first].is_active)
+    first++;
+
+  unsigned char distance = distances[first];
+  unsigned int disagreeing = 0U;
+  for (unsigned int l = 0U; l < BATCH_LANES; l++)
+    disagreeing |= (unsigned int)(distances[l] != distance) & (unsigned int)lanes[l].is_active;
+  if (disagreeing == 0U)
+    return distance;
+
+  unsigned int best_votes = 0U;
+  for (unsigned int l = first; l < lane_count; l++) {
+    if (!lanes[l].is_active)
+      continue;
+    unsigned int votes = 0U;
+    for (unsigned int v = 0U; v < lane_count; v++)
+      votes += lanes[v].is_active && distances[v] == distances[l] ? 1U : 0U;
+    if (votes > best_votes) {
+      best_votes = votes;
+      distance = distances[l];
+    }
+  }
+  for (unsigned int l = 0U; l < lane_count; l++) {
+    if (lanes[l].is_active && distances[l] != distance) {
+      lanes[l].is_active = (_Bool)0;
+      lanes[l].is_diverged = (_Bool)1;
+    }
+  }
+  return distance;
+}
+
+// runs prepared program over lanes in lockstep, until every lane either finishes or diverges
+static void
+run_lanes(unsigned int lane_count)
+{
+  const char* input = program.source;
+  unsigned int size = program.size;
+  unsigned int cursor = 0U;
+  unsigned int stack_head = 0U;
+  unsigned int active_count = 0U;
+
+  for (unsigned int l = 0U; l < lane_count; l++) {
+    if (lanes[l].is_active)
+      active_count++;
+  }
+
+  // every active lane fails the same way, as they share depth and cursor
+  #define crash_all(code) \
+    do { \
+      for (unsigned int l = 0U; l < lane_count; l++) { \
+        if (lanes[l].is_active) \
+          stop_lane(&lanes[l], code); \
+      } \
+      return; \
+    } while (0)
+
+  // lanes that are masked off still compute garbage in their columns, it's cheaper than branching on every one of them
+  #define for_lanes(l) for (unsigned int l = 0U; l < BATCH_LANES; l++)
+
+  while (active_count != 0U) {
+    if (cursor == size)
+      crash_all(OC_OK);
+
+    switch (input[cursor]) {
+      case  ' ':
+      case '\n':
+      case '\r':
+      case '\t': cursor++; continue;
+
+      case '%': {
+        if (stack_head == 0U)
+          crash_all(OC_STACK_EXHAUSTED);
+        stack_head--;
+        for (unsigned int l = 0U; l < lane_count; l++) {
+          if (lanes[l].is_active)
+            stop_lane(&lanes[l], stack[stack_head][l]);
+        }
+        return;
+      }
+
+      case '.': {
+        if (stack_head == 0U)
+          crash_all(OC_STACK_EXHAUSTED);
+        stack_head--;
+        cursor++;
+        break;
+      }
+
+      case '@': {
+        if (stack_head == STACK_LIMIT)
+          crash_all(OC_STACK_OVERFLOW);
+        if (stack_head == 0U)
+          crash_all(OC_STACK_EXHAUSTED);
+        for_lanes(l) stack[stack_head][l] = stack[stack_head - 1U][l];
+        stack_head++;
+        cursor++;
+        break;
+      }
+
+      case '^': {
+        if (stack_head < 2U)
+          crash_all(OC_STACK_EXHAUSTED);
+        unsigned char* restrict a = stack[stack_head - 2U];
+        unsigned char* restrict b = stack[stack_head - 1U];
+        for_lanes(l) {
+          unsigned char buff = b[l];
+          b[l] = a[l];
+          a[l] = buff;
+        }
+        cursor++;
+        break;
+      }
+
+      case '#': {
+        if (stack_head != 0U) {
+          for_lanes(l) row_buffer[l] = stack[stack_head - 1U][l];
+          for (unsigned int i = stack_head - 1U; i != 0U; i--)
+            for_lanes(l) stack[i][l] = stack[i - 1U][l];
+          for_lanes(l) stack[0][l] = row_buffer[l];
+        }
+        cursor++;
+        break;
+      }
+
+      case '$': {
+        if (stack_head != 0U) {
+          for_lanes(l) row_buffer[l] = stack[0][l];
+          for (unsigned int i = 0U; i != stack_head - 1U; i++)
+            for_lanes(l) stack[i][l] = stack[i + 1U][l];
+          for_lanes(l) stack[stack_head - 1U][l] = row_buffer[l];
+        }
+        cursor++;
+        break;
+      }
+
+      case '~': {
+        if (stack_head == 0U)
+          crash_all(OC_STACK_EXHAUSTED);
+        for_lanes(l) stack[stack_head - 1U][l] ^= 1U;
+        cursor++;
+        break;
+      }
+
+      case '=':
+      case '?':
+      case '+':
+      case '-':
+      case '*': {
+        if (stack_head < 2U)
+          crash_all(OC_STACK_EXHAUSTED);
+        unsigned char* restrict a = stack[stack_head - 2U];
+        const unsigned char* restrict b = stack[stack_head - 1U];
+        switch (input[cursor]) {
+          case '=': for_lanes(l) a[l] = a[l] == b[l]; break;
+          case '?': for_lanes(l) a[l] = a[l] < b[l]; break;
+          case '+': for_lanes(l) a[l] = a[l] + b[l]; break;
+          case '-': for_lanes(l) a[l] = a[l] - b[l]; break;
+          case '*': for_lanes(l) a[l] = a[l] * b[l]; break;
+        }
+        stack_head--;
+        cursor++;
+        break;
+      }
+
+      // there's no vector division, so it's the only arithmetic that goes lane by lane
+      case '/': {
+        if (stack_head < 2U)
+          crash_all(OC_STACK_EXHAUSTED);
+        unsigned char* restrict a = stack[stack_head - 2U];
+        const unsigned char* restrict b = stack[stack_head - 1U];
+        for (unsigned int l = 0U; l < lane_count; l++) {
+          if (b[l] != 0U)
+            a[l] = a[l] / b[l];
+          else if (lanes[l].is_active) {
+            stop_lane(&lanes[l], OC_ZERO_DIVISION);
+            active_count--;
+          }
+        }
+        stack_head--;
+        cursor++;
+        break;
+      }
+
+      case '<': {
+        if (stack_head == 0U)
+          crash_all(OC_STACK_EXHAUSTED);
+        stack_head--;
+        for (unsigned int l = 0U; l < lane_count; l++) {
+          if (lanes[l].is_active)
+            write_lane(&lanes[l], stack[stack_head][l]);
+        }
+        cursor++;
+        break;
+      }
+
+      case '>': {
+        if (stack_head == STACK_LIMIT - 1U)
+          crash_all(OC_STACK_OVERFLOW);
+        for_lanes(l) {
+          stack[stack_head][l] = 0U;
+          stack[stack_head + 1U][l] = 0U;
+        }
+        for (unsigned int l = 0U; l < lane_count; l++) {
+          if (!lanes[l].is_active)
+            continue;
+          unsigned char ch = 0U;
+          _Bool is_read = (_Bool)0;
+          if (!read_lane(&lanes[l], &ch, &is_read)) {
+            stop_lane(&lanes[l], OC_FILE_ERROR);
+            active_count--;
+          } else if (is_read) {
+            stack[stack_head][l] = ch;
+            stack[stack_head + 1U][l] = 1U;
+          }
+        }
+        stack_head += 2U;
+        cursor++;
+        break;
+      }
+
+      case '[': {
+        if (stack_head == 0U)
+          crash_all(OC_STACK_EXHAUSTED);
+        stack_head--;
+        unsigned char n_tokens = settle_distance(stack[stack_head], lane_count);
+        active_count = 0U;
+        for (unsigned int l = 0U; l < lane_count; l++)
+          active_count += lanes[l].is_active ? 1U : 0U;
+
+        unsigned int ordinal = program.token_ordinals[cursor];
+        if (n_tokens == 0U)
+          cursor++;
+        else if (n_tokens > ordinal)
+          crash_all(OC_INPUT_EXHAUSTED);
+        else
+          cursor = program.token_offsets[ordinal - n_tokens];
+        break;
+      }
+
+      case ']': {
+        if (stack_head == 0U)
+          crash_all(OC_STACK_EXHAUSTED);
+        stack_head--;
+        unsigned char n_tokens = settle_distance(stack[stack_head], lane_count);
+        active_count = 0U;
+        for (unsigned int l = 0U; l < lane_count; l++)
+          active_count += lanes[l].is_active ? 1U : 0U;
+
+        unsigned int ordinal = program.token_ordinals[cursor] + n_tokens;
+        if (ordinal >= program.token_count)
+          crash_all(OC_INPUT_EXHAUSTED);
+        cursor = token_end(&program, ordinal);
+        break;
+      }
+
+      // program is well formed, so every hex char starts complete pair
+      default: {
+        if (stack_head == STACK_LIMIT)
+          crash_all(OC_STACK_OVERFLOW);
+
+        // constant distance is the same for every lane, so fused jumps never diverge
+        if (program.jump_targets[cursor] != NO_STATIC_JUMP) {
+          cursor = program.jump_targets[cursor] & ~STATIC_REWIND;
+          continue;
+        }
+
+        unsigned char value;
+        if (is_hex_char(input[cursor])) {
+          value = (unsigned char)(hex_value(input[cursor]) << 4U | hex_value(input[cursor + 1U]));
+          cursor += 2U;
+        } else
+          value = (unsigned char)input[cursor++];
+        for_lanes(l) stack[stack_head][l] = value;
+        stack_head++;
+      }
+    }
+  }
+
+  #undef crash_all
+  #undef for_lanes
+}
+
+// lanes that couldn't stay in lockstep are finished one by one from the start
+static void
+rerun_lane(Lane* lane)
+{
+  if (!open_lane(lane)) {
+    lane->exit_code = OC_FILE_ERROR;
+    return;
+  }
+  WorkerArgs args = {0};
+  lane->exit_code = run_program(&program, lane->out, lane->in, args);
+  close_lane(lane);
+}
+
+static void
+report_lane(const Lane* lane)
+{
+  write_ulong(get_stdout(), (unsigned long long)(unsigned char)lane->exit_code);
+  write_cstring(get_stdout(), " ");
+  write_cstring(get_stdout(), lane->path);
+  write_cstring(get_stdout(), "\n");
+}
+
+int
+term_main(int argc, const char** argv)
+{
+  if (argc < 2)
+    return OC_FILE_ERROR; // no file given
+
+  init_io();
+
+  TermiteHandle program_file;
+  if (!open_file(argv[1], &program_file, foFileRead))
+    return OC_FILE_ERROR;
+
+  WorkerArgs args = {0};
+  int return_code = prepare_program(&program, program_file, args);
+  if (!close_file(program_file) && return_code == OC_OK)
+    return_code = OC_FILE_ERROR;
+  if (return_code != OC_OK)
+    return return_code;
+
+  for (int first = 2; first < argc; first += (int)BATCH_LANES) {
+    unsigned int lane_count = (unsigned int)(argc - first) < BATCH_LANES ? (unsigned int)(argc - first) : BATCH_LANES;
+
+    for (unsigned int l = 0U; l < BATCH_LANES; l++) {
+      Lane* lane = &lanes[l];
+      lane->path = l < lane_count ? argv[first + (int)l] : NULL;
+      lane->is_active = (_Bool)0;
+      lane->is_diverged = (_Bool)0;
+      if (lane->path == NULL)
+        continue;
+      if (!open_lane(lane)) {
+        lane->exit_code = OC_FILE_ERROR;
+        return_code = OC_FILE_ERROR;
+        continue;
+      }
+      // jumps over malformed hex are only resolved by scanning, which scalar path does
+      if (program.well_formed)
+        lane->is_active = (_Bool)1;
+      else
+        lane->is_diverged = (_Bool)1;
+    }
+
+    run_lanes(lane_count);
+
+    for (unsigned int l = 0U; l < lane_count; l++) {
+      Lane* lane = &lanes[l];
+      if (lane->is_open)
+        close_lane(lane);
+      if (lane->is_diverged)
+        rerun_lane(lane);
+    }
+    for (unsigned int l = 0U; l < lane_count; l++)
+      report_lane(&lanes[l]);
+  }
+
+  unload_program(&program);
+  deinit_io();
+
+  return return_code;
+}
@@ -0,0 +1,380 @@
+/*
+  Termite operator benchmarks
+
+  Measures cost of single operators of the interpreter loop in nanoseconds
+  Every case is a pair of synthetic programs: unit one repeats a short sequence with measured operators in it,
+    base one repeats the same sequence without them, so that difference of their run times divided by count
+    of measured operators is what they cost alone
+  Both programs are as long as program size and stack limits allow, and are run back to back SAMPLE_COUNT times,
+    ns/op is mean of those samples, given with 95% confidence interval
+
+  Jumps at different distances are measured both with constant distance, which is resolved at load time,
+    and with distance that went through '~~', so interpreter has to look it up in token index
+  Rewinds are chained, every unit jumps to its end and rewinds block after block back to its start
+
+  Numbers depend on how worker is compiled, "make bench BENCH_FLAGS=..." builds it with given flags,
+    which are printed in the report, so reports of builds with different flags could be put side by side
+
+  Usage: termite-bench [worker switches] [tsv] [case name prefix]...
+*/
+
+#define _GNU_SOURCE
+#define TERM_NO_WORKER_MAIN
+#include "worker.c"
+
+#include <math.h>
+#include <time.h>
+
+#ifndef BENCH_FLAGS
+#define BENCH_FLAGS "unknown"
+#endif
+
+#define SAMPLE_COUNT      20U
+#define STUDENT_T         2.093   // two-sided 95% for SAMPLE_COUNT - 1 degrees of freedom
+#define SAMPLE_NS         2000000.0
+#define UNIT_LIMIT        16384U
+#define REWIND_BLOCKS     4U
+#define FILTER_LIMIT      32U
+
+typedef enum {
+  bkPlain,
+  bkForward, // jump over filler of given distance
+  bkRewind,  // chain of REWIND_BLOCKS rewinds of given distance, which has to fit four blocks into byte
+} BenchKinds;
+
+typedef struct {
+  const char*  name;
+  BenchKinds   kind;
+  const char*  setup;         // executed once before units
+  unsigned int fill;          // values pushed after setup, for stack depth
+  _Bool        fill_per_unit; // one more value is pushed for every unit, for operators that consume them
+  const char*  unit;
+  const char*  base;          // unit without measured operators
+  unsigned int ops;           // measured operators in unit
+  unsigned int growth;        // values that either unit leaves on stack, at most
+  unsigned int input;         // stdin bytes consumed by unit
+  unsigned int distance;      // of jumps
+  _Bool        is_dynamic;    // jump distance isn't known at load time
+} BenchCase;
+
+static const BenchCase cases[] = {
+  { "push hex",        bkPlain, "",   0U,    0, "01", "", 1U, 1U, 0U, 0U, 0 },
+  { "push literal",    bkPlain, "",   0U,    0, "a",  "", 1U, 1U, 0U, 0U, 0 },
+  { "drop .",          bkPlain, "",   0U,    1, ".",  "", 1U, 0U, 0U, 0U, 0 },
+  { "dup @",           bkPlain, "a",  0U,    0, "@",  "", 1U, 1U, 0U, 0U, 0 },
+  { "swap ^",          bkPlain, "ab", 0U,    0, "^",  "", 1U, 0U, 0U, 0U, 0 },
+  { "not ~",           bkPlain, "a",  0U,    0, "~",  "", 1U, 0U, 0U, 0U, 0 },
+  { "add +",           bkPlain, "a",  0U,    1, "+",  "", 1U, 0U, 0U, 0U, 0 },
+  { "equal =",         bkPlain, "a",  0U,    1, "=",  "", 1U, 0U, 0U, 0U, 0 },
+  { "divide /",        bkPlain, "a",  0U,    1, "/",  "", 1U, 0U, 0U, 0U, 0 },
+  { "convey # 2",      bkPlain, "",   2U,    0, "#",  "", 1U, 0U, 0U, 0U, 0 },
+  { "convey # 16",     bkPlain, "",   16U,   0, "#",  "", 1U, 0U, 0U, 0U, 0 },
+  { "convey # 256",    bkPlain, "",   256U,  0, "#",  "", 1U, 0U, 0U, 0U, 0 },
+  { "convey # 4096",   bkPlain, "",   4096U, 0, "#",  "", 1U, 0U, 0U, 0U, 0 },
+  { "ronvey $ 2",      bkPlain, "",   2U,    0, "$",  "", 1U, 0U, 0U, 0U, 0 },
+  { "ronvey $ 16",     bkPlain, "",   16U,   0, "$",  "", 1U, 0U, 0U, 0U, 0 },
+  { "ronvey $ 256",    bkPlain, "",   256U,  0, "$",  "", 1U, 0U, 0U, 0U, 0 },
+  { "ronvey $ 4096",   bkPlain, "",   4096U, 0, "$",  "", 1U, 0U, 0U, 0U, 0 },
+  { "write <",         bkPlain, "",   0U,    1, "<",  "", 1U, 0U, 0U, 0U, 0 },
+  { "read >",          bkPlain, "",   0U,    0, ">",  "", 1U, 2U, 1U, 0U, 0 },
+  { "seek ] 1",        bkForward, NULL, 0U, 0, NULL, NULL, 1U, 1U, 0U, 1U,   0 },
+  { "seek ] 16",       bkForward, NULL, 0U, 0, NULL, NULL, 1U, 1U, 0U, 16U,  0 },
+  { "seek ] 128",      bkForward, NULL, 0U, 0, NULL, NULL, 1U, 1U, 0U, 128U, 0 },
+  { "seek ] 1 dyn",    bkForward, NULL, 0U, 0, NULL, NULL, 1U, 1U, 0U, 1U,   1 },
+  { "seek ] 16 dyn",   bkForward, NULL, 0U, 0, NULL, NULL, 1U, 1U, 0U, 16U,  1 },
+  { "seek ] 128 dyn",  bkForward, NULL, 0U, 0, NULL, NULL, 1U, 1U, 0U, 128U, 1 },
+  { "rewind [ 8",      bkRewind,  NULL, 0U, 0, NULL, NULL, REWIND_BLOCKS, REWIND_BLOCKS, 0U, 8U,  0 },
+  { "rewind [ 16",     bkRewind,  NULL, 0U, 0, NULL, NULL, REWIND_BLOCKS, REWIND_BLOCKS, 0U, 16U, 0 },
+  { "rewind [ 48",     bkRewind,  NULL, 0U, 0, NULL, NULL, REWIND_BLOCKS, REWIND_BLOCKS, 0U, 48U, 0 },
+  { "rewind [ 8 dyn",  bkRewind,  NULL, 0U, 0, NULL, NULL, REWIND_BLOCKS, REWIND_BLOCKS, 0U, 8U,  1 },
+  { "rewind [ 16 dyn", bkRewind,  NULL, 0U, 0, NULL, NULL, REWIND_BLOCKS, REWIND_BLOCKS, 0U, 16U, 1 },
+  { "rewind [ 48 dyn", bkRewind,  NULL, 0U, 0, NULL, NULL, REWIND_BLOCKS, REWIND_BLOCKS, 0U, 48U, 1 },
+};
+
+typedef struct {
+  double mean;
+  double interval; // half width
+  unsigned int units;
+  unsigned int runs;
+} BenchResult;
+
+static WorkerArgs args;
+
+// too big for stack
+static Program programs[2];
+static char source[INPUT_LIMIT];
+static unsigned int source_len;
+static unsigned char input_data[INPUT_LIMIT];
+static unsigned char output_data[INPUT_LIMIT];
+
+static _Bool
+append(const char* text)
+{
+  unsigned int len = count_cstring(text);
+  if (len > INPUT_LIMIT - source_len)
+    return (_Bool)0;
+  for (unsigned int i = 0U; i < len; i++)
+    source[source_len++] = text[i];
+  return (_Bool)1;
+}
+
+static _Bool
+append_repeated(const char* text, unsigned int count)
+{
+  for (unsigned int i = 0U; i < count; i++) {
+    if (!append(text))
+      return (_Bool)0;
+  }
+  return (_Bool)1;
+}
+
+// pushes value, optionally hiding it from load time jump resolution
+static _Bool
+append_distance(unsigned int value, _Bool is_dynamic)
+{
+  static const char digits[] = "0123456789ABCDEF";
+  char push[4] = { digits[value >> 4U & 0xFU], digits[value & 0xFU], '\0', '\0' };
+  return append(push) && (!is_dynamic || append("~~")) ? (_Bool)1 : (_Bool)0;
+}
+
+// '.' pushes are never executed, they only put distance between jumps
+static _Bool
+append_unit(const BenchCase* bench, _Bool is_base)
+{
+  switch (bench->kind) {
+    case bkPlain:
+      return append(is_base ? bench->base : bench->unit);
+
+    // constant push and jump are fused into single step, so only distances that went through '~~' are left in base
+    case bkForward:
+      if (is_base)
+        return !bench->is_dynamic || append_distance(bench->distance, (_Bool)1) ? (_Bool)1 : (_Bool)0;
+      return append_distance(bench->distance, bench->is_dynamic) && append("]") &&
+             append_repeated(".", bench->distance) ? (_Bool)1 : (_Bool)0;
+
+    // entry seeks to the last block, blocks rewind to the block before them and the first one rewinds to exit,
+    // which seeks past the unit, base only seeks to exit and pushes distances of dynamic rewinds
+    case bkRewind: {
+      unsigned int block_tokens = bench->is_dynamic ? 4U : 2U;
+      unsigned int filler = bench->distance + 1U - 2U * block_tokens;
+      unsigned int skip = REWIND_BLOCKS * (filler + block_tokens);
+      if (!append_distance(is_base ? 0U : skip, (_Bool)0) || !append("]") ||
+          !append_distance(is_base ? 0U : skip, bench->is_dynamic) || !append("]"))
+      {
+        return (_Bool)0;
+      }
+      for (unsigned int i = 0U; i < REWIND_BLOCKS; i++) {
+        if ((!is_base && !append_repeated(".", filler)) ||
+            ((!is_base || bench->is_dynamic) && !append_distance(bench->distance, bench->is_dynamic)) ||
+            (!is_base && !append("[")))
+        {
+          return (_Bool)0;
+        }
+      }
+      return (_Bool)1;
+    }
+  }
+  return (_Bool)0;
+}
+
+// returns 0 if it doesn't fit
+static _Bool
+build_program(const BenchCase* bench, _Bool is_base, unsigned int units, Program* program)
+{
+  source_len = 0U;
+  unsigned int fill = bench->fill + (bench->fill_per_unit ? units : 0U);
+  if ((bench->kind == bkPlain && !append(bench->setup)) || !append_repeated("a", fill))
+    return (_Bool)0;
+  for (unsigned int i = 0U; i < units; i++) {
+    if (!append_unit(bench, is_base))
+      return (_Bool)0;
+  }
+  if (load_program_bytes(source, source_len, program) != OC_OK)
+    return (_Bool)0;
+  attach_index(program, args);
+  return (_Bool)1;
+}
+
+static double
+now_ns(void)
+{
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec * 1e9 + (double)time.tv_nsec;
+}
+
+// returns elapsed time, or negative value if any run failed
+static double
+time_runs(const Program* program, unsigned int input_size, unsigned int runs)
+{
+  int status = OC_OK;
+  double start = now_ns();
+  for (unsigned int i = 0U; i < runs && status == OC_OK; i++) {
+    TermiteMemory in = { .data = input_data, .size = input_size, .capacity = input_size };
+    TermiteMemory out = { .data = output_data, .capacity = INPUT_LIMIT };
+    status = run_program(program, memory_handle(&out), memory_handle(&in), args);
+  }
+  double elapsed = now_ns() - start;
+  return status == OC_OK ? elapsed : -1.0;
+}
+
+// returns 0 if programs couldn't be built or failed to run
+static _Bool
+run_case(const BenchCase* bench, BenchResult* result)
+{
+  // as many units as fit into both program size and stack
+  unsigned int units = UNIT_LIMIT;
+  unsigned int depth = count_cstring(bench->kind == bkPlain ? bench->setup : "") + bench->fill;
+  if (bench->growth != 0U && (STACK_LIMIT - 2U - depth) / bench->growth < units)
+    units = (STACK_LIMIT - 2U - depth) / bench->growth;
+  while (units != 0U && !build_program(bench, (_Bool)0, units, &programs[0]))
+    units -= units / 8U + 1U;
+  if (units == 0U || !build_program(bench, (_Bool)1, units, &programs[1]))
+    return (_Bool)0;
+
+  unsigned int input_size = units * bench->input;
+  for (unsigned int i = 0U; i < input_size; i++)
+    input_data[i] = (unsigned char)'x';
+
+  // runs per sample are doubled until unit program takes long enough to be timed
+  unsigned int runs = 1U;
+  double elapsed;
+  while ((elapsed = time_runs(&programs[0], input_size, runs)) < SAMPLE_NS && elapsed >= 0.0)
+    runs *= 2U;
+  if (elapsed < 0.0 || time_runs(&programs[1], input_size, 1U) < 0.0)
+    return (_Bool)0;
+
+  double samples[SAMPLE_COUNT];
+  double sum = 0.0;
+  double operators = (double)runs * units * bench->ops;
+  for (unsigned int i = 0U; i < SAMPLE_COUNT; i++) {
+    double with_ops = time_runs(&programs[0], input_size, runs);
+    double without_ops = time_runs(&programs[1], input_size, runs);
+    samples[i] = (with_ops - without_ops) / operators;
+    sum += samples[i];
+  }
+
+  double mean = sum / SAMPLE_COUNT;
+  double variance = 0.0;
+  for (unsigned int i = 0U; i < SAMPLE_COUNT; i++)
+    variance += (samples[i] - mean) * (samples[i] - mean);
+  variance /= SAMPLE_COUNT - 1U;
+
+  result->mean = mean;
+  result->interval = STUDENT_T * sqrt(variance / SAMPLE_COUNT);
+  result->units = units;
+  result->runs = runs;
+  return (_Bool)1;
+}
+
+// with three decimal places
+static void
+write_fixed(TermiteHandle file, double value)
+{
+  if (value < 0.0) {
+    write_cstring(file, "-");
+    value = -value;
+  }
+  unsigned long long thousandths = (unsigned long long)(value * 1000.0 + 0.5);
+  write_ulong(file, thousandths / 1000U);
+  char fraction[5] = { '.', (char)('0' + thousandths / 100U % 10U), (char)('0' + thousandths / 10U % 10U),
+                       (char)('0' + thousandths % 10U), '\0' };
+  write_cstring(file, fraction);
+}
+
+static void
+write_padded(TermiteHandle file, const char* text, unsigned int width)
+{
+  write_cstring(file, text);
+  for (unsigned int len = count_cstring(text); len < width; len++)
+    write_cstring(file, " ");
+}
+
+static _Bool
+is_selected(const char* name, const char** filters, unsigned int filter_count)
+{
+  if (filter_count == 0U)
+    return (_Bool)1;
+  for (unsigned int i = 0U; i < filter_count; i++) {
+    const char* prefix = filters[i];
+    const char* ch = name;
+    while (*prefix != '\0' && *prefix == *ch) {
+      prefix++;
+      ch++;
+    }
+    if (*prefix == '\0')
+      return (_Bool)1;
+  }
+  return (_Bool)0;
+}
+
+int
+term_main(int argc, const char** argv)
+{
+  const char* filters[FILTER_LIMIT];
+  unsigned int filter_count = 0U;
+  _Bool is_tsv = (_Bool)0;
+
+  for (int i = 1; i < argc; i++) {
+    if (compare_cstring(argv[i], "tsv"))
+      is_tsv = (_Bool)1;
+    else if (!parse_worker_arg(argv[i], &args) && filter_count != FILTER_LIMIT)
+      filters[filter_count++] = argv[i];
+  }
+
+  init_io();
+  TermiteHandle out = get_stdout();
+  if (is_tsv)
+    write_cstring(out, "flags\tcells\tcase\tns/op\tci95\tunits\truns\n");
+  else {
+    write_cstring(out, "flags: " BENCH_FLAGS "\n");
+    write_cstring(out, args.wide_cells ? "cells: 16 bit\n\n" : "cells: 8 bit\n\n");
+    write_cstring(out, "case               ns/op      +-95%    units  runs\n");
+  }
+
+  int exit_code = OC_OK;
+  for (unsigned int i = 0U; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    if (!is_selected(cases[i].name, filters, filter_count))
+      continue;
+
+    BenchResult result;
+    _Bool is_done = run_case(&cases[i], &result);
+    if (is_tsv) {
+      write_cstring(out, BENCH_FLAGS "\t");
+      write_cstring(out, args.wide_cells ? "16\t" : "8\t");
+      write_cstring(out, cases[i].name);
+      write_cstring(out, "\t");
+    } else
+      write_padded(out, cases[i].name, 17U);
+
+    if (!is_done) {
+      write_cstring(out, is_tsv ? "failed\n" : "  failed\n");
+      exit_code = OC_INVALID_INPUT;
+      continue;
+    }
+
+    if (is_tsv) {
+      write_fixed(out, result.mean);
+      write_cstring(out, "\t");
+      write_fixed(out, result.interval);
+      write_cstring(out, "\t");
+      write_ulong(out, result.units);
+      write_cstring(out, "\t");
+      write_ulong(out, result.runs);
+      write_cstring(out, "\n");
+    } else {
+      write_cstring(out, "  ");
+      write_fixed(out, result.mean);
+      write_cstring(out, "  +-");
+      write_fixed(out, result.interval);
+      write_cstring(out, "  ");
+      write_ulong(out, result.units);
+      write_cstring(out, "  ");
+      write_ulong(out, result.runs);
+      write_cstring(out, "\n");
+    }
+  }
+
+  deinit_io();
+  return exit_code;
+}
@@ -0,0 +1,202 @@
+#include "io.h"
+#include "common.h"
+#include "terms.h"
+#include "program.h"
+#include "cache.h"
+#include "intrinsics.h"
+
+// todo: entries are never evicted, only purged explicitly
+
+#define CACHE_EXTENSION ".tmc"
+
+#define TEMPORARY_EXTENSION ".tmp"
+
+// "<CACHE_DIRECTORY>/<hash>.tmc"
+#define CACHE_PATH_SIZE (sizeof(CACHE_DIRECTORY) + 16U + sizeof(CACHE_EXTENSION))
+// "<CACHE_DIRECTORY>/<hash>-<process id>.tmp"
+#define TEMPORARY_PATH_SIZE (sizeof(CACHE_DIRECTORY) + 33U + sizeof(TEMPORARY_EXTENSION))
+
+static void
+form_entry_path(const Program* program, char* path)
+{
+  unsigned int len = 0U;
+  for (const char* ch = CACHE_DIRECTORY; *ch != '\0'; ch++)
+    path[len++] = *ch;
+  path[len++] = '/';
+  format_hash(program->hash, &path[len]);
+  len += 16U;
+  for (const char* ch = CACHE_EXTENSION; *ch != '\0'; ch++)
+    path[len++] = *ch;
+  path[len] = '\0';
+}
+
+static void
+form_temporary_path(const Program* program, char* path)
+{
+  unsigned int len = 0U;
+  for (const char* ch = CACHE_DIRECTORY; *ch != '\0'; ch++)
+    path[len++] = *ch;
+  path[len++] = '/';
+  format_hash(program->hash, &path[len]);
+  len += 16U;
+  path[len++] = '-';
+  format_hash(get_process_id(), &path[len]);
+  len += 16U;
+  for (const char* ch = TEMPORARY_EXTENSION; *ch != '\0'; ch++)
+    path[len++] = *ch;
+  path[len] = '\0';
+}
+
+static _Bool
+is_section_valid(const CacheHeader* header, unsigned int section, unsigned int expected_size, unsigned int file_size)
+{
+  const CacheSection* entry = &header->sections[section];
+  return entry->size == expected_size &&
+         (entry->offset & 3U) == 0U &&
+         entry->offset >= sizeof(CacheHeader) &&
+         entry->offset <= file_size &&
+         entry->size <= file_size - entry->offset ? (_Bool)1 : (_Bool)0;
+}
+
+// sections are arrays of 4 byte values, so they're hashed by whole values, which is several times faster than by bytes
+static unsigned long long
+checksum_section(unsigned long long hash, const void* section, unsigned int size)
+{
+  const unsigned int* values = section;
+  for (unsigned int i = 0U; i < size / sizeof(unsigned int); i++) {
+    hash ^= values[i];
+    hash *= 0x100000001B3ULL;
+  }
+  return hash;
+}
+
+_Bool
+cache_load(Program* program)
+{
+  char path[CACHE_PATH_SIZE];
+  form_entry_path(program, path);
+
+  TermiteMapping mapping;
+  if (!map_file(path, &mapping))
+    return (_Bool)0;
+
+  // header is validated in constant time, sections are only hashed, nothing is rescanned
+  const CacheHeader* header = (const CacheHeader*)mapping.data;
+  if (mapping.size < sizeof(CacheHeader) ||
+      header->magic != CACHE_MAGIC ||
+      header->version != CACHE_VERSION ||
+      header->source_hash != program->hash ||
+      header->source_size != program->size ||
+      header->section_count != CACHE_SECTION_COUNT ||
+      header->token_count > program->size ||
+      !is_section_valid(header, csTokenOffsets, header->token_count * sizeof(unsigned int), mapping.size) ||
+      !is_section_valid(header, csTokenOrdinals, program->size * sizeof(unsigned int), mapping.size) ||
+      !is_section_valid(header, csJumpTargets, program->size * sizeof(unsigned int), mapping.size) ||
+      header->sections[csIntrinsicSites].size % sizeof(IntrinsicSite) != 0U ||
+      header->sections[csIntrinsicSites].size > INTRINSIC_SITE_LIMIT * sizeof(IntrinsicSite) ||
+      !is_section_valid(header, csIntrinsicSites, header->sections[csIntrinsicSites].size, mapping.size))
+  {
+    unmap_file(&mapping);
+    return (_Bool)0;
+  }
+
+  unsigned long long checksum = HASH_SEED;
+  for (unsigned int i = 0U; i < CACHE_SECTION_COUNT; i++)
+    checksum = checksum_section(checksum, mapping.data + header->sections[i].offset, header->sections[i].size);
+  if (checksum != header->checksum) {
+    unmap_file(&mapping);
+    return (_Bool)0;
+  }
+
+  // sites are copied, as they're part of program itself, routines they refer to should exist
+  const IntrinsicSite* sites = (const IntrinsicSite*)(mapping.data + header->sections[csIntrinsicSites].offset);
+  unsigned int site_count = header->sections[csIntrinsicSites].size / sizeof(IntrinsicSite);
+  for (unsigned int i = 0U; i < site_count; i++) {
+    if (sites[i].intrinsic >= intrinsic_count || sites[i].offset >= sites[i].end || sites[i].end > program->size) {
+      unmap_file(&mapping);
+      return (_Bool)0;
+    }
+    program->intrinsic_sites[i] = sites[i];
+  }
+  program->intrinsic_site_count = site_count;
+
+  program->token_count = header->token_count;
+  program->well_formed = header->well_formed != 0U ? (_Bool)1 : (_Bool)0;
+  program->token_offsets = (const unsigned int*)(mapping.data + header->sections[csTokenOffsets].offset);
+  program->token_ordinals = (const unsigned int*)(mapping.data + header->sections[csTokenOrdinals].offset);
+  program->jump_targets = (const unsigned int*)(mapping.data + header->sections[csJumpTargets].offset);
+  program->cache = mapping;
+  program->is_cached = (_Bool)1;
+  return (_Bool)1;
+}
+
+_Bool
+cache_store(const Program* program)
+{
+  if (!create_directory(CACHE_DIRECTORY))
+    return (_Bool)0;
+
+  // entry is written aside and moved in place whole, as other processes could have the old one mapped
+  char path[CACHE_PATH_SIZE];
+  char temporary_path[TEMPORARY_PATH_SIZE];
+  form_entry_path(program, path);
+  form_temporary_path(program, temporary_path);
+
+  CacheHeader header = {
+    .magic = CACHE_MAGIC,
+    .version = CACHE_VERSION,
+    .source_hash = program->hash,
+    .source_size = program->size,
+    .token_count = program->token_count,
+    .well_formed = program->well_formed,
+    .section_count = CACHE_SECTION_COUNT,
+  };
+
+  const void* sections[CACHE_SECTION_COUNT];
+  sections[csTokenOffsets] = program->token_offsets;
+  header.sections[csTokenOffsets].size = program->token_count * sizeof(unsigned int);
+  sections[csTokenOrdinals] = program->token_ordinals;
+  header.sections[csTokenOrdinals].size = program->size * sizeof(unsigned int);
+  sections[csJumpTargets] = program->jump_targets;
+  header.sections[csJumpTargets].size = program->size * sizeof(unsigned int);
+  sections[csIntrinsicSites] = program->intrinsic_sites;
+  header.sections[csIntrinsicSites].size = program->intrinsic_site_count * sizeof(IntrinsicSite);
+
+  // all sections are arrays of 4 byte aligned values, so alignment is kept by placing them one after another
+  unsigned int offset = sizeof(CacheHeader);
+  header.checksum = HASH_SEED;
+  for (unsigned int i = 0U; i < CACHE_SECTION_COUNT; i++) {
+    header.sections[i].offset = offset;
+    offset += header.sections[i].size;
+    header.checksum = checksum_section(header.checksum, sections[i], header.sections[i].size);
+  }
+
+  TermiteHandle file;
+  if (!open_file(temporary_path, &file, foFileCreate))
+    return (_Bool)0;
+
+  _Bool status = write_file(file, (const char*)&header, sizeof(CacheHeader));
+  for (unsigned int i = 0U; i < CACHE_SECTION_COUNT && status; i++)
+    status = write_file(file, (const char*)sections[i], header.sections[i].size);
+
+  if (!close_file(file) || !status || !replace_file(temporary_path, path)) {
+    // never leave partially written entry behind
+    delete_file(temporary_path);
+    return (_Bool)0;
+  }
+  return (_Bool)1;
+}
+
+_Bool
+cache_purge(const Program* program)
+{
+  char path[CACHE_PATH_SIZE];
+  form_entry_path(program, path);
+
+  TermiteMapping mapping;
+  if (!map_file(path, &mapping))
+    return (_Bool)1; // nothing to purge
+  unmap_file(&mapping);
+
+  return delete_file(path);
+}
@@ -0,0 +1,53 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "program.h"
+
+// On-disk cache of program load-time artifacts
+//   Entries are named by content hash of the source and live in CACHE_DIRECTORY
+//   Every section is stored in the same form as it's used in memory, so valid entry is used directly from its mapping
+//   Checksum of sections catches torn and corrupted entries, but not forged ones, which could make interpreter
+//   read out of bounds, so cache directory is trusted input, it shouldn't be writable by anyone who can't run worker
+
+#define CACHE_MAGIC   0x434D5254U // "TRMC"
+#define CACHE_VERSION 4U
+
+typedef enum {
+  csTokenOffsets,
+  csTokenOrdinals,
+  csJumpTargets,
+  csIntrinsicSites, // count of sites is told by size of the section
+  CACHE_SECTION_COUNT
+} CacheSections;
+
+typedef struct {
+  unsigned int offset;
+  unsigned int size;
+} CacheSection;
+
+typedef struct {
+  unsigned int       magic;
+  unsigned int       version;
+  unsigned long long source_hash;
+  unsigned int       source_size;
+  unsigned int       token_count;
+  unsigned int       well_formed;
+  unsigned int       section_count;
+  CacheSection       sections[CACHE_SECTION_COUNT];
+  unsigned long long checksum; // of every section, in order
+} CacheHeader;
+
+// attaches artifacts of cache entry to loaded program
+// returns 0 if there's no valid entry for it
+_Bool
+cache_load(Program* program);
+
+// writes artifacts of indexed program, returns 0 on error
+_Bool
+cache_store(const Program* program);
+
+// removes entry of program if there's any, returns 0 on error
+_Bool
+cache_purge(const Program* program);
+
+#endif
@@ -0,0 +1,296 @@
+#include <stddef.h>
+
+#include "io.h"
+#include "common.h"
+#include "terms.h"
+#include "program.h"
+#include "cfg.h"
+
+#define LABEL_LIMIT   48U
+#define CRASH_TOKEN   0xFFFFFFFFU // jump that is known to fail
+
+typedef enum {
+  jkStatic,       // distance is pushed right before jump
+  jkConditional,  // distance is multiplied by flag that is known to be 0 or 1 right before jump
+  jkDynamic,
+} JumpKinds;
+
+// graph of single program is built at a time, arrays are too big for stack
+static unsigned char is_leader[INPUT_LIMIT + 1U];
+static unsigned char is_reachable[INPUT_LIMIT];
+static unsigned int  block_of[INPUT_LIMIT + 1U];
+static unsigned int  block_starts[INPUT_LIMIT + 1U];
+static unsigned int  worklist[INPUT_LIMIT];
+
+static _Bool
+is_jump(char ch)
+{
+  return ch == '[' || ch == ']' ? (_Bool)1 : (_Bool)0;
+}
+
+static _Bool
+is_terminator(char ch)
+{
+  return ch == '[' || ch == ']' || ch == '%' ? (_Bool)1 : (_Bool)0;
+}
+
+// token at which execution continues, token_count if it goes out of bounds at the end
+static unsigned int
+jump_destination(const Program* program, unsigned int jump, unsigned int distance)
+{
+  if (token_char(program, jump) == '[') {
+    if (distance == 0U)
+      return jump + 1U;
+    return distance <= jump ? jump - distance : CRASH_TOKEN;
+  }
+  return jump + distance < program->token_count ? jump + distance + 1U : CRASH_TOKEN;
+}
+
+// value on top after given token is 0 or 1 when it's made by comparison or read, or by '~' of such value
+// tokens that are jumped to could be entered with anything on the stack, so flag can't go through them
+static _Bool
+is_flag_made_at(const Program* program, unsigned int token)
+{
+  while (token_char(program, token) == '~') {
+    if (token == 0U || is_leader[token])
+      return (_Bool)0;
+    token--;
+  }
+  char ch = token_char(program, token);
+  return ch == '=' || ch == '?' || ch == '>' ? (_Bool)1 : (_Bool)0;
+}
+
+static JumpKinds
+classify_jump(const Program* program, unsigned int jump, unsigned int* distance)
+{
+  // jump that is landed on directly could be given any value
+  if (is_leader[jump])
+    return jkDynamic;
+
+  if (jump >= 1U && !is_operator_char(token_char(program, jump - 1U))) {
+    *distance = token_value(program, jump - 1U);
+    return jkStatic;
+  }
+  // distance multiplied by anything else could take jump anywhere in its direction
+  if (jump >= 3U &&
+      token_char(program, jump - 1U) == '*' &&
+      !is_operator_char(token_char(program, jump - 2U)) &&
+      !is_leader[jump - 1U] &&
+      !is_leader[jump - 2U] &&
+      is_flag_made_at(program, jump - 3U))
+  {
+    *distance = token_value(program, jump - 2U);
+    return jkConditional;
+  }
+  return jkDynamic;
+}
+
+static void
+mark_leader(unsigned int token)
+{
+  if (token != CRASH_TOKEN)
+    is_leader[token] = 1U;
+}
+
+static unsigned int worklist_len;
+
+static void
+visit(unsigned int block)
+{
+  if (!is_reachable[block]) {
+    is_reachable[block] = 1U;
+    worklist[worklist_len++] = block;
+  }
+}
+
+static void
+visit_token(const Program* program, unsigned int token)
+{
+  if (token != CRASH_TOKEN && token != program->token_count)
+    visit(block_of[token]);
+}
+
+static void
+write_node_name(TermiteHandle file, const Program* program, unsigned int token)
+{
+  if (token == CRASH_TOKEN)
+    write_cstring(file, "crash");
+  else if (token == program->token_count)
+    write_cstring(file, "exit");
+  else {
+    write_cstring(file, "b");
+    write_ulong(file, block_of[token]);
+  }
+}
+
+static void
+write_edge(TermiteHandle file, const Program* program, unsigned int block, unsigned int token, const char* label)
+{
+  write_cstring(file, "  b");
+  write_ulong(file, block);
+  write_cstring(file, " -> ");
+  write_node_name(file, program, token);
+  if (label != NULL) {
+    write_cstring(file, " [label=\"");
+    write_cstring(file, label);
+    write_cstring(file, "\"]");
+  }
+  write_cstring(file, ";\n");
+}
+
+static void
+write_block_label(TermiteHandle file, const Program* program, unsigned int first, unsigned int last)
+{
+  write_ulong(file, first);
+  if (last != first) {
+    write_cstring(file, "-");
+    write_ulong(file, last);
+  }
+  write_cstring(file, ": ");
+
+  unsigned int written = 0U;
+  for (unsigned int token = first; token <= last; token++) {
+    if (written >= LABEL_LIMIT) {
+      write_cstring(file, "...");
+      break;
+    }
+    unsigned int offset = program->token_offsets[token];
+    unsigned int len = token_end(program, token) - offset;
+    for (unsigned int i = 0U; i < len; i++) {
+      char ch = program->source[offset + i];
+      if (ch == '"' || ch == '\\')
+        write_cstring(file, "\\");
+      else if ((unsigned char)ch < 0x20U || (unsigned char)ch > 0x7EU)
+        ch = '?';
+      write_file(file, &ch, 1U);
+    }
+    written += len;
+    if (token != last)
+      write_cstring(file, " ");
+  }
+}
+
+_Bool
+write_cfg(TermiteHandle file, const Program* program)
+{
+  write_cstring(file, "digraph termite {\n  node [shape=box, fontname=\"monospace\"];\n");
+
+  if (!program->well_formed) {
+    write_cstring(file, "  label=\"program has malformed hex tokens\";\n}\n");
+    return (_Bool)0;
+  }
+
+  unsigned int count = program->token_count;
+  unsigned int distance = 0U;
+
+  for (unsigned int i = 0U; i <= count; i++)
+    is_leader[i] = 0U;
+  is_leader[0] = 1U;
+
+  // every block ends at terminator or right before something that is jumped to
+  for (unsigned int token = 0U; token < count; token++) {
+    char ch = token_char(program, token);
+    if (!is_terminator(ch))
+      continue;
+    is_leader[token + 1U] = 1U;
+
+    if (!is_jump(ch))
+      continue;
+    if (classify_jump(program, token, &distance) != jkDynamic)
+      mark_leader(jump_destination(program, token, distance));
+  }
+
+  unsigned int block_count = 0U;
+  for (unsigned int token = 0U; token < count; token++) {
+    if (is_leader[token])
+      block_starts[block_count++] = token;
+    block_of[token] = block_count - 1U;
+  }
+  block_starts[block_count] = count;
+
+  for (unsigned int i = 0U; i < block_count; i++)
+    is_reachable[i] = 0U;
+  worklist_len = 0U;
+  if (block_count != 0U)
+    visit(0U);
+
+  while (worklist_len != 0U) {
+    unsigned int block = worklist[--worklist_len];
+    unsigned int last = block_starts[block + 1U] - 1U;
+    char ch = token_char(program, last);
+
+    if (ch == '%')
+      continue;
+
+    if (!is_jump(ch)) {
+      visit_token(program, last + 1U);
+      continue;
+    }
+
+    switch (classify_jump(program, last, &distance)) {
+      case jkConditional:
+        visit_token(program, last + 1U);
+        // fallthrough
+      case jkStatic:
+        visit_token(program, jump_destination(program, last, distance));
+        break;
+      case jkDynamic: {
+        // anything in the direction of jump could be reached
+        for (unsigned int i = 0U; i < block_count; i++) {
+          if (ch == ']' ? block_starts[i] > last : block_starts[i] <= last + 1U)
+            visit(i);
+        }
+        break;
+      }
+    }
+  }
+
+  write_cstring(file, "  entry [shape=circle];\n  exit [shape=doublecircle];\n  crash [shape=octagon];\n");
+  write_cstring(file, "  dynamic [shape=diamond, label=\"dynamic target\"];\n");
+  if (block_count != 0U)
+    write_cstring(file, "  entry -> b0;\n");
+  else
+    write_cstring(file, "  entry -> exit;\n");
+
+  for (unsigned int block = 0U; block < block_count; block++) {
+    unsigned int first = block_starts[block];
+    unsigned int last = block_starts[block + 1U] - 1U;
+
+    write_cstring(file, "  b");
+    write_ulong(file, block);
+    write_cstring(file, " [label=\"");
+    write_block_label(file, program, first, last);
+    if (is_reachable[block])
+      write_cstring(file, "\"];\n");
+    else
+      write_cstring(file, "\", style=dashed, color=gray, fontcolor=gray, xlabel=\"unreachable\"];\n");
+
+    char ch = token_char(program, last);
+    if (ch == '%') {
+      write_edge(file, program, block, count, "%");
+      continue;
+    }
+    if (!is_jump(ch)) {
+      write_edge(file, program, block, last + 1U, NULL);
+      continue;
+    }
+
+    switch (classify_jump(program, last, &distance)) {
+      case jkStatic:
+        write_edge(file, program, block, jump_destination(program, last, distance), NULL);
+        break;
+      case jkConditional:
+        write_edge(file, program, block, last + 1U, "if 0");
+        write_edge(file, program, block, jump_destination(program, last, distance), "if 1");
+        break;
+      case jkDynamic:
+        write_cstring(file, "  b");
+        write_ulong(file, block);
+        write_cstring(file, ch == ']' ? " -> dynamic [style=dotted, label=\"seek\"];\n" : " -> dynamic [style=dotted, label=\"rewind\"];\n");
+        break;
+    }
+  }
+
+  write_cstring(file, "}\n");
+  return (_Bool)1;
+}
@@ -0,0 +1,17 @@
+#ifndef CFG_H
+#define CFG_H
+
+#include "io.h"
+#include "program.h"
+
+// Control flow graph of indexed program in DOT format
+//   Blocks are split at jumps, '%' and every statically known jump target
+//   Jumps by constant push are static edges, 'K*]' and 'K*[' are treated as conditional with boolean flag
+//   Any other jump is dynamic, conservatively everything in its direction is reachable from it
+//   Blocks that couldn't be reached from the beginning are drawn dashed and gray
+
+// returns 0 if program couldn't be analyzed, in which case graph has no blocks
+_Bool
+write_cfg(TermiteHandle file, const Program* program);
+
+#endif
@@ -0,0 +1,726 @@
+/*
+  Termite exhaustive checker
+
+  Runs program over every input of a domain and compares every run with run of oracle program over the same input,
+    inputs on which they differ in output or exit code are reported as counterexamples
+  Domain is either every byte tuple with length in given range, or list of inputs from file, one per line in hex syntax
+
+  Runs are resumable VMs, which suspend on '>' once input given so far is consumed, so inputs with common prefix
+    share everything that is done before the rest of them is read: state at such '>' is forked for every byte
+    that could come next, and for input that ends there
+  Once both runs are over, the rest of input can't change anything, so whole subtree of inputs is settled at once
+  Forks are spread over threads, each goes depth first through its own deque of them,
+    thread that runs out of forks steals the upper half of branches of the shallowest fork that another one has
+
+  Counterexample is written as input in hex pairs, with '..' when continuations of it are covered as well,
+    followed by outputs and exit codes of both runs, outputs are cut after REPORT_OUTPUT_LIMIT bytes
+  Only the first REPORT_LIMIT counterexamples are written and all of them are counted, order depends on timing of threads
+  With "matches" inputs on which runs agree are reported instead, which turns oracle into target of search
+  Runs that loop are stopped with OC_STEP_LIMIT after "steps=N" steps, which are counted from the start of input
+  Exit code is OC_OK if nothing is reported and OC_INVALID_INPUT otherwise
+
+  Usage: termite-check <program> <oracle> <length=N[-M] | list=path> [threads=N] [steps=N] [matches] [worker switches]...
+*/
+
+#define _GNU_SOURCE
+#define TERM_NO_WORKER_MAIN
+#define TERM_RESUMABLE_VM
+#include "worker.c"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "codec.h"
+
+#define LENGTH_LIMIT          7U // count of tuples up to it still fits into 64 bits
+#define THREAD_LIMIT          64U
+#define DEFAULT_STEP_LIMIT    1000000U
+#define OUTPUT_LIMIT          (16U * 1024U * 1024U) // writes past it fail, output is cut the same way for both runs
+#define REPORT_LIMIT          32U
+#define REPORT_OUTPUT_LIMIT   32U
+
+typedef struct {
+  VmState       vm;
+  TermiteMemory input; // prefix of its fork
+  TermiteMemory output;
+  int           exit_code;
+  _Bool         is_over;
+} Run;
+
+typedef struct Fork {
+  Run            runs[2];        // program and oracle
+  unsigned char* prefix;         // input given so far, room for the longest input of domain
+  unsigned int   depth;          // length of prefix
+  unsigned int   range_low;      // inputs of list that start with prefix, [low, high)
+  unsigned int   range_high;
+  unsigned int   next;           // branches that are left, [next, end), bytes for tuples and indices for list
+  unsigned int   end;
+  _Bool          is_end_pending; // input that ends with prefix is still to be run
+  struct Fork*   free_next;
+} Fork;
+
+typedef struct {
+  _Bool         is_end;
+  unsigned char byte;
+  unsigned int  low, high; // range of list inputs that continue with byte
+} Branch;
+
+typedef struct {
+  pthread_t          thread;
+  pthread_mutex_t    lock;       // guards deque and branches of forks in it, runs of them are never changed
+  Fork**             forks;      // bottom is the shallowest, every fork is deeper than the one below
+  unsigned int       fork_count;
+  Fork*              free_forks; // only owner takes and gives them, thieves included
+  unsigned int       index;
+  unsigned long long inputs;
+  unsigned long long reported;
+  unsigned long long forked;
+} Worker;
+
+typedef struct {
+  const unsigned char* data;
+  unsigned int         len;
+} ListInput;
+
+static Program programs[2];
+static WorkerArgs args;
+static unsigned int cell_size;
+
+static _Bool is_list;
+static unsigned int length_low;
+static unsigned int length_high;
+static ListInput* list;
+static unsigned int list_count;
+static unsigned int prefix_capacity;
+static _Bool is_reporting_matches;
+
+static Worker workers[THREAD_LIMIT];
+static unsigned int worker_count;
+static atomic_uint pending_forks; // forks in every deque, threads are done once it's 0 and there's nothing to steal
+static atomic_uint is_out_of_memory;
+
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int report_count;
+
+static _Bool
+reserve_output(TermiteMemory* memory, unsigned int required)
+{
+  if (required > OUTPUT_LIMIT)
+    return (_Bool)0;
+  unsigned int capacity = memory->capacity != 0U ? memory->capacity : 256U;
+  while (capacity < required)
+    capacity *= 2U;
+
+  unsigned char* data = realloc(memory->data, capacity);
+  if (data == NULL)
+    return (_Bool)0;
+  memory->data = data;
+  memory->capacity = capacity;
+  return (_Bool)1;
+}
+
+static void
+free_fork(Fork* fork)
+{
+  for (unsigned int r = 0U; r < 2U; r++) {
+    free(fork->runs[r].vm.cells);
+    free(fork->runs[r].output.data);
+  }
+  free(fork->prefix);
+  free(fork);
+}
+
+// returns NULL when out of memory, which stops every thread
+static Fork*
+take_fork(Worker* worker)
+{
+  Fork* fork = worker->free_forks;
+  if (fork != NULL) {
+    worker->free_forks = fork->free_next;
+    return fork;
+  }
+
+  fork = calloc(1U, sizeof(Fork));
+  if (fork != NULL) {
+    fork->prefix = malloc(prefix_capacity != 0U ? prefix_capacity : 1U);
+    fork->runs[0].vm.cells = malloc(STACK_LIMIT * cell_size);
+    fork->runs[1].vm.cells = malloc(STACK_LIMIT * cell_size);
+    if (fork->prefix != NULL && fork->runs[0].vm.cells != NULL && fork->runs[1].vm.cells != NULL)
+      return fork;
+    free_fork(fork);
+  }
+  atomic_store(&is_out_of_memory, 1U);
+  return NULL;
+}
+
+static void
+release_fork(Worker* worker, Fork* fork)
+{
+  fork->free_next = worker->free_forks;
+  worker->free_forks = fork;
+}
+
+// runs of one are made the same as of other, branches aren't copied
+static _Bool
+copy_fork(Fork* to, const Fork* from)
+{
+  memcpy(to->prefix, from->prefix, from->depth);
+  to->depth = from->depth;
+  to->range_low = from->range_low;
+  to->range_high = from->range_high;
+
+  for (unsigned int r = 0U; r < 2U; r++) {
+    Run* run = &to->runs[r];
+    const Run* source = &from->runs[r];
+
+    // cells past stack head are always written before they're read
+    void* cells = run->vm.cells;
+    run->vm = source->vm;
+    run->vm.cells = cells;
+    run->vm.input = &run->input;
+    memcpy(cells, source->vm.cells, (size_t)source->vm.stack_head * cell_size);
+
+    run->input = source->input;
+    run->input.data = to->prefix;
+
+    run->output.size = 0U;
+    run->output.reserve = reserve_output;
+    if (source->output.size > run->output.capacity && !reserve_output(&run->output, source->output.size)) {
+      atomic_store(&is_out_of_memory, 1U);
+      return (_Bool)0;
+    }
+    if (source->output.size != 0U)
+      memcpy(run->output.data, source->output.data, source->output.size);
+    run->output.size = source->output.size;
+
+    run->exit_code = source->exit_code;
+    run->is_over = source->is_over;
+  }
+  return (_Bool)1;
+}
+
+// runs that are left go on until they want input past prefix or are over
+static void
+advance_runs(Fork* fork)
+{
+  for (unsigned int r = 0U; r < 2U; r++) {
+    Run* run = &fork->runs[r];
+    if (run->is_over)
+      continue;
+    run->input.size = fork->depth;
+    int status = resume_program(&run->vm, memory_handle(&run->output), args);
+    if (status != VM_WAITING) {
+      run->exit_code = status;
+      run->is_over = (_Bool)1;
+    }
+  }
+}
+
+// inputs of domain that start with prefix, prefix itself included
+static unsigned long long
+count_subtree(const Fork* fork)
+{
+  if (is_list)
+    return fork->range_high - fork->range_low;
+
+  unsigned long long count = 0U;
+  unsigned long long level = 1U;
+  for (unsigned int len = fork->depth; len <= length_high; len++) {
+    if (len >= length_low)
+      count += level;
+    level *= 256U;
+  }
+  return count;
+}
+
+// there are inputs of domain that are longer than prefix and start with it
+static _Bool
+has_continuations(const Fork* fork)
+{
+  // input that ends with prefix is sorted before the rest of its range
+  if (is_list)
+    return list[fork->range_high - 1U].len > fork->depth ? (_Bool)1 : (_Bool)0;
+  return fork->depth < length_high ? (_Bool)1 : (_Bool)0;
+}
+
+static void
+open_branches(Fork* fork)
+{
+  if (is_list) {
+    fork->is_end_pending = list[fork->range_low].len == fork->depth ? (_Bool)1 : (_Bool)0;
+    fork->next = fork->is_end_pending ? fork->range_low + 1U : fork->range_low;
+    fork->end = fork->range_high;
+  } else {
+    fork->is_end_pending = fork->depth >= length_low ? (_Bool)1 : (_Bool)0;
+    fork->next = 0U;
+    fork->end = fork->depth < length_high ? 256U : 0U;
+  }
+}
+
+// first branch after given one that continues with another byte, list inputs with the same one are single branch
+static unsigned int
+next_branch(const Fork* fork, unsigned int index)
+{
+  if (!is_list)
+    return index + 1U;
+  unsigned char byte = list[index].data[fork->depth];
+  unsigned int next = index + 1U;
+  while (next < fork->end && list[next].data[fork->depth] == byte)
+    next++;
+  return next;
+}
+
+// returns 0 if fork has no branches left
+static _Bool
+take_branch(Fork* fork, Branch* branch)
+{
+  if (fork->is_end_pending) {
+    fork->is_end_pending = (_Bool)0;
+    branch->is_end = (_Bool)1;
+    return (_Bool)1;
+  }
+  if (fork->next == fork->end)
+    return (_Bool)0;
+
+  branch->is_end = (_Bool)0;
+  branch->byte = is_list ? list[fork->next].data[fork->depth] : (unsigned char)fork->next;
+  branch->low = fork->next;
+  fork->next = next_branch(fork, fork->next);
+  branch->high = fork->next;
+  return (_Bool)1;
+}
+
+// returns 0 if fork has less than two branches left, otherwise first branch of the upper half in middle
+static _Bool
+split_branches(const Fork* fork, unsigned int* middle)
+{
+  if (fork->end - fork->next < 2U)
+    return (_Bool)0;
+  unsigned int split = fork->next + (fork->end - fork->next) / 2U;
+  if (is_list) {
+    unsigned char byte = list[split - 1U].data[fork->depth];
+    while (split < fork->end && list[split].data[fork->depth] == byte)
+      split++;
+    if (split == fork->end)
+      return (_Bool)0;
+  }
+  *middle = split;
+  return (_Bool)1;
+}
+
+static void
+write_hex_bytes(TermiteHandle file, const unsigned char* data, unsigned int len, unsigned int limit)
+{
+  static const char digits[] = "0123456789ABCDEF";
+  if (len == 0U)
+    write_cstring(file, "(empty)");
+  for (unsigned int i = 0U; i < len && i < limit; i++) {
+    char pair[3] = { digits[data[i] >> 4U], digits[data[i] & 0xFU], ' ' };
+    write_file(file, pair, i + 1U != len ? 3U : 2U);
+  }
+  if (len > limit)
+    write_cstring(file, "..");
+}
+
+static void
+write_run(TermiteHandle file, const char* name, const Run* run)
+{
+  write_cstring(file, name);
+  write_cstring(file, "exit ");
+  write_ulong(file, (unsigned long long)(unsigned char)run->exit_code);
+  write_cstring(file, ", output ");
+  write_hex_bytes(file, run->output.data, run->output.size, REPORT_OUTPUT_LIMIT);
+  write_cstring(file, "\n");
+}
+
+// result of both runs stands for count inputs that start with prefix
+static void
+settle(Worker* worker, const Fork* fork, unsigned long long count, _Bool is_continued)
+{
+  worker->inputs += count;
+  const Run* program_run = &fork->runs[0];
+  const Run* oracle_run = &fork->runs[1];
+  _Bool is_same = program_run->exit_code == oracle_run->exit_code &&
+                  compare_byte_array(program_run->output.data, program_run->output.size,
+                                     oracle_run->output.data, oracle_run->output.size) ? (_Bool)1 : (_Bool)0;
+  if (is_same != is_reporting_matches)
+    return;
+
+  worker->reported += count;
+  pthread_mutex_lock(&report_lock);
+  if (report_count < REPORT_LIMIT) {
+    TermiteHandle out = get_stdout();
+    write_cstring(out, "input ");
+    write_hex_bytes(out, fork->prefix, fork->depth, ~0U);
+    if (is_continued) {
+      write_cstring(out, " .. (");
+      write_ulong(out, count);
+      write_cstring(out, count != 1U ? " inputs)" : " input)");
+    }
+    write_cstring(out, "\n");
+    write_run(out, "  program ", program_run);
+    write_run(out, "  oracle  ", oracle_run);
+  }
+  report_count++;
+  pthread_mutex_unlock(&report_lock);
+}
+
+// runs over input that ends with prefix are finished
+static void
+finish_input(Worker* worker, Fork* fork)
+{
+  fork->runs[0].vm.is_input_closed = (_Bool)1;
+  fork->runs[1].vm.is_input_closed = (_Bool)1;
+  advance_runs(fork);
+  settle(worker, fork, 1U, (_Bool)0);
+  release_fork(worker, fork);
+}
+
+static void
+push_fork(Worker* worker, Fork* fork)
+{
+  atomic_fetch_add(&pending_forks, 1U);
+  pthread_mutex_lock(&worker->lock);
+  worker->forks[worker->fork_count++] = fork;
+  pthread_mutex_unlock(&worker->lock);
+  worker->forked++;
+}
+
+// fork is a copy of parent, branch is applied to it and runs go on until fork either settles or has to branch
+static void
+explore(Worker* worker, Fork* fork, Branch branch)
+{
+  if (branch.is_end) {
+    finish_input(worker, fork);
+    return;
+  }
+
+  while (1) {
+    fork->prefix[fork->depth++] = branch.byte;
+    fork->range_low = branch.low;
+    fork->range_high = branch.high;
+    advance_runs(fork);
+    if (fork->runs[0].is_over && fork->runs[1].is_over) {
+      settle(worker, fork, count_subtree(fork), has_continuations(fork));
+      release_fork(worker, fork);
+      return;
+    }
+
+    open_branches(fork);
+    // the only way on is taken in place, which is what inputs of list mostly have
+    if (!fork->is_end_pending && fork->next != fork->end && next_branch(fork, fork->next) == fork->end) {
+      take_branch(fork, &branch);
+      continue;
+    }
+    if (fork->next == fork->end) {
+      finish_input(worker, fork);
+      return;
+    }
+    push_fork(worker, fork);
+    return;
+  }
+}
+
+// copy of the shallowest fork of another thread that could be split, with the upper half of its branches
+static Fork*
+steal(Worker* thief)
+{
+  for (unsigned int n = 1U; n < worker_count; n++) {
+    Worker* victim = &workers[(thief->index + n) % worker_count];
+    Fork* stolen = NULL;
+
+    pthread_mutex_lock(&victim->lock);
+    for (unsigned int i = 0U; i < victim->fork_count; i++) {
+      Fork* fork = victim->forks[i];
+      unsigned int middle;
+      if (!split_branches(fork, &middle))
+        continue;
+      stolen = take_fork(thief);
+      if (stolen != NULL && !copy_fork(stolen, fork)) {
+        release_fork(thief, stolen);
+        stolen = NULL;
+      }
+      if (stolen != NULL) {
+        stolen->is_end_pending = (_Bool)0;
+        stolen->next = middle;
+        stolen->end = fork->end;
+        fork->end = middle;
+        // counted before victim could drop its part, so that pending forks never look like 0 in between
+        atomic_fetch_add(&pending_forks, 1U);
+      }
+      break;
+    }
+    pthread_mutex_unlock(&victim->lock);
+
+    if (stolen != NULL)
+      return stolen;
+  }
+  return NULL;
+}
+
+static void*
+work(void* context)
+{
+  Worker* worker = context;
+  while (atomic_load(&is_out_of_memory) == 0U) {
+    Fork* parent = NULL;
+    Branch branch;
+
+    pthread_mutex_lock(&worker->lock);
+    while (worker->fork_count != 0U) {
+      Fork* top = worker->forks[worker->fork_count - 1U];
+      if (take_branch(top, &branch)) {
+        parent = top;
+        break;
+      }
+      worker->fork_count--;
+      release_fork(worker, top);
+      atomic_fetch_sub(&pending_forks, 1U);
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    if (parent == NULL) {
+      Fork* stolen = steal(worker);
+      if (stolen != NULL) {
+        pthread_mutex_lock(&worker->lock);
+        worker->forks[worker->fork_count++] = stolen;
+        pthread_mutex_unlock(&worker->lock);
+      } else if (atomic_load(&pending_forks) == 0U)
+        break;
+      else
+        sched_yield();
+      continue;
+    }
+
+    // runs of forks in deque stay the same, so parent is copied without holding the lock
+    Fork* child = take_fork(worker);
+    if (child == NULL)
+      break;
+    if (!copy_fork(child, parent)) {
+      release_fork(worker, child);
+      break;
+    }
+    explore(worker, child, branch);
+  }
+  return NULL;
+}
+
+static int
+compare_list_inputs(const void* first, const void* second)
+{
+  const ListInput* a = first;
+  const ListInput* b = second;
+  int order = memcmp(a->data, b->data, a->len < b->len ? a->len : b->len);
+  if (order != 0)
+    return order;
+  return a->len < b->len ? -1 : a->len > b->len ? 1 : 0;
+}
+
+// every line of file is input in hex syntax, list is sorted and has no duplicates after it
+static int
+load_list(const char* path)
+{
+  TermiteMapping mapping;
+  if (!map_file(path, &mapping))
+    return OC_FILE_ERROR;
+
+  unsigned char* decoded = malloc(mapping.size);
+  list = malloc(((size_t)mapping.size + 1U) * sizeof(ListInput));
+  if (decoded == NULL || list == NULL) {
+    unmap_file(&mapping);
+    return OC_FILE_ERROR;
+  }
+
+  unsigned int decoded_size = 0U;
+  unsigned int line = 1U;
+  for (unsigned int start = 0U; start < mapping.size; line++) {
+    unsigned int end = start;
+    while (end < mapping.size && mapping.data[end] != '\n')
+      end++;
+    unsigned int len = end;
+    if (len != start && mapping.data[len - 1U] == '\r')
+      len--;
+
+    unsigned int size;
+    if (!codec_decode(&mapping.data[start], len - start, &decoded[decoded_size], &size)) {
+      TermiteHandle err = get_stderr();
+      write_cstring(err, "hex char without a pair on line ");
+      write_ulong(err, line);
+      write_cstring(err, "\n");
+      unmap_file(&mapping);
+      return OC_INVALID_INPUT;
+    }
+    list[list_count++] = (ListInput){ &decoded[decoded_size], size };
+    decoded_size += size;
+    if (size > prefix_capacity)
+      prefix_capacity = size;
+    start = end + 1U;
+  }
+  unmap_file(&mapping);
+
+  qsort(list, list_count, sizeof(ListInput), compare_list_inputs);
+  unsigned int unique = 0U;
+  for (unsigned int i = 0U; i < list_count; i++) {
+    if (unique == 0U || compare_list_inputs(&list[unique - 1U], &list[i]) != 0)
+      list[unique++] = list[i];
+  }
+  list_count = unique;
+  return OC_OK;
+}
+
+static int
+load_checked_program(const char* path, Program* program)
+{
+  TermiteHandle file;
+  if (!open_file(path, &file, foFileRead))
+    return OC_FILE_ERROR;
+  int return_code = prepare_program(program, file, args);
+  if (!close_file(file) && return_code == OC_OK)
+    return_code = OC_FILE_ERROR;
+  return return_code;
+}
+
+// root fork has both runs started, they're either over or wait for the first byte
+static _Bool
+start_runs(Worker* worker)
+{
+  Fork* root = take_fork(worker);
+  if (root == NULL)
+    return (_Bool)0;
+  for (unsigned int r = 0U; r < 2U; r++) {
+    Run* run = &root->runs[r];
+    init_vm(&run->vm, &programs[r], &run->input, run->vm.cells);
+    run->vm.slice_end = ~0ULL;
+    run->input = (TermiteMemory){ .data = root->prefix };
+    run->output.size = 0U;
+    run->output.reserve = reserve_output;
+    run->is_over = (_Bool)0;
+  }
+  root->depth = 0U;
+  root->range_low = 0U;
+  root->range_high = list_count;
+
+  advance_runs(root);
+  if (root->runs[0].is_over && root->runs[1].is_over) {
+    settle(worker, root, count_subtree(root), has_continuations(root));
+    release_fork(worker, root);
+  } else {
+    open_branches(root);
+    push_fork(worker, root);
+  }
+  return (_Bool)1;
+}
+
+int
+term_main(int argc, const char** argv)
+{
+  if (argc < 4)
+    return OC_INVALID_INPUT;
+
+  init_io();
+
+  _Bool has_domain = (_Bool)0;
+  const char* list_path = NULL;
+  long online = sysconf(_SC_NPROCESSORS_ONLN);
+  worker_count = online < 1 ? 1U : online > (long)THREAD_LIMIT ? THREAD_LIMIT : (unsigned int)online;
+  args.step_limit = DEFAULT_STEP_LIMIT;
+
+  for (int i = 3; i < argc; i++) {
+    const char* value;
+    unsigned int low, high;
+    if ((value = match_arg_key(argv[i], "length=")) != NULL && parse_range(value, &low, &high) &&
+        high <= LENGTH_LIMIT)
+    {
+      has_domain = (_Bool)1;
+      length_low = low;
+      length_high = high;
+    } else if ((value = match_arg_key(argv[i], "list=")) != NULL && *value != '\0') {
+      has_domain = (_Bool)1;
+      list_path = value;
+    } else if ((value = match_arg_key(argv[i], "threads=")) != NULL && parse_range(value, &low, &high) &&
+               low == high && low != 0U && low <= THREAD_LIMIT)
+    {
+      worker_count = low;
+    } else if ((value = match_arg_key(argv[i], "steps=")) != NULL && parse_range(value, &low, &high) && low == high) {
+      args.step_limit = low;
+    } else if (compare_cstring(argv[i], "matches")) {
+      is_reporting_matches = (_Bool)1;
+    } else if (!parse_worker_arg(argv[i], &args))
+      return OC_INVALID_INPUT;
+  }
+  if (!has_domain)
+    return OC_INVALID_INPUT;
+  cell_size = args.wide_cells ? sizeof(unsigned short) : sizeof(unsigned char);
+
+  int return_code = load_checked_program(argv[1], &programs[0]);
+  if (return_code == OC_OK)
+    return_code = load_checked_program(argv[2], &programs[1]);
+  if (return_code == OC_OK && list_path != NULL) {
+    is_list = (_Bool)1;
+    return_code = load_list(list_path);
+  } else
+    prefix_capacity = length_high;
+  if (return_code != OC_OK)
+    return return_code;
+
+  for (unsigned int w = 0U; w < worker_count; w++) {
+    workers[w].index = w;
+    pthread_mutex_init(&workers[w].lock, NULL);
+    // every fork in deque is deeper than the one below it
+    workers[w].forks = malloc(((size_t)prefix_capacity + 1U) * sizeof(Fork*));
+    if (workers[w].forks == NULL)
+      return OC_FILE_ERROR;
+  }
+
+  if (!is_list || list_count != 0U) {
+    if (!start_runs(&workers[0]))
+      atomic_store(&is_out_of_memory, 1U);
+  }
+
+  unsigned int started = 0U;
+  for (; started < worker_count; started++) {
+    if (pthread_create(&workers[started].thread, NULL, work, &workers[started]) != 0)
+      break;
+  }
+  // threads that couldn't be started leave their share to others, deque of the first one is taken by stealing
+  if (started == 0U)
+    work(&workers[0]);
+  for (unsigned int w = 0U; w < started; w++)
+    pthread_join(workers[w].thread, NULL);
+
+  unsigned long long inputs = 0U;
+  unsigned long long reported = 0U;
+  unsigned long long forked = 0U;
+  for (unsigned int w = 0U; w < worker_count; w++) {
+    inputs += workers[w].inputs;
+    reported += workers[w].reported;
+    forked += workers[w].forked;
+  }
+
+  TermiteHandle out = get_stdout();
+  if (report_count > REPORT_LIMIT) {
+    write_ulong(out, report_count - REPORT_LIMIT);
+    write_cstring(out, " more are not shown\n");
+  }
+  write_cstring(out, "checked ");
+  write_ulong(out, inputs);
+  write_cstring(out, " inputs, ");
+  write_ulong(out, reported);
+  write_cstring(out, is_reporting_matches ? " matches, " : " counterexamples, ");
+  write_ulong(out, forked);
+  write_cstring(out, " forks, ");
+  write_ulong(out, started != 0U ? started : 1U);
+  write_cstring(out, " threads\n");
+
+  if (atomic_load(&is_out_of_memory) != 0U) {
+    write_cstring(get_stderr(), "out of memory\n");
+    return_code = OC_FILE_ERROR;
+  } else if (reported != 0U)
+    return_code = OC_INVALID_INPUT;
+  deinit_io();
+  return return_code;
+}
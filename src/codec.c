@@ -0,0 +1,335 @@
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "codec.h"
+
+#define ALL_BITS 0xFFFFFFFFFFFFFFFFULL
+
+static const char digits[] = "0123456789ABCDEF";
+
+static inline _Bool
+is_hex(unsigned char ch)
+{
+  return (ch >= 'A' && ch <= 'F') || (ch >= '0' && ch <= '9') ? (_Bool)1 : (_Bool)0;
+}
+
+static inline _Bool
+is_invisible(unsigned char ch)
+{
+  return ch == 0x7FU || (ch < 0x20U && ch != '\t' && ch != '\n') ? (_Bool)1 : (_Bool)0;
+}
+
+// whitespace of data, program tokens are also separated by '\r'
+static inline _Bool
+is_space(unsigned char ch, _Bool with_return)
+{
+  return ch == ' ' || ch == '\n' || ch == '\t' || (with_return && ch == '\r') ? (_Bool)1 : (_Bool)0;
+}
+
+static inline unsigned char
+nibble(unsigned char ch)
+{
+  return ch > '9' ? (unsigned char)(ch - 'A' + 10) : (unsigned char)(ch - '0');
+}
+
+#if defined(__SSE2__)
+
+// bytes in [low, high], compared as unsigned
+static inline __m128i
+in_range(__m128i bytes, unsigned char low, unsigned char high)
+{
+  __m128i shifted = _mm_sub_epi8(bytes, _mm_set1_epi8((char)low));
+  return _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8((char)(high - low))), shifted);
+}
+
+static inline __m128i
+equal_to(__m128i bytes, unsigned char value)
+{
+  return _mm_cmpeq_epi8(bytes, _mm_set1_epi8((char)value));
+}
+
+static inline __m128i
+lane_hex(__m128i bytes)
+{
+  return _mm_or_si128(in_range(bytes, '0', '9'), in_range(bytes, 'A', 'F'));
+}
+
+static inline __m128i
+lane_space(__m128i bytes, _Bool with_return)
+{
+  __m128i space = _mm_or_si128(_mm_or_si128(equal_to(bytes, ' '), equal_to(bytes, '\n')), equal_to(bytes, '\t'));
+  return with_return ? _mm_or_si128(space, equal_to(bytes, '\r')) : space;
+}
+
+static inline __m128i
+lane_invisible(__m128i bytes)
+{
+  __m128i control = _mm_andnot_si128(_mm_or_si128(equal_to(bytes, '\t'), equal_to(bytes, '\n')), in_range(bytes, 0x00U, 0x1FU));
+  return _mm_or_si128(control, equal_to(bytes, 0x7FU));
+}
+
+// every class is computed over four lanes of 16 bytes
+#define BLOCK_MASK(block, lane) \
+  do { \
+    unsigned long long mask = 0ULL; \
+    for (unsigned int l = 0U; l < CODEC_BLOCK / 16U; l++) { \
+      __m128i bytes = _mm_loadu_si128((const __m128i*)&(block)[l * 16U]); \
+      mask |= (unsigned long long)(unsigned int)_mm_movemask_epi8(lane) << (l * 16U); \
+    } \
+    return mask; \
+  } while (0)
+
+static unsigned long long
+hex_mask(const unsigned char* block)
+{
+  BLOCK_MASK(block, lane_hex(bytes));
+}
+
+static unsigned long long
+space_mask(const unsigned char* block, _Bool with_return)
+{
+  BLOCK_MASK(block, lane_space(bytes, with_return));
+}
+
+static unsigned long long
+invisible_mask(const unsigned char* block)
+{
+  BLOCK_MASK(block, lane_invisible(bytes));
+}
+
+#undef BLOCK_MASK
+
+#else
+
+#define BLOCK_MASK(block, test) \
+  do { \
+    unsigned long long mask = 0ULL; \
+    for (unsigned int i = 0U; i < CODEC_BLOCK; i++) \
+      mask |= (unsigned long long)test((block)[i]) << i; \
+    return mask; \
+  } while (0)
+
+static unsigned long long
+hex_mask(const unsigned char* block)
+{
+  BLOCK_MASK(block, is_hex);
+}
+
+static unsigned long long
+space_mask(const unsigned char* block, _Bool with_return)
+{
+#define IS_SPACE(ch) is_space(ch, with_return)
+  BLOCK_MASK(block, IS_SPACE);
+#undef IS_SPACE
+}
+
+static unsigned long long
+invisible_mask(const unsigned char* block)
+{
+  BLOCK_MASK(block, is_invisible);
+}
+
+#undef BLOCK_MASK
+
+#endif
+
+// count of set bits starting at given one, up to the end of block
+static inline unsigned int
+run_length(unsigned long long mask, unsigned int start)
+{
+  unsigned long long unset = ~(mask >> start);
+  return unset != 0ULL ? (unsigned int)__builtin_ctzll(unset) : CODEC_BLOCK;
+}
+
+// count is a number of pairs, so in holds twice as many chars
+static void
+decode_pairs(const unsigned char* in, unsigned int count, unsigned char* out)
+{
+  unsigned int i = 0U;
+#if defined(__SSE2__)
+  // 16 chars give 8 bytes, first char of pair is the low byte of its 16 bit lane
+  for (; i + 8U <= count; i += 8U) {
+    __m128i chars = _mm_loadu_si128((const __m128i*)&in[i * 2U]);
+    __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('9')), _mm_set1_epi8(7));
+    __m128i nibbles = _mm_sub_epi8(_mm_sub_epi8(chars, _mm_set1_epi8('0')), letters);
+    __m128i high = _mm_slli_epi16(_mm_and_si128(nibbles, _mm_set1_epi16(0x00FF)), 4);
+    __m128i values = _mm_or_si128(high, _mm_srli_epi16(nibbles, 8));
+    _mm_storel_epi64((__m128i*)&out[i], _mm_packus_epi16(values, values));
+  }
+#endif
+  for (; i < count; i++)
+    out[i] = (unsigned char)(nibble(in[i * 2U]) << 4U | nibble(in[i * 2U + 1U]));
+}
+
+unsigned int
+codec_escape(const unsigned char* in, unsigned int len, unsigned char* out)
+{
+  unsigned int size = 0U;
+  unsigned int i = 0U;
+
+  // only invisible bytes are visited, spans between them are copied
+  for (; i + CODEC_BLOCK <= len; i += CODEC_BLOCK) {
+    unsigned long long invisible = invisible_mask(&in[i]);
+    unsigned int copied = 0U;
+    while (invisible != 0ULL) {
+      unsigned int at = (unsigned int)__builtin_ctzll(invisible);
+      memcpy(&out[size], &in[i + copied], at - copied);
+      size += at - copied;
+      out[size++] = (unsigned char)digits[in[i + at] >> 4U];
+      out[size++] = (unsigned char)digits[in[i + at] & 0xFU];
+      copied = at + 1U;
+      invisible &= invisible - 1ULL;
+    }
+    memcpy(&out[size], &in[i + copied], CODEC_BLOCK - copied);
+    size += CODEC_BLOCK - copied;
+  }
+
+  for (; i < len; i++) {
+    if (is_invisible(in[i])) {
+      out[size++] = (unsigned char)digits[in[i] >> 4U];
+      out[size++] = (unsigned char)digits[in[i] & 0xFU];
+    } else
+      out[size++] = in[i];
+  }
+  return size;
+}
+
+_Bool
+codec_decode(const unsigned char* in, unsigned int len, unsigned char* out, unsigned int* size)
+{
+  unsigned int written = 0U;
+  unsigned int i = 0U;
+
+  // every block starts at token boundary
+  while (i + CODEC_BLOCK <= len) {
+    unsigned long long hex = hex_mask(&in[i]);
+    unsigned long long space = space_mask(&in[i], (_Bool)0);
+
+    unsigned int at = 0U;
+    while (at != CODEC_BLOCK) {
+      unsigned long long special = (hex | space) >> at;
+      unsigned int literals = special != 0ULL ? (unsigned int)__builtin_ctzll(special) : CODEC_BLOCK - at;
+      memcpy(&out[written], &in[i + at], literals);
+      written += literals;
+      at += literals;
+      if (at == CODEC_BLOCK)
+        break;
+
+      if ((space >> at & 1ULL) != 0ULL) {
+        at += run_length(space, at);
+        continue;
+      }
+
+      unsigned int run = run_length(hex, at);
+      decode_pairs(&in[i + at], run / 2U, &out[written]);
+      written += run / 2U;
+      at += run & ~1U;
+      if ((run & 1U) != 0U) {
+        // odd char at the end of block could still be paired with the first char of the next one
+        if (at + 1U != CODEC_BLOCK) {
+          *size = i + at;
+          return (_Bool)0;
+        }
+        break;
+      }
+    }
+    i += at;
+
+    if (at != CODEC_BLOCK) {
+      if (i + 1U == len || !is_hex(in[i + 1U])) {
+        *size = i;
+        return (_Bool)0;
+      }
+      out[written++] = (unsigned char)(nibble(in[i]) << 4U | nibble(in[i + 1U]));
+      i += 2U;
+    }
+  }
+
+  for (; i < len; i++) {
+    if (is_hex(in[i])) {
+      if (i + 1U == len || !is_hex(in[i + 1U])) {
+        *size = i;
+        return (_Bool)0;
+      }
+      out[written++] = (unsigned char)(nibble(in[i]) << 4U | nibble(in[i + 1U]));
+      i++;
+    } else if (!is_space(in[i], (_Bool)0))
+      out[written++] = in[i];
+  }
+  *size = written;
+  return (_Bool)1;
+}
+
+// every char that isn't whitespace is a token, except that hex pairs count once,
+// so only lengths of hex runs are checked, and those are found block by block
+_Bool
+codec_count_tokens(const unsigned char* in, unsigned int len, unsigned int* count)
+{
+  unsigned int chars = 0U;
+  unsigned int hex_chars = 0U;
+  _Bool is_in_run = (_Bool)0; // hex run reaches the end of previous block
+  unsigned int run_parity = 0U;
+  unsigned int i = 0U;
+
+  for (; i + CODEC_BLOCK <= len; i += CODEC_BLOCK) {
+    unsigned long long hex = hex_mask(&in[i]);
+    chars += CODEC_BLOCK - (unsigned int)__builtin_popcountll(space_mask(&in[i], (_Bool)1));
+    hex_chars += (unsigned int)__builtin_popcountll(hex);
+
+    unsigned int at = 0U;
+    if (is_in_run) {
+      unsigned int run = run_length(hex, 0U);
+      run_parity ^= run & 1U;
+      if (run == CODEC_BLOCK)
+        continue;
+      if (run_parity != 0U) {
+        *count = i + run - 1U;
+        return (_Bool)0;
+      }
+      is_in_run = (_Bool)0;
+      at = run;
+    }
+
+    while (at != CODEC_BLOCK && (hex >> at) != 0ULL) {
+      at += (unsigned int)__builtin_ctzll(hex >> at);
+      unsigned int run = run_length(hex, at);
+      if (at + run == CODEC_BLOCK) {
+        is_in_run = (_Bool)1;
+        run_parity = run & 1U;
+        break;
+      }
+      if ((run & 1U) != 0U) {
+        *count = i + at + run - 1U;
+        return (_Bool)0;
+      }
+      at += run;
+    }
+  }
+
+  for (; i < len; i++) {
+    if (is_hex(in[i])) {
+      run_parity = is_in_run ? run_parity ^ 1U : 1U;
+      is_in_run = (_Bool)1;
+      hex_chars++;
+      chars++;
+      continue;
+    }
+    if (is_in_run && run_parity != 0U) {
+      *count = i - 1U;
+      return (_Bool)0;
+    }
+    is_in_run = (_Bool)0;
+    if (!is_space(in[i], (_Bool)1))
+      chars++;
+  }
+  if (is_in_run && run_parity != 0U) {
+    *count = len - 1U;
+    return (_Bool)0;
+  }
+
+  *count = chars - hex_chars / 2U;
+  return (_Bool)1;
+}
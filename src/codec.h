@@ -0,0 +1,29 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+// Conversions between raw bytes and termite hex syntax
+//   Nothing here does io or allocates, so the same source is also built as shared library for Python
+//   Input is classified in blocks of CODEC_BLOCK bytes into bit masks, one bit per byte,
+//   spans that need no conversion are copied whole and runs of hex chars are decoded by pairs
+//   Masks are computed with SSE2 when compiler targets it and by plain loops otherwise
+//   Hex chars are only '0'-'9' and 'A'-'F', lowercase letters are taken as they are
+
+#define CODEC_BLOCK 64U
+
+// invisible bytes are the ones below 20 except '\t' and '\n', and 7F, they become hex pairs
+// out needs room for twice the len, returns size of escaped output
+unsigned int
+codec_escape(const unsigned char* in, unsigned int len, unsigned char* out);
+
+// hex pairs become bytes, ' ', '\n' and '\t' are dropped and everything else is taken as it is
+// out needs room for len
+// returns 0 on hex char without a pair, then *size is offset of it, otherwise *size is size of decoded output
+_Bool
+codec_decode(const unsigned char* in, unsigned int len, unsigned char* out, unsigned int* size);
+
+// tokens of termite program: hex pair or any other char that isn't whitespace, '\r' included
+// returns 0 on hex char without a pair, then *count is offset of it
+_Bool
+codec_count_tokens(const unsigned char* in, unsigned int len, unsigned int* count);
+
+#endif
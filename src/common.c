@@ -27,6 +27,19 @@ write_byte_array(TermiteHandle file, unsigned char* chars, unsigned int len)
   }
 }
 
+void
+write_short_array(TermiteHandle file, unsigned short* values, unsigned int len)
+{
+  const char space = ' ';
+  for (unsigned int i = 0U; i < len; i++) {
+    write_byte(file, (unsigned char)(values[i] >> 8U));
+    write_byte(file, (unsigned char)values[i]);
+
+    if (i != len - 1U)
+      write_file(file, &space, 1U);
+  }
+}
+
 void
 write_cstring(TermiteHandle file, const char* str) {
   write_file(file, str, count_cstring(str));
@@ -44,6 +57,18 @@ write_uint(TermiteHandle file, unsigned int value) {
   write_file(file, &builder_buff[builder_idx], MAX_DECIMAL_CHARS_UINT - builder_idx);
 }
 
+void
+write_ulong(TermiteHandle file, unsigned long long value) {
+  char builder_buff[20]; // maximum of 64 bit value is 20 digits long
+  unsigned int builder_idx = sizeof(builder_buff);
+
+  do {
+    builder_buff[--builder_idx] = (value % 10U) + 0x30;
+    value /= 10U;
+  } while (value != 0U);
+  write_file(file, &builder_buff[builder_idx], sizeof(builder_buff) - builder_idx);
+}
+
 // todo: restrict might be dangerous in this case
 _Bool
 compare_byte_array(unsigned char* restrict first, unsigned int first_len,
@@ -72,7 +97,8 @@ compare_cstring(const char* restrict first, const char* restrict second)
     first++;
     second++;
   }
-  return (_Bool)1;
+  // one string being prefix of another is not a match
+  return *first == *second ? (_Bool)1 : (_Bool)0;
 }
 
 unsigned int
@@ -86,3 +112,23 @@ count_cstring(const char* str) {
 
   return len;
 }
+
+unsigned long long
+hash_byte_array(unsigned long long seed, const unsigned char* bytes, unsigned int len)
+{
+  unsigned long long result = seed;
+  for (unsigned int i = 0U; i < len; i++) {
+    result ^= bytes[i];
+    result *= 0x100000001B3ULL;
+  }
+  return result;
+}
+
+void
+format_hash(unsigned long long value, char* result)
+{
+  for (unsigned int i = 16U; i--;) {
+    result[i] = "0123456789ABCDEF"[value & 0xFU];
+    value >>= 4U;
+  }
+}
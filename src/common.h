@@ -12,12 +12,20 @@ write_byte(TermiteHandle, unsigned char);
 void
 write_byte_array(TermiteHandle, unsigned char*, unsigned int len);
 
+// every value is written as two bytes, most significant first
+void
+write_short_array(TermiteHandle, unsigned short*, unsigned int len);
+
 void
 write_cstring(TermiteHandle, const char*);
 
 void
 write_uint(TermiteHandle, unsigned int);
 
+// unlike write_uint also writes zero values
+void
+write_ulong(TermiteHandle, unsigned long long);
+
 _Bool
 compare_byte_array(unsigned char* restrict first, unsigned int first_len,
                     unsigned char* restrict second, unsigned int second_len);
@@ -28,4 +36,14 @@ compare_cstring(const char* restrict first, const char* restrict second);
 unsigned int
 count_cstring(const char* str);
 
+#define HASH_SEED 0xCBF29CE484222325ULL
+
+// FNV-1a, seed with HASH_SEED or with result of previous call to chain several arrays
+unsigned long long
+hash_byte_array(unsigned long long seed, const unsigned char* bytes, unsigned int len);
+
+// writes 16 hex chars of value, no null terminator
+void
+format_hash(unsigned long long value, char* result);
+
 #endif
@@ -0,0 +1,385 @@
+/*
+  Termite daemon
+
+  Keeps worker resident behind unix domain socket, so hosts don't pay for process spawn on every run
+  Preforked children accept connections on shared socket and serve framed requests one after another,
+    parsed programs are kept resident in every child, keyed by content hash
+  Dead children are respawned, so crashing or timed out run only costs its own connection
+
+  Request, every integer is native endian u32:
+    magic "TMRQ", kind (0 - program path, 1 - inline source), step budget (0 - unlimited),
+      flags size, program size, stdin size, followed by flags, program and stdin bytes
+    flags are worker switches separated by spaces, the same as worker's command line ones
+
+  Response:
+    magic "TMRS", exit code, output size, followed by output bytes
+
+  Usage: termite-daemon <socket path> [workers] [seconds per request, 0 for unlimited]
+*/
+
+#define _GNU_SOURCE
+#define TERM_NO_WORKER_MAIN
+#include "worker.c"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#define REQUEST_MAGIC         0x51524D54U // "TMRQ"
+#define RESPONSE_MAGIC        0x53524D54U // "TMRS"
+#define STDIN_LIMIT           (16U * 1024U * 1024U)
+#define FLAGS_LIMIT           256U
+#define RESIDENT_PROGRAMS     16U
+#define DEFAULT_WORKERS       4U
+#define DEFAULT_TIME_LIMIT    10U
+#define WORKERS_LIMIT         256U
+
+typedef enum {
+  rkProgramPath,
+  rkProgramSource,
+} RequestKinds;
+
+typedef struct {
+  unsigned int magic;
+  unsigned int kind;
+  unsigned int budget;
+  unsigned int flags_size;
+  unsigned int program_size;
+  unsigned int stdin_size;
+} RequestHeader;
+
+typedef struct {
+  unsigned int magic;
+  int          exit_code;
+  unsigned int output_size;
+} ResponseHeader;
+
+typedef struct {
+  Program*           program;
+  unsigned long long last_use; // 0 for vacant slot
+} ResidentSlot;
+
+static ResidentSlot resident[RESIDENT_PROGRAMS];
+static unsigned long long use_clock;
+static Program* scratch;
+
+static int stdin_fd;
+static int stdout_fd;
+static unsigned int time_limit = DEFAULT_TIME_LIMIT;
+
+static volatile sig_atomic_t is_stopping;
+
+static _Bool
+read_exact(int fd, void* buff, unsigned int len)
+{
+  char* ptr = buff;
+  while (len != 0U) {
+    ssize_t chars_read = read(fd, ptr, len);
+    if (chars_read < 0 && errno == EINTR)
+      continue;
+    if (chars_read <= 0)
+      return (_Bool)0;
+    ptr += chars_read;
+    len -= (unsigned int)chars_read;
+  }
+  return (_Bool)1;
+}
+
+static _Bool
+write_exact(int fd, const void* buff, unsigned int len)
+{
+  const char* ptr = buff;
+  while (len != 0U) {
+    ssize_t chars_written = write(fd, ptr, len);
+    if (chars_written < 0 && errno == EINTR)
+      continue;
+    if (chars_written <= 0)
+      return (_Bool)0;
+    ptr += chars_written;
+    len -= (unsigned int)chars_written;
+  }
+  return (_Bool)1;
+}
+
+static unsigned int
+parse_uint(const char* str)
+{
+  unsigned int result = 0U;
+  for (; *str >= '0' && *str <= '9'; str++)
+    result = result * 10U + (unsigned int)(*str - '0');
+  return result;
+}
+
+// splits flags in place and applies every switch
+static void
+parse_flags(char* flags, WorkerArgs* args)
+{
+  char* arg = flags;
+  for (char* ptr = flags;; ptr++) {
+    if (*ptr == ' ' || *ptr == '\0') {
+      _Bool is_last = *ptr == '\0' ? (_Bool)1 : (_Bool)0;
+      *ptr = '\0';
+      if (*arg != '\0')
+        parse_worker_arg(arg, args);
+      if (is_last)
+        break;
+      arg = ptr + 1;
+    }
+  }
+}
+
+// if there's resident program with the same content as loaded into scratch - it's used instead
+// otherwise scratch is indexed and swapped with least recently used resident
+static Program*
+resolve_resident(WorkerArgs args)
+{
+  ResidentSlot* victim = &resident[0];
+  use_clock++;
+
+  for (unsigned int i = 0U; i < RESIDENT_PROGRAMS; i++) {
+    ResidentSlot* slot = &resident[i];
+    if (slot->last_use != 0U &&
+        slot->program->hash == scratch->hash &&
+        compare_byte_array((unsigned char*)slot->program->source, slot->program->size,
+                           (unsigned char*)scratch->source, scratch->size))
+    {
+      slot->last_use = use_clock;
+      return slot->program;
+    }
+    if (slot->last_use < victim->last_use)
+      victim = slot;
+  }
+
+  if (!args.use_cache || !cache_load(scratch)) {
+    index_program(scratch);
+    if (args.use_cache)
+      cache_store(scratch);
+  }
+
+  Program* evicted = victim->program;
+  unload_program(evicted);
+  victim->program = scratch;
+  victim->last_use = use_clock;
+  scratch = evicted;
+
+  return victim->program;
+}
+
+static _Bool
+send_response(int connection, int exit_code, unsigned int output_size)
+{
+  ResponseHeader header = {
+    .magic = RESPONSE_MAGIC,
+    .exit_code = exit_code,
+    .output_size = output_size,
+  };
+  if (!write_exact(connection, &header, sizeof(header)))
+    return (_Bool)0;
+
+  // output is already in file, so it's given to socket without copying through user space
+  off_t offset = 0;
+  while ((unsigned int)offset != output_size) {
+    ssize_t sent = sendfile(connection, stdout_fd, &offset, output_size - (unsigned int)offset);
+    if (sent < 0 && errno == EINTR)
+      continue;
+    if (sent <= 0)
+      return (_Bool)0;
+  }
+  return (_Bool)1;
+}
+
+// returns 0 if connection should be closed
+static _Bool
+serve_request(int connection, char* stdin_buffer)
+{
+  RequestHeader header;
+  if (!read_exact(connection, &header, sizeof(header)))
+    return (_Bool)0;
+
+  if (header.magic != REQUEST_MAGIC ||
+      header.flags_size > FLAGS_LIMIT ||
+      header.stdin_size > STDIN_LIMIT ||
+      (header.kind == rkProgramPath && header.program_size > FILEPATH_LIMIT) ||
+      (header.kind == rkProgramSource && header.program_size > INPUT_LIMIT) ||
+      header.kind > rkProgramSource)
+  {
+    return (_Bool)0;
+  }
+
+  char flags[FLAGS_LIMIT + 1U];
+  if (!read_exact(connection, flags, header.flags_size))
+    return (_Bool)0;
+  flags[header.flags_size] = '\0';
+
+  WorkerArgs args = {0};
+  parse_flags(flags, &args);
+  args.step_limit = header.budget;
+
+  int exit_code = OC_OK;
+  if (header.kind == rkProgramPath) {
+    char path[FILEPATH_LIMIT + 1U];
+    if (!read_exact(connection, path, header.program_size))
+      return (_Bool)0;
+    path[header.program_size] = '\0';
+
+    TermiteHandle file;
+    if (open_file(path, &file, foFileRead)) {
+      exit_code = load_program(file, scratch);
+      close_file(file);
+    } else
+      exit_code = OC_FILE_ERROR;
+  } else {
+    // source is read right into scratch program to not copy it twice
+    if (!read_exact(connection, scratch->source, header.program_size))
+      return (_Bool)0;
+    exit_code = load_program_bytes(scratch->source, header.program_size, scratch);
+  }
+
+  if (!read_exact(connection, stdin_buffer, header.stdin_size))
+    return (_Bool)0;
+
+  if (exit_code != OC_OK)
+    return send_response(connection, exit_code, 0U);
+
+  // descriptors 0 and 1 are duplicates of these, so rewinding them rewinds what worker sees
+  if (ftruncate(stdin_fd, 0) != 0 ||
+      !write_exact(stdin_fd, stdin_buffer, header.stdin_size) ||
+      lseek(stdin_fd, 0, SEEK_SET) != 0 ||
+      ftruncate(stdout_fd, 0) != 0 ||
+      lseek(stdout_fd, 0, SEEK_SET) != 0)
+  {
+    return send_response(connection, OC_FILE_ERROR, 0U);
+  }
+
+  Program* program = resolve_resident(args);
+
+  if (time_limit != 0U)
+    alarm(time_limit);
+
+  init_io();
+  exit_code = run_program(program, get_stdout(), get_stdin(), args);
+  deinit_io();
+
+  alarm(0U);
+
+  off_t output_size = lseek(stdout_fd, 0, SEEK_CUR);
+  if (output_size < 0)
+    return send_response(connection, OC_FILE_ERROR, 0U);
+
+  return send_response(connection, exit_code, (unsigned int)output_size);
+}
+
+static _Noreturn void
+serve(int listener)
+{
+  // programs are allocated all at once, as they are only ever swapped later
+  Program* programs = calloc(RESIDENT_PROGRAMS + 1U, sizeof(Program));
+  char* stdin_buffer = malloc(STDIN_LIMIT);
+  stdin_fd = memfd_create("termite-stdin", MFD_CLOEXEC);
+  stdout_fd = memfd_create("termite-stdout", MFD_CLOEXEC);
+
+  if (programs == NULL || stdin_buffer == NULL || stdin_fd < 0 || stdout_fd < 0 ||
+      dup2(stdin_fd, STDIN_FILENO) < 0 || dup2(stdout_fd, STDOUT_FILENO) < 0)
+  {
+    _exit(OC_FILE_ERROR);
+  }
+
+  for (unsigned int i = 0U; i < RESIDENT_PROGRAMS; i++)
+    resident[i].program = &programs[i];
+  scratch = &programs[RESIDENT_PROGRAMS];
+
+  while (1) {
+    int connection = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+    if (connection < 0)
+      continue;
+    while (serve_request(connection, stdin_buffer));
+    close(connection);
+  }
+}
+
+static pid_t
+spawn_worker(int listener)
+{
+  pid_t pid = fork();
+  if (pid == 0) {
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    serve(listener);
+  }
+  return pid;
+}
+
+static void
+handle_stop(int signal)
+{
+  (void)signal;
+  is_stopping = 1;
+}
+
+int
+term_main(int argc, const char** argv)
+{
+  if (argc < 2)
+    return OC_INVALID_INPUT;
+
+  unsigned int worker_count = argc > 2 ? parse_uint(argv[2]) : DEFAULT_WORKERS;
+  if (worker_count == 0U || worker_count > WORKERS_LIMIT)
+    return OC_INVALID_INPUT;
+  if (argc > 3)
+    time_limit = parse_uint(argv[3]);
+
+  struct sockaddr_un address = { .sun_family = AF_UNIX };
+  if (count_cstring(argv[1]) >= sizeof(address.sun_path))
+    return OC_INVALID_INPUT;
+  strcpy(address.sun_path, argv[1]);
+
+  int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listener < 0)
+    return OC_FILE_ERROR;
+
+  unlink(argv[1]);
+  if (bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+      listen(listener, SOMAXCONN) != 0)
+  {
+    close(listener);
+    return OC_FILE_ERROR;
+  }
+
+  // clients going away in the middle of response shouldn't kill children
+  signal(SIGPIPE, SIG_IGN);
+
+  struct sigaction stop_action = { .sa_handler = handle_stop };
+  sigaction(SIGTERM, &stop_action, NULL);
+  sigaction(SIGINT, &stop_action, NULL);
+
+  pid_t workers[WORKERS_LIMIT];
+  for (unsigned int i = 0U; i < worker_count; i++)
+    workers[i] = spawn_worker(listener);
+
+  while (!is_stopping) {
+    pid_t dead = waitpid(-1, NULL, 0);
+    if (dead < 0)
+      continue;
+    for (unsigned int i = 0U; i < worker_count; i++) {
+      if (workers[i] == dead && !is_stopping)
+        workers[i] = spawn_worker(listener);
+    }
+  }
+
+  for (unsigned int i = 0U; i < worker_count; i++) {
+    if (workers[i] > 0)
+      kill(workers[i], SIGTERM);
+  }
+  while (waitpid(-1, NULL, 0) > 0);
+
+  close(listener);
+  unlink(argv[1]);
+  return OC_OK;
+}
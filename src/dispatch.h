@@ -0,0 +1,523 @@
+// Interpreter loop, instantiated by worker.c for every cell width
+//   CELL        - type of stack values
+//   RUN_PROGRAM - name of produced function
+//   WRITE_CELLS - function printing stack in debug output
+//   INTRINSICS  - 1 if std routines could run natively, their implementations operate on bytes
+//   RESUMABLE   - defined if run continues from VmState and suspends itself instead of blocking on input
+//   PROFILED    - defined if offset of every token is published for sampling profiler
+// There's no include guard, as every inclusion produces separate instance
+
+#ifdef RESUMABLE
+static int
+RUN_PROGRAM(VmState* vm,
+            TermiteHandle out_handle,
+            WorkerArgs args)
+{
+  int exit_code = OC_OK;
+
+  const Program* program = vm->program;
+  const TermiteHandle in_handle = memory_handle(vm->input);
+  const char* input = program->source;
+  unsigned int size = program->size;
+  unsigned int cursor = vm->cursor;
+  unsigned long long steps = vm->steps;
+#else
+static int
+RUN_PROGRAM(const Program* program,
+            TermiteHandle out_handle,
+            TermiteHandle in_handle,
+            WorkerArgs args)
+{
+  int exit_code = OC_OK;
+
+  const char* input = program->source;
+  unsigned int size = program->size;
+  unsigned int cursor = 0U;
+  unsigned long long steps = 0U;
+#endif
+
+  // tracing and loop catching need to observe jumps themselves
+  const _Bool fuse_jumps = program->well_formed && !args.print_stack_steps && !args.catch_infinite_recursion;
+
+  // routines skip over their own rewinds, so step limit is left for interpreter as well
+  const _Bool use_intrinsics = INTRINSICS && fuse_jumps && !args.no_intrinsics && args.step_limit == 0U &&
+                               program->intrinsic_site_count != 0U;
+
+  const TraceWindow trace_window = resolve_trace_filter(program, &args.trace_filter);
+#ifdef RESUMABLE
+  unsigned int trace_countdown = vm->trace_countdown != 0U ? vm->trace_countdown : trace_window.every;
+
+  CELL* stack = (CELL*)vm->cells;
+  unsigned int stack_head = vm->stack_head;
+#else
+  unsigned int trace_countdown = trace_window.every;
+
+  CELL stack[STACK_LIMIT];
+  unsigned int stack_head = 0U;
+#endif
+
+  // EXPERIMENTAL: required for checking of infinite loops on rewinds
+  // resumed run starts it anew, so loops aren't caught across suspensions
+  // todo: make it compile-time optional?
+  // todo: could be dangerous to just mul to 0
+  CELL shadow_stack[STACK_LIMIT * args.catch_infinite_recursion];
+  unsigned int shadow_stack_rewinded_at = 0U;
+  CELL shadow_stack_rewinded_with = 0U;
+  unsigned int  shadow_stack_len = 0U;
+
+  #define crash(code) \
+    do { \
+      exit_code = code; \
+      goto EXIT_LOOP; \
+    } while (0)
+
+  // token at cursor is executed anew on resume
+  #define suspend(reason) \
+    do { \
+      vm->cursor = cursor; \
+      vm->steps = steps; \
+      vm->stack_head = stack_head; \
+      vm->trace_countdown = trace_countdown; \
+      return reason; \
+    } while (0)
+
+  char op_char = '\0';
+
+  while (1) {
+    if (cursor == size)
+      break;
+
+    const unsigned int op_offset = cursor;
+#ifdef PROFILED
+    profile_cursor = op_offset;
+#endif
+    switch (input[cursor]) {
+      case  ' ':
+      case '\n':
+      case '\r':
+      case '\t': cursor++; continue;
+
+      // pop value from stack and return it as exit code
+      // this effectively terminates the program in predictable manner
+      case '%': {
+        op_char = '%';
+        if (stack_head == 0U)
+          crash(OC_STACK_EXHAUSTED);
+
+        stack_head--;
+        crash(stack[stack_head]);
+        break;
+      }
+
+      // drop value from stack
+      case '.': {
+        op_char = '.';
+        if (stack_head == 0U)
+          crash(OC_STACK_EXHAUSTED);
+        stack_head--;
+        cursor++;
+        break;
+      }
+
+      // duplicate last value on stack
+      case '@': {
+        op_char = '@';
+        if (stack_head == STACK_LIMIT)
+          crash(OC_STACK_OVERFLOW);
+        if (stack_head == 0U)
+          crash(OC_STACK_EXHAUSTED);
+        stack[stack_head] = stack[stack_head - 1U];
+        stack_head++;
+        cursor++;
+        break;
+      }
+
+      // swap two last values on stack
+      case '^': {
+        op_char = '^';
+        if (stack_head < 2U)
+          crash(OC_STACK_EXHAUSTED);
+        CELL buff = stack[stack_head - 1U];
+        stack[stack_head - 1U] = stack[stack_head - 2U];
+        stack[stack_head - 2U] = buff;
+        cursor++;
+        break;
+      }
+
+      // 'conveyor belt' operator
+      // place last value on the stack at the beginning
+      case '#': {
+        op_char = '#';
+        if (stack_head == 0U) {
+          cursor++;
+          break;
+        }
+        CELL buff = stack[stack_head - 1U];
+        for (unsigned int i = 0U; i < stack_head; i++) {
+          CELL convey = stack[i];
+          stack[i] = buff;
+          buff = convey;
+        }
+        cursor++;
+        break;
+      }
+
+      // 'ronveyor belt' operator aka 'reverse conveyor'
+      // place first value on the stack at the end
+      case '$': {
+        op_char = '$';
+        if (stack_head == 0U) {
+          cursor++;
+          break;
+        }
+        CELL buff = stack[0U];
+        for (unsigned int i = stack_head; i--;) {
+          CELL convey = stack[i];
+          stack[i] = buff;
+          buff = convey;
+        }
+        cursor++;
+        break;
+      }
+
+      // not operator, toggles least significant bit
+      // todo: replace with proper bitwise operators?
+      case '~': {
+        op_char = '~';
+        if (stack_head == 0U)
+          crash(OC_STACK_EXHAUSTED);
+        stack[stack_head - 1U] ^= 1U;
+        cursor++;
+        break;
+      }
+
+      // compare two stack values, consume them and push 1 or 0 depending on whether they're equal
+      case '=': {
+        op_char = '=';
+        if (stack_head < 2U)
+          crash(OC_STACK_EXHAUSTED);
+        stack[stack_head - 2U] = stack[stack_head - 2U] == stack[stack_head - 1U];
+        stack_head--;
+        cursor++;
+        break;
+      }
+
+      // compare two stack values, consume them and push 1 or 0 depending on how they compare
+      // if last is bigger than next then 0, otherwise 1
+      case '?': {
+        op_char = '?';
+        if (stack_head < 2U)
+          crash(OC_STACK_EXHAUSTED);
+        stack[stack_head - 2U] = stack[stack_head - 2U] < stack[stack_head - 1U];
+        stack_head--;
+        cursor++;
+        break;
+      }
+
+      // add two stack values, consume them and push result of addition 
+      case '+': {
+        op_char = '+';
+        if (stack_head < 2U)
+          crash(OC_STACK_EXHAUSTED);
+        stack[stack_head - 2U] = stack[stack_head - 2U] + stack[stack_head - 1U];
+        stack_head--;
+        cursor++;
+        break;
+      }
+
+      // subtract two stack values, consume them and push result of subtraction
+      // pops subtractor first, then subtrahend
+      case '-': {
+        op_char = '-';
+        if (stack_head < 2U)
+          crash(OC_STACK_EXHAUSTED);
+        stack[stack_head - 2U] = stack[stack_head - 2U] - stack[stack_head - 1U];
+        stack_head--;
+        cursor++;
+        break;
+      }
+
+      // multiply two stack values, consume them and push result of multiplication 
+      case '*': {
+        op_char = '*';
+        if (stack_head < 2U)
+          crash(OC_STACK_EXHAUSTED);
+        stack[stack_head - 2U] = stack[stack_head - 2U] * stack[stack_head - 1U];
+        stack_head--;
+        cursor++;
+        break;
+      }
+
+      // divide two stack values, consume them and push result of division
+      // pops divider first, then dividend
+      case '/': {
+        op_char = '/';
+        if (stack_head < 2U)
+          crash(OC_STACK_EXHAUSTED);
+        if (stack[stack_head - 1U] == 0U) {
+          crash(OC_ZERO_DIVISION);
+          break;
+        }
+        stack[stack_head - 2U] = stack[stack_head - 2U] / stack[stack_head - 1U];
+        stack_head--;
+        cursor++;
+        break;
+      }
+
+      // pop from stack and print
+      case '<': {
+        op_char = '<';
+        if (stack_head == 0U)
+          crash(OC_STACK_EXHAUSTED);
+        if (args.print_stack_steps)
+          write_cstring(out_handle, "\n");
+        write_byte(out_handle, (unsigned char)stack[stack_head - 1U]);
+        stack_head--;
+        cursor++;
+        break;
+      }
+
+      // push single byte from stdin into stack
+      case '>': {
+        op_char = '>';
+#ifdef RESUMABLE
+        if (vm->input->position == vm->input->size && !vm->is_input_closed)
+          suspend(VM_WAITING);
+#endif
+        if (use_intrinsics) {
+          const IntrinsicSite* site = intrinsic_site_at(program, cursor);
+          if (site != NULL) {
+            IntrinsicState state = { (unsigned char*)stack, stack_head, out_handle, in_handle, 0U, site };
+            int status = intrinsics[site->intrinsic].routine(&state);
+            // loops could decline after some iterations, what's done is kept either way
+            stack_head = state.stack_head;
+            steps += state.steps;
+            if (status != INTRINSIC_DECLINED) {
+              if (status != OC_OK)
+                crash(status);
+              cursor = site->end;
+              continue;
+            }
+          }
+        }
+        if (stack_head == STACK_LIMIT - 1U)
+          crash(OC_STACK_OVERFLOW);
+
+        char stdin_char;
+        unsigned int chars_read;
+        if (!read_file(in_handle, &stdin_char, 1U, &chars_read)) // todo: we could probably retrieve STDIN only once per startup
+          crash(OC_FILE_ERROR); // todo: could be triggered when there's no input, should give INPUT_EXHAUTED error on such cases
+
+        if (chars_read != 0U) {
+          stack[stack_head++] = (unsigned char)stdin_char;
+          stack[stack_head++] = 1U;
+        } else {
+          stack[stack_head++] = 0U; // todo: what about outputting random value here?
+          stack[stack_head++] = 0U;
+        }
+
+        cursor++;
+        break;
+      }
+
+      // pop from stack and rewind N tokens back
+      case '[': {
+        op_char = '[';
+#ifdef RESUMABLE
+        if (steps >= vm->slice_end)
+          suspend(VM_PREEMPTED);
+#endif
+        if (stack_head == 0U)
+          crash(OC_STACK_EXHAUSTED);
+
+        CELL n_tokens = stack[stack_head - 1U];
+        stack_head--;
+
+        if (args.step_limit != 0U && steps >= args.step_limit)
+          crash(OC_STEP_LIMIT);
+
+        if (args.catch_infinite_recursion) {
+          if (shadow_stack_rewinded_at != 0U &&
+              shadow_stack_rewinded_at == cursor &&
+              shadow_stack_rewinded_with == n_tokens &&
+              compare_byte_array((unsigned char*)shadow_stack, shadow_stack_len * sizeof(CELL),
+                                 (unsigned char*)stack, stack_head * sizeof(CELL)))
+          {
+            crash(OC_INFINITE_LOOP);
+          }
+          shadow_stack_rewinded_at = cursor;
+          shadow_stack_rewinded_with = n_tokens;
+          shadow_stack_len = stack_head;
+          for (unsigned int i = stack_head; i--;)
+            shadow_stack[i] = stack[i];
+        }
+
+        // token index resolves jump at once, scanning is left for sources which have malformed hex tokens
+        if (program->well_formed) {
+          unsigned int ordinal = program->token_ordinals[cursor];
+          if (n_tokens == 0U)
+            cursor++;
+          else if (n_tokens > ordinal)
+            crash(OC_INPUT_EXHAUSTED);
+          else
+            cursor = program->token_offsets[ordinal - n_tokens];
+          break;
+        }
+
+        if (n_tokens != 0U)
+          // '[' itself should not count
+          cursor--;
+        else
+          // move along
+          cursor++;
+
+        while (n_tokens != 0U) {
+          switch (input[cursor]) {
+            case  ' ':
+            case '\n':
+            case '\r':
+            case '\t': break;
+            default: {
+              if (is_hex_char(input[cursor])) {
+                if ((cursor != 0U) && parse_hex(input, &input[size - 1U], cursor - 1U))
+                  cursor--;
+                else
+                  crash(OC_INVALID_INPUT);
+              }
+              n_tokens--;
+            }
+          }
+
+          if ((cursor == 0U) && (n_tokens != 0U))
+            crash(OC_INPUT_EXHAUSTED);
+          else if (n_tokens != 0U)
+            cursor--;
+        }
+        break;
+      }
+
+      // pop from stack and seek N tokens forward
+      case ']': {
+        op_char = ']';
+        if (stack_head == 0U)
+          crash(OC_STACK_EXHAUSTED);
+
+        CELL n_tokens = stack[stack_head - 1U];
+        stack_head--;
+
+        if (program->well_formed) {
+          unsigned int ordinal = program->token_ordinals[cursor] + n_tokens;
+          if (ordinal >= program->token_count)
+            crash(OC_INPUT_EXHAUSTED);
+          cursor = token_end(program, ordinal);
+          break;
+        }
+
+        cursor++;
+        while (n_tokens != 0U) {
+          if (cursor == size)
+            crash(OC_INPUT_EXHAUSTED);
+
+          switch (input[cursor]) {
+            case  ' ':
+            case '\n':
+            case '\r':
+            case '\t': break;
+            default: {
+              if (is_hex_char(input[cursor])) {
+                if ((cursor != (size - 1U)) && parse_hex(input, &input[size - 1U], cursor))
+                  cursor++;
+                else
+                  crash(OC_INVALID_INPUT);
+              }
+              n_tokens--;
+            }
+          }
+
+          if ((cursor == size) && (n_tokens != 0U))
+            crash(OC_INPUT_EXHAUSTED);
+          cursor++;
+        }
+        break;
+      }
+
+      // otherwise push it as character or hex value
+      default: {
+        if (stack_head == STACK_LIMIT)
+          crash(OC_STACK_OVERFLOW);
+
+        // constant push followed by jump lands at precomputed target, value never goes through stack
+        if (fuse_jumps && program->jump_targets[cursor] != NO_STATIC_JUMP) {
+          unsigned int target = program->jump_targets[cursor];
+#ifdef RESUMABLE
+          if ((target & STATIC_REWIND) != 0U && steps >= vm->slice_end)
+            suspend(VM_PREEMPTED);
+#endif
+          if ((target & STATIC_REWIND) != 0U && args.step_limit != 0U && steps + 1U >= args.step_limit)
+            crash(OC_STEP_LIMIT);
+          cursor = target & ~STATIC_REWIND;
+          steps += 2U;
+          continue;
+        }
+
+        if (is_hex_char(input[cursor])) {
+          if ((cursor != (size - 1U)) && parse_hex(input, &input[size - 1U], cursor)) {
+            unsigned char leading = input[cursor] - '0';
+            if (leading > 9U)
+              leading -= 7U;
+
+            unsigned char following = input[cursor + 1U] - '0';
+            if (following > 9U)
+              following -= 7U;
+
+            // literals are bytes in wide mode too, tokens are the same whatever the width of cells
+            cursor += 2U;
+            stack[stack_head] = (leading << 4U) | following;
+          } else
+            crash(OC_INVALID_INPUT);
+
+        } else
+          stack[stack_head] = (unsigned char)input[cursor++];
+
+        op_char = stack[stack_head];
+        stack_head++;
+      }
+    }
+    steps++;
+    if (args.print_stack_steps == (_Bool)1 &&
+        is_step_traced(&trace_window, op_offset, stack_head, stack_head != 0U ? stack[stack_head - 1U] : 0U) &&
+        --trace_countdown == 0U)
+    {
+      trace_countdown = trace_window.every;
+      write_cstring(out_handle, "\n|");
+      WRITE_CELLS(out_handle, stack, stack_head);
+      write_cstring(out_handle, "| (");
+      write_file(out_handle, (const char*)&op_char, 1U);
+      write_cstring(out_handle, " ");
+      write_uint(out_handle, count_tokens(input, &input[size - 1U], cursor - 1U));
+      write_cstring(out_handle, ")");
+      if (args.stop_on_trace)
+        crash(OC_BREAKPOINT);
+    }
+  }
+
+EXIT_LOOP:
+  if (args.executed_steps != NULL)
+    *args.executed_steps = steps;
+
+  if (args.print_stack_on_exit == (_Bool)1 || args.print_stack_steps == (_Bool)1) {
+    write_cstring(out_handle, "\n|");
+    WRITE_CELLS(out_handle, stack, stack_head);
+    write_cstring(out_handle, "|");
+  }
+  return exit_code;
+}
+
+#undef crash
+#undef suspend
+#undef CELL
+#undef RUN_PROGRAM
+#undef WRITE_CELLS
+#undef INTRINSICS
+#undef RESUMABLE
+#undef PROFILED
@@ -0,0 +1,109 @@
+/*
+  Termite hex syntax codec
+
+  Converts stdin to stdout with functions of src/codec.c, which are also available as libtermite-codec for Python:
+    escape - invisible bytes become hex pairs, the same as std/invis-to-hex.tm does
+    decode - hex text becomes raw bytes, as 'data' command of hivemind does
+    count  - number of termite tokens is written in decimal, as utils/token_counter.py does
+
+  Hex char without a pair is reported to stderr with its offset, exit code is OC_INVALID_INPUT then
+
+  Usage: termite-hex <escape | decode | count> < input > output
+*/
+
+#include <stdlib.h>
+
+#include "io.h"
+#include "common.h"
+#include "terms.h"
+#include "codec.h"
+
+#define READ_CHUNK (64U * 1024U)
+
+// returns 0 on error, whole stdin is kept in memory
+static _Bool
+read_stdin(unsigned char** data, unsigned int* size)
+{
+  unsigned int capacity = 0U;
+  *data = NULL;
+  *size = 0U;
+  while (1) {
+    if (capacity - *size < READ_CHUNK) {
+      // escaped output has to fit into unsigned int too
+      if (capacity > 0x3FFFFFFFU)
+        return (_Bool)0;
+      capacity = capacity != 0U ? capacity * 2U : READ_CHUNK * 4U;
+      unsigned char* grown = realloc(*data, capacity);
+      if (grown == NULL)
+        return (_Bool)0;
+      *data = grown;
+    }
+    unsigned int chars_read;
+    if (!read_file(get_stdin(), (char*)&(*data)[*size], READ_CHUNK, &chars_read))
+      return (_Bool)0;
+    if (chars_read == 0U)
+      return (_Bool)1;
+    *size += chars_read;
+  }
+}
+
+static void
+report_unpaired(unsigned int offset)
+{
+  TermiteHandle err = get_stderr();
+  write_cstring(err, "hex char without a pair at offset ");
+  write_ulong(err, offset);
+  write_cstring(err, "\n");
+}
+
+int
+term_main(int argc, const char** argv)
+{
+  if (argc != 2)
+    return OC_INVALID_INPUT;
+  _Bool is_escape = compare_cstring(argv[1], "escape");
+  _Bool is_decode = compare_cstring(argv[1], "decode");
+  if (!is_escape && !is_decode && !compare_cstring(argv[1], "count"))
+    return OC_INVALID_INPUT;
+
+  init_io();
+
+  unsigned char* in;
+  unsigned int len;
+  unsigned char* out = NULL;
+  int return_code = OC_OK;
+
+  if (!read_stdin(&in, &len))
+    return_code = OC_FILE_ERROR;
+  else if (is_escape) {
+    out = malloc(len * 2ULL + 1U);
+    if (out == NULL)
+      return_code = OC_FILE_ERROR;
+    else if (!write_file(get_stdout(), (const char*)out, codec_escape(in, len, out)))
+      return_code = OC_FILE_ERROR;
+  } else if (is_decode) {
+    unsigned int size;
+    out = malloc(len + 1U);
+    if (out == NULL)
+      return_code = OC_FILE_ERROR;
+    else if (!codec_decode(in, len, out, &size)) {
+      report_unpaired(size);
+      return_code = OC_INVALID_INPUT;
+    } else if (!write_file(get_stdout(), (const char*)out, size))
+      return_code = OC_FILE_ERROR;
+  } else {
+    unsigned int count;
+    if (!codec_count_tokens(in, len, &count)) {
+      report_unpaired(count);
+      return_code = OC_INVALID_INPUT;
+    } else {
+      write_ulong(get_stdout(), count);
+      write_cstring(get_stdout(), "\n");
+    }
+  }
+
+  free(out);
+  free(in);
+  deinit_io();
+  return return_code;
+}
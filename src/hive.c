@@ -0,0 +1,679 @@
+/*
+  Termite hivemind host
+
+  Native counterpart of utils/hivemind.py, every stage is run in-process over memory streams instead of spawned worker
+  Output of stage becomes input of the next one by swapping their buffers, so nothing is copied between stages
+  Output is scanned for MAGIC sequences while it's being written, so commands are known by the time stage exits,
+    they're applied only if it exits with HIVEMIND_EXIT, otherwise output is passed as it is
+
+  Script syntax is the same as of hivemind.py, see its HelpText
+
+  Commands embedded in output, MAGIC is 98 7F and NAME is path terminated by 00:
+    MAGIC 10        - stop interpreting magic sequences in current output, except for MAGIC 11
+    MAGIC 11        - resume interpreting them
+    MAGIC 20 X:NAME - run program at path X with no input, its output takes place of command
+    MAGIC 21 X:NAME - save output that is before command into file at path X, rewriting it
+    MAGIC 22 X:NAME - load contents of file at path X in place of command
+
+  Usage: termite-hivemind <script path>
+*/
+
+#define TERM_NO_WORKER_MAIN
+#include "worker.c"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "codec.h"
+
+// todo: time limit of stages, step limit is only checked on rewinds
+
+#define MAGIC_LEADING       0x98U
+#define MAGIC_FOLLOWING     0x7FU
+#define NAME_LIMIT          128U
+#define NESTING_LIMIT       8U
+#define STAGE_STEP_LIMIT    100000000U
+#define WORD_LIMIT          4U
+#define ERROR_PROGRAM       "std/spit-error.tm"
+
+typedef enum {
+  hcNoInterpret = 0x10,
+  hcInterpret   = 0x11,
+  hcRun         = 0x20,
+  hcSave        = 0x21,
+  hcLoad        = 0x22,
+} HiveCommands;
+
+typedef struct {
+  unsigned int  offset; // where command starts in output
+  unsigned int  end;    // just after it
+  unsigned char kind;
+  char          name[NAME_LIMIT];
+} HiveCommand;
+
+typedef enum {
+  ssData,
+  ssLeading,
+  ssCommand,
+  ssName,
+} ScanStates;
+
+typedef struct {
+  ScanStates   state;
+  _Bool        is_interpreting;
+  _Bool        is_failed;
+  HiveCommand  pending;
+  unsigned int name_len;
+  HiveCommand* commands;
+  unsigned int count;
+  unsigned int capacity;
+} Scanner;
+
+typedef struct {
+  const char*  start;
+  unsigned int len;
+} Word;
+
+static Program stage_program;
+static Program error_program;
+static _Bool   is_error_program_loaded;
+
+static _Bool
+grow_memory(TermiteMemory* memory, unsigned int required)
+{
+  unsigned int capacity = memory->capacity != 0U ? memory->capacity : 4096U;
+  while (capacity < required)
+    capacity = capacity > 0x7FFFFFFFU ? required : capacity * 2U;
+
+  unsigned char* data = realloc(memory->data, capacity);
+  if (data == NULL)
+    return (_Bool)0;
+  memory->data = data;
+  memory->capacity = capacity;
+  return (_Bool)1;
+}
+
+static void
+init_memory(TermiteMemory* memory)
+{
+  *memory = (TermiteMemory){ .reserve = grow_memory };
+}
+
+static _Bool
+append_memory(TermiteMemory* memory, const void* data, unsigned int len)
+{
+  return write_file(memory_handle(memory), (const char*)data, len);
+}
+
+static void
+record_command(Scanner* scanner, unsigned int end)
+{
+  if (scanner->count == scanner->capacity) {
+    unsigned int capacity = scanner->capacity != 0U ? scanner->capacity * 2U : 8U;
+    HiveCommand* commands = realloc(scanner->commands, capacity * sizeof(HiveCommand));
+    if (commands == NULL) {
+      scanner->is_failed = (_Bool)1;
+      return;
+    }
+    scanner->commands = commands;
+    scanner->capacity = capacity;
+  }
+  scanner->pending.end = end;
+  scanner->commands[scanner->count++] = scanner->pending;
+}
+
+// fed with every chunk stage writes, commands are only recorded, as exit code isn't known yet
+static void
+scan_output(TermiteMemory* memory, unsigned int offset)
+{
+  Scanner* scanner = memory->context;
+
+  for (unsigned int i = offset; i < memory->size; i++) {
+    unsigned char ch = memory->data[i];
+    switch (scanner->state) {
+      case ssData: {
+        if (ch == MAGIC_LEADING) {
+          scanner->pending.offset = i;
+          scanner->state = ssLeading;
+        }
+        break;
+      }
+      case ssLeading: {
+        if (ch == MAGIC_FOLLOWING)
+          scanner->state = ssCommand;
+        else if (ch == MAGIC_LEADING)
+          scanner->pending.offset = i;
+        else
+          scanner->state = ssData;
+        break;
+      }
+      case ssCommand: {
+        scanner->state = ssData;
+        scanner->pending.kind = ch;
+        if (ch == MAGIC_LEADING) {
+          scanner->pending.offset = i;
+          scanner->state = ssLeading;
+          break;
+        }
+        if (!scanner->is_interpreting && ch != hcInterpret)
+          break;
+
+        switch (ch) {
+          case hcNoInterpret:
+          case hcInterpret: {
+            scanner->is_interpreting = ch == hcInterpret ? (_Bool)1 : (_Bool)0;
+            record_command(scanner, i + 1U);
+            break;
+          }
+          case hcRun:
+          case hcSave:
+          case hcLoad: {
+            scanner->name_len = 0U;
+            scanner->state = ssName;
+            break;
+          }
+          default: break; // not a command, stays as it is
+        }
+        break;
+      }
+      case ssName: {
+        if (ch == 0x00U) {
+          scanner->pending.name[scanner->name_len] = '\0';
+          record_command(scanner, i + 1U);
+          scanner->state = ssData;
+        } else if (scanner->name_len == NAME_LIMIT - 1U)
+          scanner->state = ssData; // too long to be a name, stays as it is
+        else
+          scanner->pending.name[scanner->name_len++] = (char)ch;
+        break;
+      }
+    }
+  }
+}
+
+static int
+run_described(const Program* program, TermiteMemory* in, TermiteMemory* out, WorkerArgs args, unsigned int depth);
+
+static int
+save_file(const char* path, const unsigned char* data, unsigned int len)
+{
+  TermiteHandle file;
+  if (!open_file(path, &file, foFileCreate))
+    return OC_FILE_ERROR;
+  _Bool status = len == 0U || write_file(file, (const char*)data, len);
+  if (!close_file(file) || !status)
+    return OC_FILE_ERROR;
+  return OC_OK;
+}
+
+static int
+load_file(const char* path, TermiteMemory* out)
+{
+  TermiteHandle file;
+  if (!open_file(path, &file, foFileRead))
+    return OC_FILE_ERROR;
+
+  int status = OC_OK;
+  char buffer[4096];
+  unsigned int chars_read;
+  do {
+    if (!read_file(file, buffer, sizeof(buffer), &chars_read) || !append_memory(out, buffer, chars_read)) {
+      status = OC_FILE_ERROR;
+      break;
+    }
+  } while (chars_read != 0U);
+
+  if (!close_file(file))
+    status = OC_FILE_ERROR;
+  return status;
+}
+
+static int
+run_file(const char* path, TermiteMemory* out, unsigned int depth)
+{
+  if (depth == NESTING_LIMIT)
+    return OC_STACK_OVERFLOW;
+
+  TermiteHandle file;
+  if (!open_file(path, &file, foFileRead))
+    return OC_FILE_ERROR;
+
+  // nested programs are rare, so they're not worth keeping around
+  Program* program = calloc(1U, sizeof(Program));
+  if (program == NULL) {
+    close_file(file);
+    return OC_FILE_ERROR;
+  }
+
+  WorkerArgs args = { .step_limit = STAGE_STEP_LIMIT };
+  int status = prepare_program(program, file, args);
+  if (!close_file(file) && status == OC_OK)
+    status = OC_FILE_ERROR;
+
+  if (status == OC_OK) {
+    TermiteMemory in;
+    init_memory(&in);
+    status = run_described(program, &in, out, args, depth);
+  }
+  unload_program(program);
+  free(program);
+  return status;
+}
+
+// output of stage from base is rebuilt with commands replaced by their results
+static int
+apply_commands(TermiteMemory* out, unsigned int base, const Scanner* scanner, unsigned int depth)
+{
+  unsigned int raw_size = out->size - base;
+  unsigned char* raw = malloc(raw_size != 0U ? raw_size : 1U);
+  if (raw == NULL)
+    return OC_FILE_ERROR;
+  memcpy(raw, &out->data[base], raw_size);
+  out->size = base;
+
+  int status = OC_OK;
+  unsigned int from = 0U;
+  for (unsigned int i = 0U; i < scanner->count && status == OC_OK; i++) {
+    const HiveCommand* command = &scanner->commands[i];
+    if (!append_memory(out, &raw[from], command->offset - base - from)) {
+      status = OC_FILE_ERROR;
+      break;
+    }
+    from = command->end - base;
+
+    switch (command->kind) {
+      case hcSave: status = save_file(command->name, &out->data[base], out->size - base); break;
+      case hcLoad: status = load_file(command->name, out); break;
+      case hcRun:  status = run_file(command->name, out, depth + 1U); break;
+      default: break;
+    }
+  }
+  if (status == OC_OK && !append_memory(out, &raw[from], raw_size - from))
+    status = OC_FILE_ERROR;
+
+  free(raw);
+  return status;
+}
+
+// output of stage is appended to out
+static int
+run_stage(const Program* program, TermiteMemory* in, TermiteMemory* out, WorkerArgs args, unsigned int depth)
+{
+  Scanner scanner = { .state = ssData, .is_interpreting = (_Bool)1 };
+  unsigned int base = out->size;
+
+  out->written = scan_output;
+  out->context = &scanner;
+  in->position = 0U;
+  int exit_code = run_program(program, memory_handle(out), memory_handle(in), args);
+  out->written = NULL;
+  out->context = NULL;
+
+  if (exit_code == HIVEMIND_EXIT)
+    exit_code = scanner.is_failed ? OC_FILE_ERROR : apply_commands(out, base, &scanner, depth);
+
+  free(scanner.commands);
+  return exit_code;
+}
+
+// the same as hivemind.py does, description of failure is appended after output
+static int
+describe_error(int exit_code, TermiteMemory* out)
+{
+  if (!is_error_program_loaded) {
+    TermiteHandle file;
+    if (!open_file(ERROR_PROGRAM, &file, foFileRead))
+      return OC_FILE_ERROR;
+    WorkerArgs args = {0};
+    int status = prepare_program(&error_program, file, args);
+    close_file(file);
+    if (status != OC_OK)
+      return status;
+    is_error_program_loaded = (_Bool)1;
+  }
+
+  unsigned char code = (unsigned char)exit_code;
+  TermiteMemory in;
+  init_memory(&in);
+  in.data = &code;
+  in.size = 1U;
+  in.capacity = 1U;
+  in.reserve = NULL;
+
+  if (!append_memory(out, "\n", 1U))
+    return OC_FILE_ERROR;
+  WorkerArgs args = {0};
+  return run_stage(&error_program, &in, out, args, NESTING_LIMIT);
+}
+
+static int
+run_described(const Program* program, TermiteMemory* in, TermiteMemory* out, WorkerArgs args, unsigned int depth)
+{
+  int exit_code = run_stage(program, in, out, args, depth);
+  if (exit_code != OC_OK)
+    return describe_error(exit_code, out);
+  return OC_OK;
+}
+
+static _Bool
+is_word(Word word, const char* cstring)
+{
+  unsigned int len = count_cstring(cstring);
+  return len == word.len && memcmp(word.start, cstring, len) == 0 ? (_Bool)1 : (_Bool)0;
+}
+
+static _Bool
+is_blank(char ch)
+{
+  return ch == ' ' || ch == '\t' || ch == '\r' ? (_Bool)1 : (_Bool)0;
+}
+
+// splits next command of script into words, returns 0 when script is over
+//   words are separated by blanks, could be quoted
+//   ':' starts word that takes the rest of line and every following line that is indented
+static _Bool
+next_command(const char* script, unsigned int size, unsigned int* cursor, Word* words, unsigned int* count)
+{
+  unsigned int pos = *cursor;
+  *count = 0U;
+
+  while (pos != size) {
+    char ch = script[pos];
+    if (is_blank(ch)) {
+      pos++;
+      continue;
+    }
+    if (ch == '\n') {
+      pos++;
+      if (*count != 0U)
+        break;
+      continue;
+    }
+
+    Word word;
+    if (ch == '"') {
+      unsigned int start = ++pos;
+      while (pos != size && script[pos] != '"')
+        pos += script[pos] == '\\' && pos + 1U != size ? 2U : 1U;
+      word = (Word){ &script[start], (pos < size ? pos : size) - start };
+      if (pos < size)
+        pos++;
+    } else if (ch == ':') {
+      unsigned int start = ++pos;
+      while (pos != size) {
+        if (script[pos] == '\n' && (pos + 1U == size || !is_blank(script[pos + 1U])))
+          break;
+        pos++;
+      }
+      unsigned int end = pos;
+      while (start != end && (is_blank(script[start]) || script[start] == '\n'))
+        start++;
+      while (end != start && (is_blank(script[end - 1U]) || script[end - 1U] == '\n'))
+        end--;
+      word = (Word){ &script[start], end - start };
+    } else {
+      unsigned int start = pos;
+      while (pos != size && !is_blank(script[pos]) && script[pos] != '\n' && script[pos] != ':')
+        pos++;
+      word = (Word){ &script[start], pos - start };
+    }
+
+    if (*count == WORD_LIMIT)
+      return (_Bool)0;
+    words[(*count)++] = word;
+  }
+
+  *cursor = pos;
+  return *count != 0U ? (_Bool)1 : (_Bool)0;
+}
+
+static WorkerArgs
+parse_arg_string(Word arg_string)
+{
+  WorkerArgs args = { .step_limit = STAGE_STEP_LIMIT };
+  unsigned int pos = 0U;
+  while (pos != arg_string.len) {
+    if (arg_string.start[pos] == ' ') {
+      pos++;
+      continue;
+    }
+    char arg[FILEPATH_LIMIT];
+    unsigned int len = 0U;
+    while (pos != arg_string.len && arg_string.start[pos] != ' ') {
+      if (len != FILEPATH_LIMIT - 1U)
+        arg[len++] = arg_string.start[pos];
+      pos++;
+    }
+    arg[len] = '\0';
+    parse_worker_arg(arg, &args);
+  }
+  return args;
+}
+
+// makes room for len more bytes past the end of memory
+static _Bool
+reserve_memory(TermiteMemory* memory, unsigned long long len)
+{
+  unsigned long long required = memory->size + len;
+  if (required > 0xFFFFFFFFU)
+    return (_Bool)0;
+  return required <= memory->capacity || memory->reserve(memory, (unsigned int)required) ? (_Bool)1 : (_Bool)0;
+}
+
+// hex pairs become bytes, whitespace is dropped and everything else is taken as it is
+static _Bool
+push_data(Word data, TermiteMemory* out)
+{
+  unsigned int size;
+  if (!reserve_memory(out, data.len) || !codec_decode((const unsigned char*)data.start, data.len, &out->data[out->size], &size))
+    return (_Bool)0;
+  out->size += size;
+  return (_Bool)1;
+}
+
+static _Bool
+invis_to_hex(const TermiteMemory* in, TermiteMemory* out)
+{
+  if (!reserve_memory(out, in->size * 2ULL))
+    return (_Bool)0;
+  out->size += codec_escape(in->data, in->size, &out->data[out->size]);
+  return (_Bool)1;
+}
+
+static int
+load_script_program(Word word, _Bool is_path)
+{
+  if (!is_path)
+    return load_program_bytes(word.start, word.len, &stage_program);
+
+  char path[FILEPATH_LIMIT + 1U];
+  unsigned int len = word.len;
+  if (len + sizeof(".tm") > sizeof(path))
+    return OC_FILE_ERROR;
+  memcpy(path, word.start, len);
+  path[len] = '\0';
+  if (len < 3U || !compare_cstring(&path[len - 3U], ".tm"))
+    memcpy(&path[len], ".tm", sizeof(".tm"));
+
+  TermiteHandle file;
+  if (!open_file(path, &file, foFileRead))
+    return OC_FILE_ERROR;
+  int status = load_program(file, &stage_program);
+  if (!close_file(file) && status == OC_OK)
+    status = OC_FILE_ERROR;
+  return status;
+}
+
+static void
+report(const char* message, Word word)
+{
+  write_cstring(get_stderr(), "hivemind: ");
+  write_cstring(get_stderr(), message);
+  if (word.len != 0U) {
+    write_cstring(get_stderr(), " '");
+    write_file(get_stderr(), word.start, word.len);
+    write_cstring(get_stderr(), "'");
+  }
+  write_cstring(get_stderr(), "\n");
+}
+
+static char*
+read_script(const char* path, unsigned int* size)
+{
+  TermiteHandle file;
+  if (!open_file(path, &file, foFileRead))
+    return NULL;
+
+  TermiteMemory script;
+  init_memory(&script);
+  int status = OC_OK;
+  TermiteHandle handle = memory_handle(&script);
+  char buffer[4096];
+  unsigned int chars_read;
+  do {
+    if (!read_file(file, buffer, sizeof(buffer), &chars_read) || !write_file(handle, buffer, chars_read))
+      status = OC_FILE_ERROR;
+  } while (chars_read != 0U && status == OC_OK);
+  close_file(file);
+
+  if (status != OC_OK || script.data == NULL) {
+    free(script.data);
+    return NULL;
+  }
+  *size = script.size;
+  return (char*)script.data;
+}
+
+int
+term_main(int argc, const char** argv)
+{
+  if (argc < 2)
+    return OC_FILE_ERROR; // no script given
+
+  init_io();
+
+  unsigned int size = 0U;
+  char* script = read_script(argv[1], &size);
+  if (script == NULL) {
+    report("can't read script", (Word){ argv[1], count_cstring(argv[1]) });
+    deinit_io();
+    return OC_FILE_ERROR;
+  }
+
+  // output of the last stage and the one that is being produced, they're swapped after every stage
+  TermiteMemory buffers[2];
+  init_memory(&buffers[0]);
+  init_memory(&buffers[1]);
+  TermiteMemory* current = &buffers[0];
+  TermiteMemory* spare = &buffers[1];
+
+  int return_code = OC_OK;
+  unsigned int cursor = 0U;
+  Word words[WORD_LIMIT];
+  unsigned int count = 0U;
+  const Word none = { NULL, 0U };
+
+  while (return_code == OC_OK && next_command(script, size, &cursor, words, &count)) {
+    Word code = none;
+    Word arg_string = none;
+    _Bool is_path = (_Bool)0;
+
+    if (is_word(words[0], "run") && count == 3U) {
+      arg_string = words[1];
+      code = words[2];
+    } else if (is_word(words[0], "run") && count == 2U) {
+      code = words[1];
+    } else if (is_word(words[0], "script") && count == 3U) {
+      arg_string = words[1];
+      code = words[2];
+      is_path = (_Bool)1;
+    } else if (is_word(words[0], "script") && count == 2U) {
+      code = words[1];
+      is_path = (_Bool)1;
+    } else if (is_word(words[0], "data") && count == 2U) {
+      if (!push_data(words[1], current)) {
+        report("ill-formed data", words[1]);
+        return_code = OC_INVALID_INPUT;
+      }
+      continue;
+    } else if (is_word(words[0], "hex") && count == 1U) {
+      spare->size = 0U;
+      if (!invis_to_hex(current, spare))
+        return_code = OC_FILE_ERROR;
+      TermiteMemory* swap = current;
+      current = spare;
+      spare = swap;
+      continue;
+    } else if (is_word(words[0], "seed") && count <= 2U) {
+      unsigned char seed = (unsigned char)time(NULL);
+      _Bool is_number = (_Bool)1;
+      if (count == 2U) {
+        seed = 0U;
+        for (unsigned int i = 0U; i < words[1].len; i++) {
+          char ch = words[1].start[i];
+          if (ch < '0' || ch > '9')
+            is_number = (_Bool)0;
+          seed = (unsigned char)(seed * 10U + (unsigned char)(ch - '0'));
+        }
+      }
+      if (!is_number) {
+        report("ill-formed seed", words[1]);
+        return_code = OC_INVALID_INPUT;
+      } else if (!append_memory(current, &seed, 1U))
+        return_code = OC_FILE_ERROR;
+      continue;
+    } else if (is_word(words[0], "drop") && count == 1U) {
+      current->size = 0U;
+      continue;
+    } else if (count == 1U) {
+      code = words[0];
+      arg_string = (Word){ "d", 1U };
+    } else {
+      report("unknown command", words[0]);
+      return_code = OC_INVALID_INPUT;
+      break;
+    }
+
+    WorkerArgs args = parse_arg_string(arg_string);
+    int status = load_script_program(code, is_path);
+    if (status == OC_OK) {
+      if (!args.use_cache || !cache_load(&stage_program)) {
+        index_program(&stage_program);
+        if (args.use_cache)
+          cache_store(&stage_program);
+      }
+
+      spare->size = 0U;
+      status = run_described(&stage_program, current, spare, args, 0U);
+      unload_program(&stage_program);
+
+      TermiteMemory* swap = current;
+      current = spare;
+      spare = swap;
+      if (status != OC_OK) {
+        report("can't run " ERROR_PROGRAM, none);
+        return_code = status;
+      }
+    } else {
+      report(is_path ? "can't load script" : "can't load code", code);
+      return_code = status;
+    }
+  }
+
+  if (return_code == OC_OK && cursor != size) {
+    report("too many words in command", words[0]);
+    return_code = OC_INVALID_INPUT;
+  }
+  if (current->size != 0U)
+    write_file(get_stdout(), (const char*)current->data, current->size);
+
+  free(buffers[0].data);
+  free(buffers[1].data);
+  free(script);
+  if (is_error_program_loaded)
+    unload_program(&error_program);
+  deinit_io();
+
+  return return_code;
+}
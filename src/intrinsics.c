@@ -0,0 +1,506 @@
+#include <stddef.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "io.h"
+#include "common.h"
+#include "terms.h"
+#include "program.h"
+#include "intrinsics.h"
+
+#define CHUNK_SIZE 4096U
+
+// routines never check stack on their own, they only run with enough room for their peak depth
+static inline _Bool
+has_room(const IntrinsicState* state, unsigned int peak)
+{
+  return state->stack_head + peak <= STACK_LIMIT ? (_Bool)1 : (_Bool)0;
+}
+
+static inline void
+push(IntrinsicState* state, unsigned char value)
+{
+  state->stack[state->stack_head++] = value;
+}
+
+static inline unsigned char
+pop(IntrinsicState* state)
+{
+  return state->stack[--state->stack_head];
+}
+
+// '>' followed by '.', exhausted input gives 0
+// returns 0 on read error
+static _Bool
+read_value(IntrinsicState* state, unsigned char* value)
+{
+  char ch;
+  unsigned int chars_read;
+  if (!read_file(state->in, &ch, 1U, &chars_read))
+    return (_Bool)0;
+  *value = chars_read != 0U ? (unsigned char)ch : 0U;
+  return (_Bool)1;
+}
+
+static inline void
+write_digit(IntrinsicState* state, unsigned char digit)
+{
+  // '@0A?~07*30++' of to-hex, which is also correct for decimal digits
+  write_byte(state->out, (unsigned char)(digit + 0x30U + (digit >= 0x0AU) * 0x07U));
+}
+
+// writes byte map of pass-through loop over bytes in place
+static void
+map_bytes(const IntrinsicSite* site, unsigned char* bytes, unsigned int len)
+{
+  unsigned int i = 0U;
+  if (site->map_kind == PASS_AFFINE) {
+#if defined(__SSE2__)
+    // there's no multiplication of bytes, so even and odd ones are multiplied as low and high halves of words
+    __m128i scale = _mm_set1_epi16((short)site->map_scale);
+    __m128i shift = _mm_set1_epi8((char)site->map_shift);
+    __m128i low_halves = _mm_set1_epi16(0x00FF);
+    for (; i + 16U <= len; i += 16U) {
+      __m128i block = _mm_loadu_si128((const __m128i*)&bytes[i]);
+      __m128i even = _mm_and_si128(_mm_mullo_epi16(block, scale), low_halves);
+      __m128i odd = _mm_slli_epi16(_mm_mullo_epi16(_mm_srli_epi16(block, 8), scale), 8);
+      _mm_storeu_si128((__m128i*)&bytes[i], _mm_add_epi8(_mm_or_si128(even, odd), shift));
+    }
+#endif
+    for (; i < len; i++)
+      bytes[i] = (unsigned char)(site->map_scale * bytes[i] + site->map_shift);
+  } else {
+    for (; i < len; i++)
+      bytes[i] = site->map[bytes[i]];
+  }
+}
+
+// >~03*]<07[. and pass-through loops with byte map
+static int
+echo(IntrinsicState* state)
+{
+  if (!has_room(state, 3U))
+    return INTRINSIC_DECLINED;
+
+  // input is consumed until it's exhausted anyway, so it's moved in bulk and stack is left untouched
+  const IntrinsicSite* site = state->site;
+  unsigned long long byte_steps = 8ULL + site->map_tokens;
+  if (site->map_kind == PASS_COPY) {
+    unsigned long long transferred;
+    _Bool status = transfer_file(state->in, state->out, &transferred);
+    state->steps += byte_steps * transferred;
+    if (!status)
+      return OC_FILE_ERROR;
+  } else {
+    unsigned char chunk[TRANSFER_CHUNK_SIZE];
+    unsigned int chars_read;
+    while (1) {
+      if (!read_file(state->in, (char*)chunk, TRANSFER_CHUNK_SIZE, &chars_read))
+        return OC_FILE_ERROR;
+      if (chars_read == 0U)
+        break;
+      map_bytes(site, chunk, chars_read);
+      write_file(state->out, (const char*)chunk, chars_read);
+      state->steps += byte_steps * chars_read;
+    }
+  }
+  state->steps += 6U;
+  return OC_OK;
+}
+
+// >~02*]06[
+static int
+read_all(IntrinsicState* state)
+{
+  while (1) {
+    if (!has_room(state, 3U))
+      return INTRINSIC_DECLINED;
+
+    // chars are read right onto the stack, but no more than loop could push without declining
+    unsigned int chars_read;
+    unsigned int room = STACK_LIMIT - 2U - state->stack_head;
+    if (!read_file(state->in, (char*)&state->stack[state->stack_head], room < CHUNK_SIZE ? room : CHUNK_SIZE, &chars_read))
+      return OC_FILE_ERROR;
+    if (chars_read == 0U)
+      break;
+    state->stack_head += chars_read;
+    state->steps += 7ULL * chars_read;
+  }
+  push(state, 0U);
+  state->steps += 5U;
+  return OC_OK;
+}
+
+// >.@0A=~08*[..
+static int
+read_line(IntrinsicState* state)
+{
+  // reads are done char by char, as nothing past line feed should be consumed
+  unsigned char ch;
+  do {
+    if (!has_room(state, 3U))
+      return INTRINSIC_DECLINED;
+    if (!read_value(state, &ch))
+      return OC_FILE_ERROR;
+    push(state, ch);
+    state->steps += 9U;
+  } while (ch != '\n');
+
+  // line feed goes and so does char before it, which isn't there for empty line on empty stack
+  state->stack_head--;
+  state->steps++;
+  if (state->stack_head == 0U)
+    return OC_STACK_EXHAUSTED;
+  state->stack_head--;
+  state->steps++;
+  return OC_OK;
+}
+
+// >.@00=02*]09[
+static int
+read_string(IntrinsicState* state)
+{
+  unsigned char ch;
+  while (1) {
+    if (!has_room(state, 3U))
+      return INTRINSIC_DECLINED;
+    if (!read_value(state, &ch))
+      return OC_FILE_ERROR;
+    push(state, ch);
+    if (ch == 0U)
+      break;
+    state->steps += 10U;
+  }
+  state->steps += 8U;
+  return OC_OK;
+}
+
+// >.@10/@0A?~07*30++<@10/10*-@0A?~07*30++<
+static int
+to_hex(IntrinsicState* state)
+{
+  if (!has_room(state, 4U))
+    return INTRINSIC_DECLINED;
+
+  unsigned char value;
+  if (!read_value(state, &value))
+    return OC_FILE_ERROR;
+  write_digit(state, value >> 4U);
+  write_digit(state, value & 0x0FU);
+  state->steps += 31U;
+  return OC_OK;
+}
+
+// >.@64/@30+<64*-@0A/@30+<0A*-30+<
+static int
+to_decimal(IntrinsicState* state)
+{
+  if (!has_room(state, 4U))
+    return INTRINSIC_DECLINED;
+
+  unsigned char value;
+  if (!read_value(state, &value))
+    return OC_FILE_ERROR;
+  write_digit(state, value / 100U);
+  write_digit(state, value % 100U / 10U);
+  write_digit(state, value % 10U);
+  state->steps += 25U;
+  return OC_OK;
+}
+
+// '$', first value on the stack goes to the end
+static void
+ronvey(IntrinsicState* state)
+{
+  unsigned char first = state->stack[0];
+  for (unsigned int i = 1U; i < state->stack_head; i++)
+    state->stack[i - 1U] = state->stack[i];
+  state->stack[state->stack_head - 1U] = first;
+}
+
+static void
+swap(IntrinsicState* state)
+{
+  unsigned char top = state->stack[state->stack_head - 1U];
+  state->stack[state->stack_head - 1U] = state->stack[state->stack_head - 2U];
+  state->stack[state->stack_head - 2U] = top;
+}
+
+// >.>.>.@$?~^$?^=<
+static int
+check_range(IntrinsicState* state)
+{
+  if (!has_room(state, 4U))
+    return INTRINSIC_DECLINED;
+
+  unsigned char value;
+  for (unsigned int i = 0U; i < 3U; i++) {
+    if (!read_value(state, &value))
+      return OC_FILE_ERROR;
+    push(state, value);
+    state->steps += 2U;
+  }
+
+  // conveyors take from the bottom of whole stack, so its operators are repeated as they are
+  push(state, state->stack[state->stack_head - 1U]);
+  ronvey(state);
+  value = pop(state);
+  push(state, pop(state) < value);
+  state->stack[state->stack_head - 1U] ^= 1U;
+  swap(state);
+  ronvey(state);
+  value = pop(state);
+  push(state, pop(state) < value);
+  swap(state);
+  value = pop(state);
+  write_byte(state->out, pop(state) == value);
+  state->steps += 10U;
+  return OC_OK;
+}
+
+// >.>.>.#^@$@#=~03*]0113]#@$@#^$=~03*]0004]01+1E[<...
+static int
+check_range_2(IntrinsicState* state)
+{
+  if (!has_room(state, 6U))
+    return INTRINSIC_DECLINED;
+
+  unsigned char value;
+  for (unsigned int i = 0U; i < 3U; i++) {
+    if (!read_value(state, &value))
+      return OC_FILE_ERROR;
+    push(state, value);
+    state->steps += 2U;
+  }
+  unsigned char x = pop(state);
+  unsigned char z = pop(state);
+  unsigned char a = pop(state);
+  state->steps += 2U;
+
+  // a is counted up until it meets x, which is checked first, or z, wrapping around
+  while (a != x && a != z) {
+    a++;
+    state->steps += 25U;
+  }
+  write_byte(state->out, a == x);
+  state->steps += a == x ? 16U : 28U;
+
+  // conveyors leave x at the bottom, the last '.' drops whatever was on top before the body
+  if (state->stack_head != 0U) {
+    for (unsigned int i = state->stack_head - 1U; i != 0U; i--)
+      state->stack[i] = state->stack[i - 1U];
+    state->stack[0] = x;
+  }
+  return OC_OK;
+}
+
+// todo: invis-to-hex, it doesn't even parse yet
+// echo goes first, as sites of pass-through loops refer to it by index
+const Intrinsic intrinsics[] = {
+  { "echo",          ">~03*]<07[.",                                         echo },
+  { "read",          ">~02*]06[",                                           read_all },
+  { "read-line",     ">.@0A=~08*[..",                                       read_line },
+  { "read-string",   ">.@00=02*]09[",                                       read_string },
+  { "to-hex",        ">.@10/@0A?~07*30++<@10/10*-@0A?~07*30++<",            to_hex },
+  { "to-decimal",    ">.@64/@30+<64*-@0A/@30+<0A*-30+<",                    to_decimal },
+  { "check-range",   ">.>.>.@$?~^$?^=<",                                    check_range },
+  { "check-range-2", ">.>.>.#^@$@#=~03*]0113]#@$@#^$=~03*]0004]01+1E[<...", check_range_2 },
+};
+const unsigned int intrinsic_count = sizeof(intrinsics) / sizeof(intrinsics[0]);
+
+// token counts and hashes of canonical bodies, computed on first search
+static unsigned int       body_tokens[sizeof(intrinsics) / sizeof(intrinsics[0])];
+static unsigned long long body_hashes[sizeof(intrinsics) / sizeof(intrinsics[0])];
+static unsigned int       longest_body;
+
+static void
+hash_bodies(void)
+{
+  for (unsigned int i = 0U; i < intrinsic_count; i++) {
+    const char* body = intrinsics[i].body;
+    unsigned int len = count_cstring(body);
+    unsigned int tokens = 0U;
+    for (unsigned int c = 0U; c < len; c++, tokens++) {
+      if (is_hex_char(body[c]))
+        c++;
+    }
+    // without whitespace body is the same sequence of bytes as its tokens
+    body_tokens[i] = tokens;
+    body_hashes[i] = hash_byte_array(HASH_SEED, (const unsigned char*)body, len);
+    if (tokens > longest_body)
+      longest_body = tokens;
+  }
+}
+
+static _Bool
+is_data_token(const Program* program, unsigned int token)
+{
+  return token < program->token_count && !is_operator_char(token_char(program, token)) ? (_Bool)1 : (_Bool)0;
+}
+
+// ">~J*]" map "<R[." where map is m tokens long, J is 3 + m and R is 7 + m
+//   map is sequence of '~' and data tokens followed by '+', '-', '*', '/', '=' or '?',
+//   it's applied to byte that is read and leaves byte that is written, division by zero is left to interpreter
+// returns count of tokens in the loop and fills map of site, or 0 if there's no such loop at given token
+static unsigned int
+match_pass_through(const Program* program, unsigned int first, IntrinsicSite* site)
+{
+  if (first + 5U > program->token_count ||
+      token_char(program, first + 1U) != '~' || !is_data_token(program, first + 2U) ||
+      token_char(program, first + 3U) != '*' || token_char(program, first + 4U) != ']')
+  {
+    return 0U;
+  }
+
+  unsigned int token = first + 5U;
+  while (token < program->token_count && token_char(program, token) != '<') {
+    if (token_char(program, token) == '~') {
+      token++;
+      continue;
+    }
+    if (!is_data_token(program, token) || token + 1U == program->token_count)
+      return 0U;
+    switch (token_char(program, token + 1U)) {
+      case '+': case '-': case '*': case '=': case '?':
+        break;
+      case '/':
+        if (token_value(program, token) == 0U)
+          return 0U;
+        break;
+      default:
+        return 0U;
+    }
+    token += 2U;
+  }
+
+  unsigned int map_tokens = token - (first + 5U);
+  if (token + 4U > program->token_count || map_tokens > 0xFFU - 7U ||
+      token_value(program, first + 2U) != 3U + map_tokens || !is_data_token(program, token + 1U) ||
+      token_value(program, token + 1U) != 7U + map_tokens ||
+      token_char(program, token + 2U) != '[' || token_char(program, token + 3U) != '.')
+  {
+    return 0U;
+  }
+
+  // map is interpreted once for every byte, the same as '=', '?' and arithmetic of byte cells do it
+  _Bool is_copy = (_Bool)1;
+  for (unsigned int byte = 0U; byte < 256U; byte++) {
+    unsigned char value = (unsigned char)byte;
+    for (unsigned int t = first + 5U; t < token; t++) {
+      if (token_char(program, t) == '~') {
+        value ^= 1U;
+        continue;
+      }
+      unsigned char operand = token_value(program, t++);
+      switch (token_char(program, t)) {
+        case '+': value = (unsigned char)(value + operand); break;
+        case '-': value = (unsigned char)(value - operand); break;
+        case '*': value = (unsigned char)(value * operand); break;
+        case '/': value = (unsigned char)(value / operand); break;
+        case '=': value = value == operand; break;
+        case '?': value = value < operand; break;
+      }
+    }
+    site->map[byte] = value;
+    if (value != byte)
+      is_copy = (_Bool)0;
+  }
+
+  site->map_tokens = map_tokens;
+  site->map_shift = site->map[0];
+  site->map_scale = (unsigned char)(site->map[1] - site->map[0]);
+  site->map_kind = is_copy ? PASS_COPY : PASS_AFFINE;
+  for (unsigned int byte = 0U; byte < 256U && site->map_kind == PASS_AFFINE; byte++) {
+    if (site->map[byte] != (unsigned char)(site->map_scale * byte + site->map_shift))
+      site->map_kind = PASS_TABLE;
+  }
+  return map_tokens + 9U;
+}
+
+static _Bool
+is_body_at(const Program* program, unsigned int first, const char* body)
+{
+  for (unsigned int token = first; *body != '\0'; token++) {
+    unsigned int offset = program->token_offsets[token];
+    unsigned int len = token_end(program, token) - offset;
+    for (unsigned int i = 0U; i < len; i++, body++) {
+      if (*body != program->source[offset + i])
+        return (_Bool)0;
+    }
+  }
+  return (_Bool)1;
+}
+
+void
+find_intrinsic_sites(Program* program)
+{
+  program->intrinsic_site_count = 0U;
+  if (!program->well_formed)
+    return;
+  if (longest_body == 0U)
+    hash_bodies();
+
+  unsigned int token = 0U;
+  while (token < program->token_count && program->intrinsic_site_count < INTRINSIC_SITE_LIMIT) {
+    if (token_char(program, token) != '>') {
+      token++;
+      continue;
+    }
+
+    // echo is the pass-through loop with empty map, every such loop is run by it
+    IntrinsicSite* site = &program->intrinsic_sites[program->intrinsic_site_count];
+    unsigned int loop_tokens = match_pass_through(program, token, site);
+    if (loop_tokens != 0U) {
+      site->offset = program->token_offsets[token];
+      site->end = token_end(program, token + loop_tokens - 1U);
+      site->intrinsic = 0U;
+      program->intrinsic_site_count++;
+      token += loop_tokens;
+      continue;
+    }
+
+    // normalized hash is extended token by token and checked against bodies of that length
+    unsigned long long hash = HASH_SEED;
+    unsigned int found = intrinsic_count;
+    for (unsigned int len = 1U; len <= longest_body && token + len <= program->token_count; len++) {
+      unsigned int last = token + len - 1U;
+      unsigned int offset = program->token_offsets[last];
+      hash = hash_byte_array(hash, (const unsigned char*)&program->source[offset], token_end(program, last) - offset);
+
+      for (unsigned int i = 0U; i < intrinsic_count; i++) {
+        if (body_tokens[i] == len && body_hashes[i] == hash && is_body_at(program, token, intrinsics[i].body))
+          found = i;
+      }
+    }
+    if (found == intrinsic_count) {
+      token++;
+      continue;
+    }
+
+    program->intrinsic_site_count++;
+    site->offset = program->token_offsets[token];
+    site->end = token_end(program, token + body_tokens[found] - 1U);
+    site->intrinsic = found;
+    site->map_tokens = 0U;
+    token += body_tokens[found];
+  }
+}
+
+const IntrinsicSite*
+intrinsic_site_at(const Program* program, unsigned int offset)
+{
+  unsigned int low = 0U;
+  unsigned int high = program->intrinsic_site_count;
+  while (low < high) {
+    unsigned int middle = low + (high - low) / 2U;
+    const IntrinsicSite* site = &program->intrinsic_sites[middle];
+    if (site->offset == offset)
+      return site;
+    if (site->offset < offset)
+      low = middle + 1U;
+    else
+      high = middle;
+  }
+  return NULL;
+}
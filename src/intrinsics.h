@@ -0,0 +1,49 @@
+#ifndef INTRINSICS_H
+#define INTRINSICS_H
+
+#include "io.h"
+#include "program.h"
+
+// Native implementations of std routines
+//   Bodies are matched by hash of their tokens, so whitespace and line breaks don't matter
+//   Every body begins with '>', so interpreter only looks for them on reads
+//   Routines run only when stack has room for their peak depth, otherwise they decline
+//   and the body is interpreted, which leaves every edge case failure to the interpreter
+//   Looping routines could decline at the head of their loop after any number of iterations
+//   Echo also stands for pass-through loops that put byte map between ']' and '<' of its body,
+//   such as ">~05*]20+<09[.", map is evaluated for every byte at load time, then loop is run over chunks of input,
+//   loops that write bytes as they are read move them from file to file without copying them through the process
+
+#define INTRINSIC_DECLINED -1
+
+// state of byte cell interpreter that routine operates on
+typedef struct {
+  unsigned char*       stack;
+  unsigned int         stack_head;
+  TermiteHandle        out;
+  TermiteHandle        in;
+  unsigned long long   steps; // tokens that interpreter would have executed
+  const IntrinsicSite* site;  // that routine is run for
+} IntrinsicState;
+
+// returns OC_OK, termite exit code on failure or INTRINSIC_DECLINED
+typedef int (*IntrinsicRoutine)(IntrinsicState* state);
+
+typedef struct {
+  const char*      name; // std routine it stands for
+  const char*      body; // canonical body without whitespace
+  IntrinsicRoutine routine;
+} Intrinsic;
+
+extern const Intrinsic intrinsics[];
+extern const unsigned int intrinsic_count;
+
+// records sites of known bodies and pass-through loops in indexed program, programs with malformed hex tokens have none
+void
+find_intrinsic_sites(Program* program);
+
+// returns NULL if no body starts at given offset
+const IntrinsicSite*
+intrinsic_site_at(const Program* program, unsigned int offset);
+
+#endif
@@ -8,15 +8,51 @@ typedef void* TermiteHandle;
 typedef enum {
   foFileRead,
   foFileWrite,
+  foFileCreate, // creates file for writing, rewrites if it exists
 } FileOpenIntents;
 
+// read only view of whole file
+typedef struct {
+  const unsigned char* data;
+  unsigned int size;
+  TermiteHandle file;
+  TermiteHandle view;
+} TermiteMapping;
+
+// memory backed stream, its handle could be used with read_file, write_file and close_file in place of file
+//   reads consume bytes from position up to size, writes append at size
+//   reserve is called when write doesn't fit into capacity, write fails if it's NULL or couldn't make room
+//   written is called after every write with offset of appended bytes, could be NULL
+//   refill is called when reads reach size, it could replace consumed bytes with more, could be NULL
+typedef struct TermiteMemory {
+  unsigned char* data;
+  unsigned int   size;
+  unsigned int   capacity;
+  unsigned int   position;
+  _Bool        (*reserve)(struct TermiteMemory* memory, unsigned int required);
+  void         (*written)(struct TermiteMemory* memory, unsigned int offset);
+  _Bool        (*refill)(struct TermiteMemory* memory);
+  void*          context;
+} TermiteMemory;
+
 TermiteHandle get_stdout(void);
 TermiteHandle get_stdin(void);
+TermiteHandle get_stderr(void);
 
 // todo: make them return status?
 void init_io(void);
 void deinit_io(void);
 
+// moves stdin prefetching and stdout draining to separate thread, so they overlap with interpretation
+// has to be called after init_io, deinit_io flushes everything that is left and stops the thread
+// returns 0 if it's not supported, io stays synchronous then
+_Bool
+start_io_thread(void);
+
+// handle of memory stream, it stays valid for as long as memory itself
+TermiteHandle
+memory_handle(TermiteMemory* memory);
+
 // returns 0 on file opening error, 1 otherwise
 _Bool
 open_file(const char* path, TermiteHandle* result, FileOpenIntents intent);
@@ -36,4 +72,40 @@ read_file(TermiteHandle file,
           unsigned int limit,
           unsigned int* restrict read_result);
 
+// moves what's left of in to out until in is exhausted, transferred receives count of moved bytes
+//   bytes go from file to file without copying them through the process where system allows it
+//   write errors are ignored, in is still consumed to the end, returns 0 on read error, 1 otherwise
+_Bool
+transfer_file(TermiteHandle in, TermiteHandle out, unsigned long long* transferred);
+
+// returns 0 on mapping error or if file is empty, 1 otherwise
+_Bool
+map_file(const char* path, TermiteMapping* result);
+
+// returns 0 on error, 1 otherwise
+_Bool
+unmap_file(TermiteMapping* mapping);
+
+// returns 0 on error, 1 otherwise
+_Bool
+delete_file(const char* path);
+
+// moves file over destination in one step, processes that mapped the old destination keep seeing it whole
+// returns 0 on error, 1 otherwise
+_Bool
+replace_file(const char* source, const char* destination);
+
+// number that no other running process has, for naming files that are written before they're put in place
+unsigned int
+get_process_id(void);
+
+// returns 0 on error, 1 if directory was created or already exists
+_Bool
+create_directory(const char* path);
+
+// blocks until exclusive lock on open file is taken, it's released when file is closed
+// returns 0 on error, 1 otherwise
+_Bool
+lock_file(TermiteHandle file);
+
 #endif
@@ -0,0 +1,541 @@
+#define _GNU_SOURCE
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/file.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+// Linux counterpart of win.c, implemented over POSIX calls
+
+#include "io.h"
+#include "common.h"
+#include "terms.h"
+#include "memory.h"
+
+// handles are descriptors shifted by one, so NULL handle is never valid
+#define HANDLE_TO_FD(handle) ((int)(size_t)(handle) - 1)
+#define FD_TO_HANDLE(fd)     ((TermiteHandle)(size_t)((fd) + 1))
+
+#define ASYNC_BUFFER_SIZE 65536U
+
+static char stdout_buffer[STDOUT_BUFFER_SIZE];
+static unsigned int stdout_buffer_written;
+
+// Overlapped io, stdin and stdout are both double buffered
+//   Every buffer is owned either by interpreter or by io thread, which is told by is_full flag
+//   Producer fills buffer and sets the flag, consumer empties it and clears the flag, so they never touch it at once
+//   Buffers of each stream are passed in turns, which keeps order of data
+//   Io thread is woken through eventfd, interpreter waits on futex of io_sequence, which is bumped on every hand over
+
+typedef struct {
+  char          data[ASYNC_BUFFER_SIZE];
+  unsigned int  len;
+  _Bool         is_failed; // read error, length is 0 then
+  atomic_uint   is_full;
+} AsyncBuffer;
+
+static _Bool        is_async;
+static pthread_t    io_thread;
+static int          io_event = -1;
+static atomic_uint  io_sequence;
+static atomic_uint  is_stopping;
+
+static AsyncBuffer  in_buffers[2];
+static AsyncBuffer  out_buffers[2];
+static unsigned int in_front;
+static unsigned int in_position;
+static unsigned int out_front;
+
+static _Bool
+write_file_impl(int fd, const char* msg, unsigned int len)
+{
+  while (len != 0U) {
+    ssize_t chars_written = write(fd, msg, len);
+    if (chars_written < 0) {
+      if (errno == EINTR)
+        continue;
+      return (_Bool)0;
+    }
+    msg += chars_written;
+    len -= (unsigned int)chars_written;
+  }
+  return (_Bool)1;
+}
+
+static void
+wake_io_thread(void)
+{
+  unsigned long long increment = 1U;
+  while (write(io_event, &increment, sizeof(increment)) < 0 && errno == EINTR) {}
+}
+
+static void
+wake_interpreter(void)
+{
+  atomic_fetch_add(&io_sequence, 1U);
+  syscall(SYS_futex, &io_sequence, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+// waits for buffer to be in given state, sequence is read before the check so wake up is never missed
+static void
+wait_for_buffer(AsyncBuffer* buffer, unsigned int is_full)
+{
+  while (1) {
+    unsigned int seen = atomic_load(&io_sequence);
+    if (atomic_load_explicit(&buffer->is_full, memory_order_acquire) == is_full)
+      return;
+    syscall(SYS_futex, &io_sequence, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+  }
+}
+
+static void*
+io_thread_main(void* arg)
+{
+  (void)arg;
+  unsigned int in_back = 0U;
+  unsigned int out_back = 0U;
+  _Bool is_input_over = (_Bool)0;
+
+  while (1) {
+    // stop request is read before draining, so everything published before it is written out
+    _Bool is_stop_requested = atomic_load(&is_stopping) != 0U ? (_Bool)1 : (_Bool)0;
+
+    while (atomic_load_explicit(&out_buffers[out_back].is_full, memory_order_acquire) != 0U) {
+      AsyncBuffer* buffer = &out_buffers[out_back];
+      write_file_impl(STDOUT_FILENO, buffer->data, buffer->len);
+      buffer->len = 0U;
+      atomic_store_explicit(&buffer->is_full, 0U, memory_order_release);
+      out_back ^= 1U;
+      wake_interpreter();
+    }
+    if (is_stop_requested)
+      break;
+
+    // stdin is only polled when there's somewhere to put it, so blocking read never holds back output
+    AsyncBuffer* buffer = &in_buffers[in_back];
+    _Bool is_reading = !is_input_over && atomic_load_explicit(&buffer->is_full, memory_order_acquire) == 0U;
+    struct pollfd fds[2] = {
+      { .fd = io_event, .events = POLLIN },
+      { .fd = STDIN_FILENO, .events = POLLIN },
+    };
+    if (poll(fds, is_reading ? 2U : 1U, -1) < 0)
+      continue;
+
+    if ((fds[0].revents & POLLIN) != 0) {
+      unsigned long long events;
+      (void)!read(io_event, &events, sizeof(events));
+    }
+    if (is_reading && fds[1].revents != 0) {
+      ssize_t chars_read = read(STDIN_FILENO, buffer->data, ASYNC_BUFFER_SIZE);
+      if (chars_read < 0 && errno == EINTR)
+        continue;
+      // the last buffer is left empty for good, every read after end of input gets nothing from it
+      buffer->len = chars_read > 0 ? (unsigned int)chars_read : 0U;
+      buffer->is_failed = chars_read < 0 ? (_Bool)1 : (_Bool)0;
+      if (chars_read <= 0)
+        is_input_over = (_Bool)1;
+      atomic_store_explicit(&buffer->is_full, 1U, memory_order_release);
+      in_back ^= 1U;
+      wake_interpreter();
+    }
+  }
+  return NULL;
+}
+
+// hands current output buffer over to io thread, next one is waited for only when it's written to
+static void
+publish_output(void)
+{
+  atomic_store_explicit(&out_buffers[out_front].is_full, 1U, memory_order_release);
+  out_front ^= 1U;
+  wake_io_thread();
+}
+
+static void
+write_async(const char* msg, unsigned int len)
+{
+  while (len != 0U) {
+    AsyncBuffer* buffer = &out_buffers[out_front];
+    wait_for_buffer(buffer, 0U);
+
+    unsigned int to_write = ASYNC_BUFFER_SIZE - buffer->len;
+    if (to_write > len)
+      to_write = len;
+    for (unsigned int i = 0U; i < to_write; i++)
+      buffer->data[buffer->len + i] = msg[i];
+    buffer->len += to_write;
+    msg += to_write;
+    len -= to_write;
+
+    if (buffer->len == ASYNC_BUFFER_SIZE)
+      publish_output();
+  }
+}
+
+static _Bool
+read_async(char* restrict buff, unsigned int limit, unsigned int* restrict read_result)
+{
+  AsyncBuffer* buffer = &in_buffers[in_front];
+  if (atomic_load_explicit(&buffer->is_full, memory_order_acquire) == 0U) {
+    // whatever was written before input is awaited should be seen, as it could be prompt for that input
+    if (atomic_load_explicit(&out_buffers[out_front].is_full, memory_order_acquire) == 0U &&
+        out_buffers[out_front].len != 0U)
+    {
+      publish_output();
+    }
+    wait_for_buffer(buffer, 1U);
+  }
+
+  *read_result = 0U;
+  if (buffer->is_failed)
+    return (_Bool)0;
+  if (buffer->len == 0U)
+    return (_Bool)1;
+
+  unsigned int to_read = buffer->len - in_position;
+  if (to_read > limit)
+    to_read = limit;
+  for (unsigned int i = 0U; i < to_read; i++)
+    buff[i] = buffer->data[in_position + i];
+  in_position += to_read;
+  *read_result = to_read;
+
+  if (in_position == buffer->len) {
+    in_position = 0U;
+    buffer->len = 0U;
+    atomic_store_explicit(&buffer->is_full, 0U, memory_order_release);
+    in_front ^= 1U;
+    wake_io_thread();
+  }
+  return (_Bool)1;
+}
+
+_Bool
+start_io_thread(void)
+{
+  if (is_async)
+    return (_Bool)1;
+
+  io_event = eventfd(0U, EFD_CLOEXEC);
+  if (io_event < 0)
+    return (_Bool)0;
+
+  for (unsigned int i = 0U; i < 2U; i++) {
+    in_buffers[i].len = 0U;
+    atomic_store(&in_buffers[i].is_full, 0U);
+    out_buffers[i].len = 0U;
+    atomic_store(&out_buffers[i].is_full, 0U);
+  }
+  in_front = 0U;
+  in_position = 0U;
+  out_front = 0U;
+  atomic_store(&is_stopping, 0U);
+
+  // whatever was buffered synchronously goes first
+  if (stdout_buffer_written != 0U)
+    write_file_impl(STDOUT_FILENO, stdout_buffer, stdout_buffer_written);
+  stdout_buffer_written = 0U;
+
+  if (pthread_create(&io_thread, NULL, io_thread_main, NULL) != 0) {
+    close(io_event);
+    io_event = -1;
+    return (_Bool)0;
+  }
+  is_async = (_Bool)1;
+  return (_Bool)1;
+}
+
+static void
+stop_io_thread(void)
+{
+  AsyncBuffer* buffer = &out_buffers[out_front];
+  wait_for_buffer(buffer, 0U);
+  if (buffer->len != 0U)
+    publish_output();
+  atomic_store(&is_stopping, 1U);
+  wake_io_thread();
+  pthread_join(io_thread, NULL);
+
+  close(io_event);
+  io_event = -1;
+  is_async = (_Bool)0;
+}
+
+void
+init_io(void)
+{
+  stdout_buffer_written = 0U;
+}
+
+void
+deinit_io(void)
+{
+  if (is_async)
+    stop_io_thread();
+
+  // check if there's anything left in stdout buffer
+  if (stdout_buffer_written != 0U)
+    write_file_impl(STDOUT_FILENO, stdout_buffer, stdout_buffer_written);
+  stdout_buffer_written = 0U;
+}
+
+TermiteHandle
+get_stdin(void)
+{
+  return FD_TO_HANDLE(STDIN_FILENO);
+}
+
+TermiteHandle
+get_stdout(void)
+{
+  return FD_TO_HANDLE(STDOUT_FILENO);
+}
+
+TermiteHandle
+get_stderr(void)
+{
+  return FD_TO_HANDLE(STDERR_FILENO);
+}
+
+_Bool
+open_file(const char* path, TermiteHandle* result, FileOpenIntents intent)
+{
+  if (count_cstring(path) > FILEPATH_LIMIT)
+    return (_Bool)0;
+
+  int fd = -1;
+  switch (intent) {
+    case foFileRead:
+      fd = open(path, O_RDONLY | O_CLOEXEC);
+      break;
+    case foFileWrite:
+      fd = open(path, O_WRONLY | O_CLOEXEC);
+      break;
+    case foFileCreate:
+      fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+      break;
+  }
+
+  if (fd < 0)
+    return (_Bool)0;
+
+  *result = FD_TO_HANDLE(fd);
+  return (_Bool)1;
+}
+
+_Bool
+close_file(TermiteHandle file)
+{
+  if (is_memory_handle(file))
+    return (_Bool)1;
+
+  return close(HANDLE_TO_FD(file)) == 0 ? (_Bool)1 : (_Bool)0;
+}
+
+_Bool
+write_file(TermiteHandle file, const char* msg, unsigned int len)
+{
+  if (is_memory_handle(file))
+    return write_memory(file, msg, len);
+
+  if (is_async && HANDLE_TO_FD(file) == STDOUT_FILENO) {
+    write_async(msg, len);
+    return (_Bool)1;
+  }
+
+  // messages that would fill the buffer anyway go right after what's buffered, without copying them through it
+  if (HANDLE_TO_FD(file) == STDOUT_FILENO && len >= STDOUT_BUFFER_SIZE) {
+    if (stdout_buffer_written != 0U)
+      write_file_impl(STDOUT_FILENO, stdout_buffer, stdout_buffer_written);
+    stdout_buffer_written = 0U;
+    return write_file_impl(STDOUT_FILENO, msg, len);
+  }
+
+  if (HANDLE_TO_FD(file) == STDOUT_FILENO) {
+    unsigned int base = 0U;
+    while (len > 0U) {
+      // calculate how much of message should be buffered in each iteration
+      unsigned int to_write = STDOUT_BUFFER_SIZE - stdout_buffer_written;
+      if (to_write > len)
+        to_write = len;
+
+      // buffer the msg
+      for (unsigned int i = 0U; i < to_write; i++) {
+        stdout_buffer[stdout_buffer_written + i] = msg[base + i];
+      }
+      stdout_buffer_written += to_write;
+
+      // if buffer is full - write it
+      if (stdout_buffer_written == STDOUT_BUFFER_SIZE) {
+        write_file_impl(STDOUT_FILENO, stdout_buffer, STDOUT_BUFFER_SIZE);
+        stdout_buffer_written = 0U;
+      }
+      len -= to_write;
+      base += to_write;
+    }
+    // todo: catch write_file_impl errors on iteration
+    return (_Bool)1;
+  } else {
+    return write_file_impl(HANDLE_TO_FD(file), msg, len);
+  }
+}
+
+_Bool
+read_file(TermiteHandle file,
+          char* restrict buff,
+          unsigned int limit,
+          unsigned int* restrict read_result)
+{
+  if (is_memory_handle(file))
+    return read_memory(file, buff, limit, read_result);
+
+  if (is_async && HANDLE_TO_FD(file) == STDIN_FILENO)
+    return read_async(buff, limit, read_result);
+
+  ssize_t chars_read;
+  do {
+    chars_read = read(HANDLE_TO_FD(file), buff, limit);
+  } while (chars_read < 0 && errno == EINTR);
+
+  if (chars_read < 0) {
+    *read_result = 0U;
+    return (_Bool)0;
+  }
+  *read_result = (unsigned int)chars_read;
+  return (_Bool)1;
+}
+
+static _Bool
+transfer_chunks(TermiteHandle in, TermiteHandle out, unsigned long long* transferred)
+{
+  char chunk[TRANSFER_CHUNK_SIZE];
+  unsigned int chars_read;
+  while (1) {
+    if (!read_file(in, chunk, TRANSFER_CHUNK_SIZE, &chars_read))
+      return (_Bool)0;
+    if (chars_read == 0U)
+      return (_Bool)1;
+    write_file(out, chunk, chars_read);
+    *transferred += chars_read;
+  }
+}
+
+_Bool
+transfer_file(TermiteHandle in, TermiteHandle out, unsigned long long* transferred)
+{
+  *transferred = 0U;
+  // memory streams and io thread have buffers of their own that bytes should go through
+  if (is_memory_handle(in) || is_memory_handle(out) || is_async)
+    return transfer_chunks(in, out, transferred);
+
+  int in_fd = HANDLE_TO_FD(in);
+  int out_fd = HANDLE_TO_FD(out);
+  if (out_fd == STDOUT_FILENO && stdout_buffer_written != 0U)
+    write_file_impl(STDOUT_FILENO, stdout_buffer, stdout_buffer_written);
+  if (out_fd == STDOUT_FILENO)
+    stdout_buffer_written = 0U;
+
+  // copy_file_range works between regular files, splice needs pipe on either side,
+  // call that fails moves nothing, so the next way continues from the same place
+  for (int way = 0; way < 2; way++) {
+    _Bool has_moved = (_Bool)0;
+    while (1) {
+      ssize_t moved = way == 0 ? copy_file_range(in_fd, NULL, out_fd, NULL, TRANSFER_CHUNK_SIZE * 16U, 0U)
+                               : splice(in_fd, NULL, out_fd, NULL, TRANSFER_CHUNK_SIZE * 16U, SPLICE_F_MOVE);
+      if (moved > 0) {
+        *transferred += (unsigned long long)moved;
+        has_moved = (_Bool)1;
+        continue;
+      }
+      // some kernels give 0 from copy_file_range on files of pseudo filesystems, which aren't empty
+      if (moved == 0 && (way != 0 || has_moved))
+        return (_Bool)1;
+      if (moved == 0 || errno != EINTR)
+        break;
+    }
+  }
+  // terminals, sockets on both sides, appending files or failed writes, which are told apart by plain copy
+  return transfer_chunks(in, out, transferred);
+}
+
+_Bool
+map_file(const char* path, TermiteMapping* result)
+{
+  if (!open_file(path, &result->file, foFileRead))
+    return (_Bool)0;
+
+  struct stat info;
+  if (fstat(HANDLE_TO_FD(result->file), &info) != 0 ||
+      info.st_size == 0 ||
+      (unsigned long long)info.st_size > 0xFFFFFFFFULL)
+  {
+    close_file(result->file);
+    return (_Bool)0;
+  }
+
+  void* data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, HANDLE_TO_FD(result->file), 0);
+  if (data == MAP_FAILED) {
+    close_file(result->file);
+    return (_Bool)0;
+  }
+
+  result->data = (const unsigned char*)data;
+  result->size = (unsigned int)info.st_size;
+  result->view = NULL; // there's no separate mapping object
+  return (_Bool)1;
+}
+
+_Bool
+unmap_file(TermiteMapping* mapping)
+{
+  _Bool status = munmap((void*)mapping->data, mapping->size) == 0 ? (_Bool)1 : (_Bool)0;
+  return close_file(mapping->file) && status ? (_Bool)1 : (_Bool)0;
+}
+
+_Bool
+delete_file(const char* path)
+{
+  if (count_cstring(path) > FILEPATH_LIMIT)
+    return (_Bool)0;
+
+  return unlink(path) == 0 ? (_Bool)1 : (_Bool)0;
+}
+
+_Bool
+replace_file(const char* source, const char* destination)
+{
+  if (count_cstring(source) > FILEPATH_LIMIT || count_cstring(destination) > FILEPATH_LIMIT)
+    return (_Bool)0;
+
+  return rename(source, destination) == 0 ? (_Bool)1 : (_Bool)0;
+}
+
+unsigned int
+get_process_id(void)
+{
+  return (unsigned int)getpid();
+}
+
+_Bool
+create_directory(const char* path)
+{
+  return mkdir(path, 0755) == 0 || errno == EEXIST ? (_Bool)1 : (_Bool)0;
+}
+
+_Bool
+lock_file(TermiteHandle file)
+{
+  int status;
+  while ((status = flock(HANDLE_TO_FD(file), LOCK_EX)) != 0 && errno == EINTR) {}
+  return status == 0 ? (_Bool)1 : (_Bool)0;
+}
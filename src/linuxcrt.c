@@ -0,0 +1,9 @@
+// Linux builds link against libc, so entry is just regular main forwarding to term_main
+
+extern int term_main(int argc, const char** argv);
+
+int
+main(int argc, char** argv)
+{
+  return term_main(argc, (const char**)argv);
+}
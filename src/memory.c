@@ -0,0 +1,70 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "io.h"
+#include "memory.h"
+
+// memory handles are tagged pointers, neither native handles nor user space addresses have highest bit set
+#define MEMORY_HANDLE_TAG ((uintptr_t)1U << (sizeof(uintptr_t) * 8U - 1U))
+
+static TermiteMemory*
+handle_memory(TermiteHandle handle)
+{
+  return (TermiteMemory*)((uintptr_t)handle & ~MEMORY_HANDLE_TAG);
+}
+
+TermiteHandle
+memory_handle(TermiteMemory* memory)
+{
+  return (TermiteHandle)((uintptr_t)memory | MEMORY_HANDLE_TAG);
+}
+
+_Bool
+is_memory_handle(TermiteHandle handle)
+{
+  return ((uintptr_t)handle & MEMORY_HANDLE_TAG) != 0U ? (_Bool)1 : (_Bool)0;
+}
+
+_Bool
+read_memory(TermiteHandle handle,
+            char* restrict buff,
+            unsigned int limit,
+            unsigned int* restrict read_result)
+{
+  TermiteMemory* memory = handle_memory(handle);
+  if (memory->position == memory->size && memory->refill != NULL && !memory->refill(memory))
+    return (_Bool)0;
+
+  unsigned int available = memory->size - memory->position;
+  if (limit > available)
+    limit = available;
+
+  for (unsigned int i = 0U; i < limit; i++)
+    buff[i] = (char)memory->data[memory->position + i];
+  memory->position += limit;
+  *read_result = limit;
+  return (_Bool)1;
+}
+
+_Bool
+write_memory(TermiteHandle handle, const char* msg, unsigned int len)
+{
+  TermiteMemory* memory = handle_memory(handle);
+  if (len > memory->capacity - memory->size) {
+    if (memory->size + len < len)
+      return (_Bool)0;
+    if (memory->reserve == NULL || !memory->reserve(memory, memory->size + len))
+      return (_Bool)0;
+    if (len > memory->capacity - memory->size)
+      return (_Bool)0;
+  }
+
+  unsigned int offset = memory->size;
+  for (unsigned int i = 0U; i < len; i++)
+    memory->data[offset + i] = (unsigned char)msg[i];
+  memory->size += len;
+
+  if (memory->written != NULL)
+    memory->written(memory, offset);
+  return (_Bool)1;
+}
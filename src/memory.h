@@ -0,0 +1,22 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include "io.h"
+
+// Memory streams are shared by io backends, which check for them before treating handle as native one
+
+_Bool
+is_memory_handle(TermiteHandle handle);
+
+// returns 0 on read error, 1 otherwise
+_Bool
+read_memory(TermiteHandle handle,
+            char* restrict buff,
+            unsigned int limit,
+            unsigned int* restrict read_result);
+
+// returns 0 if there's no room for all chars, otherwise 1
+_Bool
+write_memory(TermiteHandle handle, const char* msg, unsigned int len);
+
+#endif
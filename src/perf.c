@@ -0,0 +1,171 @@
+#if defined(__linux__)
+  #define _GNU_SOURCE
+  #include <linux/perf_event.h>
+  #include <sys/ioctl.h>
+  #include <sys/syscall.h>
+  #include <unistd.h>
+#endif
+
+#include "io.h"
+#include "common.h"
+#include "perf.h"
+
+static const char* counter_names[PERF_COUNTER_COUNT] = {
+  [pcCycles]       = "cycles        ",
+  [pcInstructions] = "instructions  ",
+  [pcBranchMisses] = "branch misses ",
+  [pcCacheMisses]  = "cache misses  ",
+};
+
+static unsigned long long
+read_ticks(void)
+{
+#if defined(__GNUC__) && (defined(__amd64__) || defined(__i386__))
+  return __builtin_ia32_rdtsc();
+#else
+  return 0U;
+#endif
+}
+
+#if defined(__linux__)
+static const unsigned long long counter_configs[PERF_COUNTER_COUNT] = {
+  [pcCycles]       = PERF_COUNT_HW_CPU_CYCLES,
+  [pcInstructions] = PERF_COUNT_HW_INSTRUCTIONS,
+  [pcBranchMisses] = PERF_COUNT_HW_BRANCH_MISSES,
+  [pcCacheMisses]  = PERF_COUNT_HW_CACHE_MISSES,
+};
+
+// layout of group read with PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING
+typedef struct {
+  unsigned long long count;
+  unsigned long long time_enabled;
+  unsigned long long time_running;
+  unsigned long long values[PERF_COUNTER_COUNT];
+} GroupReading;
+
+static void
+close_counters(PerfSample* sample)
+{
+  for (unsigned int i = 0U; i < PERF_COUNTER_COUNT; i++) {
+    if (sample->descriptors[i] >= 0)
+      close(sample->descriptors[i]);
+    sample->descriptors[i] = -1;
+  }
+}
+
+// all counters are opened as single group, so they are scheduled together and their ratios are meaningful
+static _Bool
+open_counters(PerfSample* sample)
+{
+  for (unsigned int i = 0U; i < PERF_COUNTER_COUNT; i++)
+    sample->descriptors[i] = -1;
+
+  for (unsigned int i = 0U; i < PERF_COUNTER_COUNT; i++) {
+    struct perf_event_attr attr = {
+      .type = PERF_TYPE_HARDWARE,
+      .size = sizeof(struct perf_event_attr),
+      .config = counter_configs[i],
+      .disabled = i == 0U ? 1U : 0U,
+      .exclude_kernel = 1U,
+      .exclude_hv = 1U,
+      .read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING,
+    };
+    int leader = i == 0U ? -1 : sample->descriptors[0];
+    sample->descriptors[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, leader, PERF_FLAG_FD_CLOEXEC);
+    if (sample->descriptors[i] < 0) {
+      close_counters(sample);
+      return (_Bool)0;
+    }
+  }
+  return (_Bool)1;
+}
+#endif
+
+void
+perf_begin(PerfSample* sample)
+{
+  for (unsigned int i = 0U; i < PERF_COUNTER_COUNT; i++)
+    sample->counters[i] = 0U;
+  sample->has_counters = (_Bool)0;
+
+#if defined(__linux__)
+  if (open_counters(sample)) {
+    sample->has_counters = (_Bool)1;
+    ioctl(sample->descriptors[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(sample->descriptors[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  }
+#endif
+
+  sample->ticks = read_ticks();
+}
+
+void
+perf_end(PerfSample* sample)
+{
+  sample->ticks = read_ticks() - sample->ticks;
+
+#if defined(__linux__)
+  if (!sample->has_counters)
+    return;
+
+  ioctl(sample->descriptors[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+  GroupReading reading;
+  if (read(sample->descriptors[0], &reading, sizeof(reading)) != (ssize_t)sizeof(reading) ||
+      reading.count != PERF_COUNTER_COUNT ||
+      reading.time_running == 0U)
+  {
+    sample->has_counters = (_Bool)0;
+  } else {
+    for (unsigned int i = 0U; i < PERF_COUNTER_COUNT; i++) {
+      // group could be multiplexed with other events, extrapolate to the whole time it was enabled
+      unsigned long long value = reading.values[i];
+      if (reading.time_running < reading.time_enabled)
+        value = (unsigned long long)((double)value * (double)reading.time_enabled / (double)reading.time_running);
+      sample->counters[i] = value;
+    }
+  }
+  close_counters(sample);
+#endif
+}
+
+// writes value / tokens with two fractional digits
+static void
+write_per_token(TermiteHandle file, unsigned long long value, unsigned long long tokens)
+{
+  if (tokens == 0U) {
+    write_cstring(file, "-");
+    return;
+  }
+  unsigned long long hundredths = value * 100U / tokens;
+  write_ulong(file, hundredths / 100U);
+  write_cstring(file, hundredths % 100U < 10U ? ".0" : ".");
+  write_ulong(file, hundredths % 100U);
+}
+
+static void
+write_line(TermiteHandle file, const char* name, unsigned long long value, unsigned long long tokens)
+{
+  write_cstring(file, "  ");
+  write_cstring(file, name);
+  write_ulong(file, value);
+  write_cstring(file, " (");
+  write_per_token(file, value, tokens);
+  write_cstring(file, " per token)\n");
+}
+
+void
+perf_report(TermiteHandle file, const PerfSample* sample, unsigned long long tokens)
+{
+  write_cstring(file, "\nperf: ");
+  write_ulong(file, tokens);
+  write_cstring(file, " tokens executed\n");
+
+  if (sample->has_counters) {
+    for (unsigned int i = 0U; i < PERF_COUNTER_COUNT; i++)
+      write_line(file, counter_names[i], sample->counters[i], tokens);
+  } else
+    write_cstring(file, "  hardware counters are unavailable, only time stamp counter is reported\n");
+
+  write_line(file, "tsc ticks     ", sample->ticks, tokens);
+}
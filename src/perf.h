@@ -0,0 +1,36 @@
+#ifndef PERF_H
+#define PERF_H
+
+#include "io.h"
+
+// Hardware counters around interpreter runs
+//   On Linux cycles, instructions, branch misses and cache misses are taken from perf_event_open
+//   Time stamp counter is always sampled, so there's something to report when counters are unavailable
+
+typedef enum {
+  pcCycles,
+  pcInstructions,
+  pcBranchMisses,
+  pcCacheMisses,
+  PERF_COUNTER_COUNT
+} PerfCounters;
+
+typedef struct {
+  _Bool              has_counters;
+  unsigned long long counters[PERF_COUNTER_COUNT];
+  unsigned long long ticks;
+
+  int                descriptors[PERF_COUNTER_COUNT]; // platform specific
+} PerfSample;
+
+void
+perf_begin(PerfSample* sample);
+
+void
+perf_end(PerfSample* sample);
+
+// totals and their values per executed token
+void
+perf_report(TermiteHandle file, const PerfSample* sample, unsigned long long tokens);
+
+#endif
@@ -0,0 +1,549 @@
+/*
+  Termite preprocessor
+
+  Expands macros, resolves labels into exact jump distances and strips comments, output is plain termite
+  Every directive starts with backtick, which is otherwise rare in termite code:
+    ``              - literal backtick
+    `; text         - comment until the end of line
+    `:name          - label, it marks the next token
+    `]name `[name   - push distance to label and jump to it, seeking forward or rewinding back
+    `*]name `*[name - the same, but distance is multiplied by flag on the stack first, so jump is taken only if it's 1
+    `def name ... `end
+                    - macro definition, it's expanded in place of every following `name
+    `name           - macro expansion, if there's no definition of it then body of std/name.tm is used,
+                        which is everything before its "00 %" line
+
+  Labels are local to macro expansion they are defined in, while references could also reach labels of enclosing code
+  Names are made of letters, digits, '-' and '_', so they should be separated from following code by whitespace
+
+  Usage: termite-prep <source path> [std directory] > program.tm
+*/
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "io.h"
+#include "common.h"
+#include "terms.h"
+#include "program.h"
+
+#define NAME_LIMIT        64U
+#define EXPANSION_LIMIT   32U
+#define DEFAULT_STD       "std"
+#define STD_TERMINATOR    "00 %"
+#define READ_CHUNK        4096U
+
+typedef struct {
+  const char*  path;
+  char*        text;
+  unsigned int size;
+} Source;
+
+typedef struct {
+  char          name[NAME_LIMIT];
+  const Source* source;
+  unsigned int  begin;
+  unsigned int  end;
+} Macro;
+
+typedef enum {
+  ikText,   // plain termite code, copied as it is
+  ikLabel,
+  ikJump,
+} ItemKinds;
+
+typedef struct {
+  ItemKinds     kind;
+  const Source* source;
+  unsigned int  offset; // where item starts in source
+  unsigned int  len;    // of text
+  unsigned int  tokens; // termite tokens that item emits
+  unsigned int  scope;
+  unsigned int  ordinal; // of the first token that item emits, or the one label marks
+  char          name[NAME_LIMIT];
+  const char*   jump;    // operators that follow distance push
+} Item;
+
+typedef struct {
+  unsigned int parent;
+} Scope;
+
+static Item*   items;
+static unsigned int item_count, item_capacity;
+static Macro*  macros;
+static unsigned int macro_count, macro_capacity;
+static Scope*  scopes;
+static unsigned int scope_count, scope_capacity;
+
+static const char* std_directory = DEFAULT_STD;
+
+// growable arrays are reallocated by doubling, running out of memory is reported as failure
+static _Bool
+reserve_array(void** array, unsigned int* capacity, unsigned int count, unsigned int item_size)
+{
+  if (count < *capacity)
+    return (_Bool)1;
+  unsigned int new_capacity = *capacity != 0U ? *capacity * 2U : 64U;
+  void* grown = realloc(*array, (size_t)new_capacity * item_size);
+  if (grown == NULL)
+    return (_Bool)0;
+  *array = grown;
+  *capacity = new_capacity;
+  return (_Bool)1;
+}
+
+static unsigned int
+line_of(const Source* source, unsigned int offset)
+{
+  unsigned int line = 1U;
+  for (unsigned int i = 0U; i < offset && i < source->size; i++) {
+    if (source->text[i] == '\n')
+      line++;
+  }
+  return line;
+}
+
+static _Bool
+report(const Source* source, unsigned int offset, const char* message, const char* name)
+{
+  TermiteHandle err = get_stderr();
+  write_cstring(err, "prep: ");
+  if (source != NULL) {
+    write_cstring(err, source->path);
+    write_cstring(err, ":");
+    write_ulong(err, line_of(source, offset));
+    write_cstring(err, ": ");
+  }
+  write_cstring(err, message);
+  if (name != NULL) {
+    write_cstring(err, " '");
+    write_cstring(err, name);
+    write_cstring(err, "'");
+  }
+  write_cstring(err, "\n");
+  return (_Bool)0;
+}
+
+static _Bool
+load_source(const char* path, Source* source)
+{
+  TermiteHandle file;
+  if (!open_file(path, &file, foFileRead))
+    return (_Bool)0;
+
+  source->path = path;
+  source->text = NULL;
+  source->size = 0U;
+  unsigned int capacity = 0U;
+  unsigned int chars_read = 0U;
+  _Bool status = (_Bool)1;
+  do {
+    if (capacity - source->size < READ_CHUNK) {
+      capacity = capacity != 0U ? capacity * 2U : READ_CHUNK * 4U;
+      char* grown = realloc(source->text, capacity);
+      if (grown == NULL) {
+        status = (_Bool)0;
+        break;
+      }
+      source->text = grown;
+    }
+    if (!read_file(file, &source->text[source->size], READ_CHUNK, &chars_read)) {
+      status = (_Bool)0;
+      break;
+    }
+    source->size += chars_read;
+  } while (chars_read != 0U);
+
+  if (!close_file(file) || !status) {
+    free(source->text);
+    return (_Bool)0;
+  }
+  return (_Bool)1;
+}
+
+static _Bool
+is_name_char(char ch)
+{
+  return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9') ||
+         ch == '-' || ch == '_' ? (_Bool)1 : (_Bool)0;
+}
+
+// returns 0 if there's no name at cursor or it's too long
+static _Bool
+read_name(const Source* source, unsigned int* cursor, unsigned int end, char* name)
+{
+  unsigned int len = 0U;
+  while (*cursor != end && is_name_char(source->text[*cursor])) {
+    if (len == NAME_LIMIT - 1U)
+      return (_Bool)0;
+    name[len++] = source->text[(*cursor)++];
+  }
+  name[len] = '\0';
+  return len != 0U ? (_Bool)1 : (_Bool)0;
+}
+
+static Item*
+push_item(ItemKinds kind, const Source* source, unsigned int offset, unsigned int scope)
+{
+  if (!reserve_array((void**)&items, &item_capacity, item_count, sizeof(Item)))
+    return NULL;
+  Item* item = &items[item_count++];
+  *item = (Item){ .kind = kind, .source = source, .offset = offset, .scope = scope };
+  return item;
+}
+
+// plain code between directives, tokens are counted the same way interpreter indexes them
+static _Bool
+push_text(const Source* source, unsigned int begin, unsigned int end, unsigned int scope)
+{
+  if (begin == end)
+    return (_Bool)1;
+
+  unsigned int tokens = 0U;
+  unsigned int hex_run = 0U;
+  for (unsigned int i = begin; i <= end; i++) {
+    char ch = i != end ? source->text[i] : ' ';
+    if (is_hex_char(ch)) {
+      hex_run++;
+      continue;
+    }
+    // distances over malformed hex couldn't be relied on
+    if ((hex_run & 1U) != 0U)
+      return report(source, i, "hex sequence of odd length", NULL);
+    tokens += hex_run / 2U;
+    hex_run = 0U;
+    if (i != end && !is_whitespace_char(ch))
+      tokens++;
+  }
+
+  Item* item = push_item(ikText, source, begin, scope);
+  if (item == NULL)
+    return report(source, begin, "out of memory", NULL);
+  item->len = end - begin;
+  item->tokens = tokens;
+  return (_Bool)1;
+}
+
+static const Macro*
+find_macro(const char* name)
+{
+  for (unsigned int i = macro_count; i--;) {
+    if (compare_cstring(macros[i].name, name))
+      return &macros[i];
+  }
+  return NULL;
+}
+
+static Macro*
+add_macro(const char* name, const Source* source, unsigned int begin, unsigned int end)
+{
+  if (!reserve_array((void**)&macros, &macro_capacity, macro_count, sizeof(Macro)))
+    return NULL;
+  Macro* macro = &macros[macro_count++];
+  memcpy(macro->name, name, count_cstring(name) + 1U);
+  macro->source = source;
+  macro->begin = begin;
+  macro->end = end;
+  return macro;
+}
+
+// std programs are loaded on first use, their description that follows terminator is left out
+static const Macro*
+load_std_macro(const char* name)
+{
+  char path[FILEPATH_LIMIT];
+  unsigned int dir_len = count_cstring(std_directory);
+  unsigned int name_len = count_cstring(name);
+  if (dir_len + name_len + sizeof("/.tm") > FILEPATH_LIMIT)
+    return NULL;
+  memcpy(path, std_directory, dir_len);
+  path[dir_len] = '/';
+  memcpy(&path[dir_len + 1U], name, name_len);
+  memcpy(&path[dir_len + 1U + name_len], ".tm", sizeof(".tm"));
+
+  Source* source = malloc(sizeof(Source));
+  char* stored_path = malloc(count_cstring(path) + 1U);
+  if (source == NULL || stored_path == NULL) {
+    free(source);
+    free(stored_path);
+    return NULL;
+  }
+  memcpy(stored_path, path, count_cstring(path) + 1U);
+  if (!load_source(stored_path, source)) {
+    free(source);
+    free(stored_path);
+    return NULL;
+  }
+
+  unsigned int end = source->size;
+  for (unsigned int line = 0U; line < source->size;) {
+    unsigned int start = line;
+    while (start < source->size && (source->text[start] == ' ' || source->text[start] == '\t'))
+      start++;
+    if (source->size - start >= sizeof(STD_TERMINATOR) - 1U &&
+        memcmp(&source->text[start], STD_TERMINATOR, sizeof(STD_TERMINATOR) - 1U) == 0)
+    {
+      end = line;
+      break;
+    }
+    while (line < source->size && source->text[line] != '\n')
+      line++;
+    line++;
+  }
+  return add_macro(name, source, 0U, end);
+}
+
+static _Bool
+new_scope(unsigned int parent, unsigned int* scope)
+{
+  if (!reserve_array((void**)&scopes, &scope_capacity, scope_count, sizeof(Scope)))
+    return (_Bool)0;
+  scopes[scope_count].parent = parent;
+  *scope = scope_count++;
+  return (_Bool)1;
+}
+
+static _Bool
+expand(const Source* source, unsigned int begin, unsigned int end, unsigned int scope, unsigned int depth);
+
+static _Bool
+expand_macro(const Source* source, unsigned int offset, const char* name, unsigned int scope, unsigned int depth)
+{
+  const Macro* macro = find_macro(name);
+  if (macro == NULL)
+    macro = load_std_macro(name);
+  if (macro == NULL)
+    return report(source, offset, "unknown macro", name);
+  if (depth == EXPANSION_LIMIT)
+    return report(source, offset, "macros are nested too deep at", name);
+
+  unsigned int macro_scope;
+  if (!new_scope(scope, &macro_scope))
+    return report(source, offset, "out of memory", NULL);
+  return expand(macro->source, macro->begin, macro->end, macro_scope, depth + 1U);
+}
+
+// turns source range into items, directives are handled as they're met
+static _Bool
+expand(const Source* source, unsigned int begin, unsigned int end, unsigned int scope, unsigned int depth)
+{
+  const char* text = source->text;
+  unsigned int cursor = begin;
+  unsigned int text_begin = begin;
+  char name[NAME_LIMIT];
+
+  while (cursor != end) {
+    if (text[cursor] != '`') {
+      cursor++;
+      continue;
+    }
+    if (!push_text(source, text_begin, cursor, scope))
+      return (_Bool)0;
+    unsigned int directive = cursor++;
+
+    if (cursor != end && text[cursor] == '`') {
+      // literal backtick is plain code of its own
+      if (!push_text(source, cursor, cursor + 1U, scope))
+        return (_Bool)0;
+      cursor++;
+
+    } else if (cursor != end && text[cursor] == ';') {
+      while (cursor != end && text[cursor] != '\n')
+        cursor++;
+
+    } else if (cursor != end && text[cursor] == ':') {
+      cursor++;
+      if (!read_name(source, &cursor, end, name))
+        return report(source, directive, "label without name", NULL);
+      Item* item = push_item(ikLabel, source, directive, scope);
+      if (item == NULL)
+        return report(source, directive, "out of memory", NULL);
+      memcpy(item->name, name, sizeof(name));
+
+    } else if (cursor != end && (text[cursor] == '[' || text[cursor] == ']' || text[cursor] == '*')) {
+      const char* jump;
+      if (text[cursor] == '*') {
+        cursor++;
+        if (cursor == end || (text[cursor] != '[' && text[cursor] != ']'))
+          return report(source, directive, "conditional jump should be followed by '[' or ']'", NULL);
+        jump = text[cursor] == '[' ? "*[" : "*]";
+      } else
+        jump = text[cursor] == '[' ? "[" : "]";
+      cursor++;
+      if (!read_name(source, &cursor, end, name))
+        return report(source, directive, "jump without label", NULL);
+      Item* item = push_item(ikJump, source, directive, scope);
+      if (item == NULL)
+        return report(source, directive, "out of memory", NULL);
+      memcpy(item->name, name, sizeof(name));
+      item->jump = jump;
+      item->tokens = 1U + count_cstring(jump);
+
+    } else if (read_name(source, &cursor, end, name)) {
+      if (compare_cstring(name, "def")) {
+        while (cursor != end && is_whitespace_char(text[cursor]))
+          cursor++;
+        if (!read_name(source, &cursor, end, name))
+          return report(source, directive, "macro definition without name", NULL);
+
+        // body lasts until `end, definitions couldn't be nested
+        unsigned int body = cursor;
+        unsigned int body_end = cursor;
+        _Bool is_closed = (_Bool)0;
+        while (cursor != end) {
+          if (text[cursor] == '`' && end - cursor >= 4U && memcmp(&text[cursor + 1U], "end", 3U) == 0 &&
+              (end - cursor == 4U || !is_name_char(text[cursor + 4U])))
+          {
+            body_end = cursor;
+            cursor += 4U;
+            is_closed = (_Bool)1;
+            break;
+          }
+          cursor++;
+        }
+        if (!is_closed)
+          return report(source, directive, "unterminated definition of", name);
+        if (add_macro(name, source, body, body_end) == NULL)
+          return report(source, directive, "out of memory", NULL);
+
+      } else if (compare_cstring(name, "end")) {
+        return report(source, directive, "`end without definition", NULL);
+
+      } else if (!expand_macro(source, directive, name, scope, depth))
+        return (_Bool)0;
+
+    } else
+      return report(source, directive, "unknown directive", NULL);
+
+    text_begin = cursor;
+  }
+  return push_text(source, text_begin, end, scope);
+}
+
+// label that is visible from scope, innermost one wins
+static const Item*
+find_label(const char* name, unsigned int scope)
+{
+  while (1) {
+    for (unsigned int i = 0U; i < item_count; i++) {
+      if (items[i].kind == ikLabel && items[i].scope == scope && compare_cstring(items[i].name, name))
+        return &items[i];
+    }
+    if (scope == 0U)
+      return NULL;
+    scope = scopes[scope].parent;
+  }
+}
+
+static _Bool
+resolve_labels(void)
+{
+  unsigned int ordinal = 0U;
+  for (unsigned int i = 0U; i < item_count; i++) {
+    items[i].ordinal = ordinal;
+    ordinal += items[i].tokens;
+  }
+  unsigned int token_count = ordinal;
+
+  for (unsigned int i = 0U; i < item_count; i++) {
+    if (items[i].kind != ikLabel)
+      continue;
+    if (items[i].ordinal == token_count)
+      return report(items[i].source, items[i].offset, "there's nothing after label", items[i].name);
+    for (unsigned int j = i + 1U; j < item_count; j++) {
+      if (items[j].kind == ikLabel && items[j].scope == items[i].scope && compare_cstring(items[j].name, items[i].name))
+        return report(items[j].source, items[j].offset, "duplicate label", items[j].name);
+    }
+  }
+
+  for (unsigned int i = 0U; i < item_count; i++) {
+    Item* item = &items[i];
+    if (item->kind != ikJump)
+      continue;
+    const Item* label = find_label(item->name, item->scope);
+    if (label == NULL)
+      return report(item->source, item->offset, "unknown label", item->name);
+
+    // jump token is the last one of reference
+    unsigned int jump = item->ordinal + item->tokens - 1U;
+    unsigned int target = label->ordinal;
+    unsigned int distance;
+    if (item->jump[count_cstring(item->jump) - 1U] == ']') {
+      if (target <= jump)
+        return report(item->source, item->offset, "label isn't after seek to it", item->name);
+      distance = target - jump - 1U;
+    } else {
+      if (target >= jump)
+        return report(item->source, item->offset, "label isn't before rewind to it", item->name);
+      distance = jump - target;
+    }
+    if (distance > 0xFFU)
+      return report(item->source, item->offset, "label is further than 255 tokens", item->name);
+    item->ordinal = distance; // no longer needed, distance is all that is left to emit
+  }
+  return (_Bool)1;
+}
+
+static _Bool
+emit(TermiteHandle out, unsigned int* size)
+{
+  static const char digits[] = "0123456789ABCDEF";
+  _Bool status = (_Bool)1;
+  *size = 0U;
+
+  for (unsigned int i = 0U; i < item_count && status; i++) {
+    const Item* item = &items[i];
+    switch (item->kind) {
+      case ikText: {
+        status = write_file(out, &item->source->text[item->offset], item->len);
+        *size += item->len;
+        break;
+      }
+      case ikJump: {
+        char push[2] = { digits[item->ordinal >> 4U], digits[item->ordinal & 0xFU] };
+        status = write_file(out, push, 2U) && write_file(out, item->jump, count_cstring(item->jump));
+        *size += 2U + count_cstring(item->jump);
+        break;
+      }
+      case ikLabel: break;
+    }
+  }
+  return status;
+}
+
+int
+term_main(int argc, const char** argv)
+{
+  if (argc < 2)
+    return OC_FILE_ERROR; // no file given
+  if (argc > 2)
+    std_directory = argv[2];
+
+  init_io();
+
+  Source source;
+  unsigned int root_scope;
+  int return_code = OC_OK;
+
+  if (!load_source(argv[1], &source)) {
+    report(NULL, 0U, "can't read", argv[1]);
+    return_code = OC_FILE_ERROR;
+  } else if (!new_scope(0U, &root_scope) ||
+             !expand(&source, 0U, source.size, root_scope, 0U) ||
+             !resolve_labels())
+  {
+    return_code = OC_INVALID_INPUT;
+  } else {
+    unsigned int size;
+    if (!emit(get_stdout(), &size))
+      return_code = OC_FILE_ERROR;
+    else if (size > INPUT_LIMIT) {
+      report(NULL, 0U, "output is too big to be run by worker", NULL);
+      return_code = OC_INPUT_OVERFLOW;
+    }
+  }
+
+  deinit_io();
+  return return_code;
+}
@@ -0,0 +1,213 @@
+#if defined(__linux__)
+  #define _GNU_SOURCE
+  #include <signal.h>
+  #include <sys/time.h>
+#endif
+
+#include "io.h"
+#include "common.h"
+#include "terms.h"
+#include "program.h"
+#include "profile.h"
+
+volatile unsigned int profile_cursor = PROFILE_OUTSIDE;
+
+// written by signal handler only, read once timer is stopped
+static volatile unsigned int hits[PROFILE_OUTSIDE + 1U];
+static volatile unsigned int sample_count;
+
+// too big for stack, indexed by token ordinals and line numbers
+static unsigned int token_hits[INPUT_LIMIT];
+static unsigned int line_hits[INPUT_LIMIT];
+static unsigned int line_starts[INPUT_LIMIT];
+
+#if defined(__linux__)
+static void
+take_sample(int signal)
+{
+  (void)signal;
+  unsigned int cursor = profile_cursor;
+  hits[cursor < PROFILE_OUTSIDE ? cursor : PROFILE_OUTSIDE]++;
+  sample_count++;
+}
+#endif
+
+_Bool
+profile_begin(void)
+{
+  for (unsigned int i = 0U; i <= PROFILE_OUTSIDE; i++)
+    hits[i] = 0U;
+  sample_count = 0U;
+  profile_cursor = PROFILE_OUTSIDE;
+
+#if defined(__linux__)
+  // interrupted reads and writes are restarted, so io doesn't notice the timer
+  struct sigaction action = { .sa_handler = take_sample, .sa_flags = SA_RESTART };
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGPROF, &action, NULL) != 0)
+    return (_Bool)0;
+
+  struct itimerval timer = {
+    .it_interval = { .tv_sec = 0, .tv_usec = PROFILE_INTERVAL_US },
+    .it_value = { .tv_sec = 0, .tv_usec = PROFILE_INTERVAL_US },
+  };
+  return setitimer(ITIMER_PROF, &timer, NULL) == 0 ? (_Bool)1 : (_Bool)0;
+#else
+  return (_Bool)0;
+#endif
+}
+
+void
+profile_end(void)
+{
+  profile_cursor = PROFILE_OUTSIDE;
+#if defined(__linux__)
+  struct itimerval timer = {0};
+  setitimer(ITIMER_PROF, &timer, NULL);
+  // signal that is already pending shouldn't terminate the process, which is default for SIGPROF
+  signal(SIGPROF, SIG_IGN);
+#endif
+}
+
+// writes part of total in percents with two fractional digits
+static void
+write_share(TermiteHandle file, unsigned int part, unsigned int total)
+{
+  unsigned long long hundredths = (unsigned long long)part * 10000U / total;
+  if (hundredths < 1000U)
+    write_cstring(file, " ");
+  write_ulong(file, hundredths / 100U);
+  write_cstring(file, hundredths % 100U < 10U ? ".0" : ".");
+  write_ulong(file, hundredths % 100U);
+  write_cstring(file, "%  ");
+}
+
+static void
+write_padded_uint(TermiteHandle file, unsigned int value, unsigned int width)
+{
+  unsigned int digits = 1U;
+  for (unsigned int rest = value; rest >= 10U; rest /= 10U)
+    digits++;
+  for (; digits < width; digits++)
+    write_cstring(file, " ");
+  write_ulong(file, value);
+}
+
+// returns count when every entry is already taken, taken ones are marked by zeroing their hits
+static unsigned int
+take_hottest(unsigned int* entries, unsigned int count)
+{
+  unsigned int hottest = count;
+  for (unsigned int i = 0U; i < count; i++) {
+    if (entries[i] != 0U && (hottest == count || entries[i] > entries[hottest]))
+      hottest = i;
+  }
+  return hottest;
+}
+
+// line that offset is on, counted from 0, line_starts has to be filled for the first line_count lines
+static unsigned int
+find_line(unsigned int offset, unsigned int line_count)
+{
+  unsigned int low = 0U;
+  unsigned int high = line_count;
+  while (high - low > 1U) {
+    unsigned int middle = low + (high - low) / 2U;
+    if (line_starts[middle] <= offset)
+      low = middle;
+    else
+      high = middle;
+  }
+  return low;
+}
+
+void
+profile_report(TermiteHandle file, const Program* program)
+{
+  unsigned int total = sample_count;
+  write_cstring(file, "\nprofile: ");
+  write_ulong(file, total);
+  write_cstring(file, " samples, every ");
+  write_ulong(file, PROFILE_INTERVAL_US);
+  write_cstring(file, "us of cpu time at most\n");
+  if (total == 0U) {
+    write_cstring(file, "  there are no samples, run is too short or timer is unavailable\n");
+    return;
+  }
+  if (hits[PROFILE_OUTSIDE] != 0U) {
+    write_cstring(file, "  outside of interpreter loop ");
+    write_share(file, hits[PROFILE_OUTSIDE], total);
+    write_cstring(file, "\n");
+  }
+
+  unsigned int line_count = 1U;
+  line_starts[0] = 0U;
+  for (unsigned int i = 0U; i < program->size; i++) {
+    if (program->source[i] == '\n' && i + 1U < program->size)
+      line_starts[line_count++] = i + 1U;
+  }
+
+  // whitespace before token is attributed to it, as it's skipped on the way to it
+  for (unsigned int i = 0U; i < program->token_count; i++)
+    token_hits[i] = 0U;
+  for (unsigned int i = 0U; i < line_count; i++)
+    line_hits[i] = 0U;
+  for (unsigned int offset = 0U; offset < program->size; offset++) {
+    if (hits[offset] == 0U)
+      continue;
+    unsigned int ordinal = program->token_ordinals[offset];
+    if (ordinal < program->token_count)
+      token_hits[ordinal] += hits[offset];
+    line_hits[find_line(offset, line_count)] += hits[offset];
+  }
+
+  write_cstring(file, "  hottest tokens:\n     samples    share    line:col   token  op\n");
+  for (unsigned int n = 0U; n < PROFILE_TOP; n++) {
+    unsigned int token = take_hottest(token_hits, program->token_count);
+    if (token == program->token_count)
+      break;
+    unsigned int offset = program->token_offsets[token];
+    unsigned int line = find_line(offset, line_count);
+
+    write_padded_uint(file, token_hits[token], 12U);
+    write_cstring(file, "  ");
+    write_share(file, token_hits[token], total);
+    write_padded_uint(file, line + 1U, 6U);
+    write_cstring(file, ":");
+    // column is left aligned, so it stays next to line number
+    unsigned int column = offset - line_starts[line] + 1U;
+    write_ulong(file, column);
+    for (unsigned int width = column; width < 10000U; width *= 10U)
+      write_cstring(file, " ");
+    // tokens are counted from 1, the same as in trace output
+    write_padded_uint(file, token + 1U, 6U);
+    write_cstring(file, "  ");
+    write_file(file, &program->source[offset], token_end(program, token) - offset);
+    write_cstring(file, "\n");
+    token_hits[token] = 0U;
+  }
+
+  write_cstring(file, "  hottest lines:\n     samples    share    line\n");
+  for (unsigned int n = 0U; n < PROFILE_TOP; n++) {
+    unsigned int line = take_hottest(line_hits, line_count);
+    if (line == line_count)
+      break;
+
+    write_padded_uint(file, line_hits[line], 12U);
+    write_cstring(file, "  ");
+    write_share(file, line_hits[line], total);
+    write_padded_uint(file, line + 1U, 6U);
+    write_cstring(file, "  ");
+
+    // long lines are cut, line breaks aren't written
+    unsigned int end = line_starts[line];
+    while (end < program->size && end - line_starts[line] < 64U &&
+           program->source[end] != '\n' && program->source[end] != '\r')
+    {
+      end++;
+    }
+    write_file(file, &program->source[line_starts[line]], end - line_starts[line]);
+    write_cstring(file, "\n");
+    line_hits[line] = 0U;
+  }
+}
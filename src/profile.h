@@ -0,0 +1,31 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "io.h"
+#include "program.h"
+
+// Sampling profiler of interpreter runs
+//   Interpreter publishes offset of every token it's about to execute in profile_cursor while sampling is on,
+//   SIGPROF handler counts hits of that offset every PROFILE_INTERVAL_US of CPU time the process spends
+//   Counters are indexed by offset, so handler never allocates or locks, and memory doesn't grow with run length
+//   At the end hits are resolved to tokens and lines of the source, hottest ones are reported
+//   Only Linux has the timer, elsewhere report says that there are no samples
+
+#define PROFILE_INTERVAL_US 1000U
+#define PROFILE_OUTSIDE     INPUT_LIMIT // cursor value outside of interpreter loop
+#define PROFILE_TOP         16U         // tokens and lines in the report
+
+extern volatile unsigned int profile_cursor;
+
+// returns 0 if timer couldn't be set, run goes on without samples then
+_Bool
+profile_begin(void);
+
+void
+profile_end(void);
+
+// ranked hot spots of given program, which is the one that ran between begin and end
+void
+profile_report(TermiteHandle file, const Program* program);
+
+#endif
@@ -0,0 +1,128 @@
+#include "io.h"
+#include "common.h"
+#include "terms.h"
+#include "program.h"
+#include "intrinsics.h"
+
+int
+load_program(TermiteHandle file, Program* program)
+{
+  program->is_cached = (_Bool)0;
+
+  if (!read_file(file, program->source, INPUT_LIMIT, &program->size))
+    return OC_FILE_ERROR;
+
+  if (program->size == INPUT_LIMIT + 1U)
+    return OC_INPUT_OVERFLOW;
+
+  program->hash = hash_byte_array(HASH_SEED, (const unsigned char*)program->source, program->size);
+  return OC_OK;
+}
+
+int
+load_program_bytes(const char* source, unsigned int size, Program* program)
+{
+  program->is_cached = (_Bool)0;
+
+  if (size > INPUT_LIMIT)
+    return OC_INPUT_OVERFLOW;
+
+  for (unsigned int i = 0U; i < size; i++)
+    program->source[i] = source[i];
+  program->size = size;
+
+  program->hash = hash_byte_array(HASH_SEED, (const unsigned char*)program->source, program->size);
+  return OC_OK;
+}
+
+// constant push right before jump always makes it jump by the same distance
+static void
+resolve_static_jumps(Program* program)
+{
+  for (unsigned int i = 0U; i < program->size; i++)
+    program->targets_storage[i] = NO_STATIC_JUMP;
+  program->jump_targets = program->targets_storage;
+
+  if (!program->well_formed)
+    return;
+
+  for (unsigned int ordinal = 0U; ordinal + 1U < program->token_count; ordinal++) {
+    if (is_operator_char(token_char(program, ordinal)))
+      continue;
+
+    unsigned int jump = ordinal + 1U;
+    unsigned int distance = token_value(program, ordinal);
+    unsigned int target = NO_STATIC_JUMP;
+
+    switch (token_char(program, jump)) {
+      case '[': {
+        if (distance == 0U)
+          target = token_end(program, jump) | STATIC_REWIND;
+        else if (distance <= jump)
+          target = program->token_offsets[jump - distance] | STATIC_REWIND;
+        break;
+      }
+      case ']': {
+        if (jump + distance < program->token_count)
+          target = token_end(program, jump + distance);
+        break;
+      }
+      default: continue;
+    }
+    program->targets_storage[program->token_offsets[ordinal]] = target;
+  }
+}
+
+void
+index_program(Program* program)
+{
+  unsigned int ordinal = 0U;
+  unsigned int hex_run = 0U;
+  _Bool well_formed = (_Bool)1;
+
+  for (unsigned int i = 0U; i < program->size; i++) {
+    char ch = program->source[i];
+    program->ordinals_storage[i] = ordinal;
+
+    if (is_hex_char(ch)) {
+      // hex tokens are formed by pairs within continuous sequences of hex chars
+      if ((hex_run & 1U) == 0U)
+        program->offsets_storage[ordinal] = i;
+      else
+        ordinal++;
+      hex_run++;
+      continue;
+    }
+
+    // lone hex char is counted as separate token, index is not used for such programs anyway
+    if ((hex_run & 1U) != 0U) {
+      well_formed = (_Bool)0;
+      ordinal++;
+    }
+    hex_run = 0U;
+
+    if (!is_whitespace_char(ch))
+      program->offsets_storage[ordinal++] = i;
+  }
+  if ((hex_run & 1U) != 0U) {
+    well_formed = (_Bool)0;
+    ordinal++;
+  }
+
+  program->token_count = ordinal;
+  program->well_formed = well_formed;
+  program->token_offsets = program->offsets_storage;
+  program->token_ordinals = program->ordinals_storage;
+
+  resolve_static_jumps(program);
+  find_intrinsic_sites(program);
+}
+
+void
+unload_program(Program* program)
+{
+  if (program->is_cached) {
+    unmap_file(&program->cache);
+    program->is_cached = (_Bool)0;
+  }
+}
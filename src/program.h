@@ -0,0 +1,132 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include "io.h"
+#include "terms.h"
+
+// Load-time artifacts of termite program, everything that doesn't depend on its input
+// Index arrays either point into program's own storage or into mapped cache file
+
+#define INTRINSIC_SITE_LIMIT 64U
+
+// kinds of byte map of pass-through loop
+#define PASS_COPY   0U // bytes are written as they are read
+#define PASS_AFFINE 1U // scale * byte + shift
+#define PASS_TABLE  2U // anything else is looked up
+
+// body of std routine that has native implementation, see intrinsics.h
+typedef struct {
+  unsigned int  offset;     // source offset of its first token
+  unsigned int  end;        // source offset just after its last token
+  unsigned int  intrinsic;  // index in registry
+  unsigned int  map_tokens; // tokens of byte map in pass-through loop, 0 for other routines
+  unsigned char map_kind;
+  unsigned char map_scale;
+  unsigned char map_shift;
+  unsigned char map[256];   // byte that pass-through loop writes for every byte it reads
+} IntrinsicSite;
+
+typedef struct {
+  char          source[INPUT_LIMIT + 1U];
+  unsigned int  size;
+  unsigned long long hash;
+
+  // 0 if source has hex sequences of odd length
+  // jumps over such sequences could fail differently depending on direction, so they should be resolved by scanning
+  _Bool         well_formed;
+  unsigned int  token_count;
+  const unsigned int* token_offsets;  // token ordinal -> source offset of its first char
+  const unsigned int* token_ordinals; // source offset -> ordinal of token that covers it
+
+  // source offset of constant push -> where execution continues if it's followed by jump
+  // NO_STATIC_JUMP when it isn't, or when such jump fails, so that failure is left for the jump itself
+  const unsigned int* jump_targets;
+
+  // ordered by offset, cached entries have them copied from their section
+  unsigned int  intrinsic_site_count;
+  IntrinsicSite intrinsic_sites[INTRINSIC_SITE_LIMIT];
+
+  TermiteMapping cache;
+  _Bool          is_cached;
+
+  unsigned int  offsets_storage[INPUT_LIMIT];
+  unsigned int  ordinals_storage[INPUT_LIMIT];
+  unsigned int  targets_storage[INPUT_LIMIT];
+} Program;
+
+#define NO_STATIC_JUMP  0xFFFFFFFFU
+#define STATIC_REWIND   0x80000000U // set for targets of '[', rewinds are where step limit is checked
+
+// returns OC_OK or termite exit code on failure
+int
+load_program(TermiteHandle file, Program* program);
+
+// same as load_program, but source is copied from memory
+int
+load_program_bytes(const char* source, unsigned int size, Program* program);
+
+// builds token index from source and resolves jumps with constant distances
+void
+index_program(Program* program);
+
+// releases cache mapping if there's any
+void
+unload_program(Program* program);
+
+static inline _Bool
+is_hex_char(char ch)
+{
+ return (ch >= 'A' && ch <= 'F') || (ch >= '0' && ch <= '9') ? (_Bool)1 : (_Bool)0;
+}
+
+static inline _Bool
+is_whitespace_char(char ch)
+{
+  return ch == ' ' || ch == '\n' || ch == '\r' || ch == '\t' ? (_Bool)1 : (_Bool)0;
+}
+
+static inline _Bool
+is_operator_char(char ch)
+{
+  switch (ch) {
+    case '%': case '.': case '@': case '^': case '#': case '$': case '~':
+    case '=': case '?': case '+': case '-': case '*': case '/':
+    case '<': case '>': case '[': case ']':
+      return (_Bool)1;
+    default:
+      return (_Bool)0;
+  }
+}
+
+static inline unsigned char
+hex_value(char ch)
+{
+  return ch > '9' ? (unsigned char)(ch - 'A' + 10) : (unsigned char)(ch - '0');
+}
+
+// first char of token
+static inline char
+token_char(const Program* program, unsigned int ordinal)
+{
+  return program->source[program->token_offsets[ordinal]];
+}
+
+// value that is pushed by data token
+static inline unsigned char
+token_value(const Program* program, unsigned int ordinal)
+{
+  const char* token = &program->source[program->token_offsets[ordinal]];
+  if (is_hex_char(token[0]))
+    return (unsigned char)(hex_value(token[0]) << 4U | hex_value(token[1]));
+  return (unsigned char)token[0];
+}
+
+// source offset just after token
+static inline unsigned int
+token_end(const Program* program, unsigned int ordinal)
+{
+  unsigned int offset = program->token_offsets[ordinal];
+  return is_hex_char(program->source[offset]) ? offset + 2U : offset + 1U;
+}
+
+#endif
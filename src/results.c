@@ -0,0 +1,242 @@
+#include <stddef.h>
+
+#include "io.h"
+#include "common.h"
+#include "terms.h"
+#include "results.h"
+
+// todo: entries that are left out of index by failed save are never evicted
+
+#define RESULTS_EXTENSION ".tmr"
+#define RESULTS_INDEX     CACHE_DIRECTORY "/results.idx"
+#define RESULTS_LOCK      CACHE_DIRECTORY "/results.lock"
+
+// "<CACHE_DIRECTORY>/<key>.tmr"
+#define RESULTS_PATH_SIZE (sizeof(CACHE_DIRECTORY) + 16U + sizeof(RESULTS_EXTENSION))
+
+typedef struct {
+  unsigned long long key;
+  unsigned int       size;     // of whole entry file
+  unsigned int       last_use; // value of index clock at the time
+} ResultsIndexEntry;
+
+typedef struct {
+  unsigned int      magic;
+  unsigned int      version;
+  unsigned int      clock;
+  unsigned int      count;
+  ResultsIndexEntry entries[RESULTS_ENTRY_LIMIT];
+} ResultsIndex;
+
+// too big for stack
+static ResultsIndex results_index;
+
+static void
+form_entry_path(unsigned long long key, char* path)
+{
+  unsigned int len = 0U;
+  for (const char* ch = CACHE_DIRECTORY; *ch != '\0'; ch++)
+    path[len++] = *ch;
+  path[len++] = '/';
+  format_hash(key, &path[len]);
+  len += 16U;
+  for (const char* ch = RESULTS_EXTENSION; *ch != '\0'; ch++)
+    path[len++] = *ch;
+  path[len] = '\0';
+}
+
+// reads up to limit, returns 0 on error
+static _Bool
+read_whole(TermiteHandle file, unsigned char* buffer, unsigned int limit, unsigned int* size)
+{
+  *size = 0U;
+  while (*size != limit) {
+    unsigned int chars_read;
+    if (!read_file(file, (char*)&buffer[*size], limit - *size, &chars_read))
+      return (_Bool)0;
+    if (chars_read == 0U)
+      break;
+    *size += chars_read;
+  }
+  return (_Bool)1;
+}
+
+// index that is missing or invalid is started anew
+static void
+load_index(void)
+{
+  TermiteHandle file;
+  unsigned int size = 0U;
+  if (open_file(RESULTS_INDEX, &file, foFileRead)) {
+    if (!read_whole(file, (unsigned char*)&results_index, sizeof(ResultsIndex), &size))
+      size = 0U;
+    close_file(file);
+  }
+
+  if (size != sizeof(ResultsIndex) ||
+      results_index.magic != RESULTS_MAGIC ||
+      results_index.version != RESULTS_VERSION ||
+      results_index.count > RESULTS_ENTRY_LIMIT)
+  {
+    results_index.magic = RESULTS_MAGIC;
+    results_index.version = RESULTS_VERSION;
+    results_index.clock = 0U;
+    results_index.count = 0U;
+  }
+}
+
+static _Bool
+save_index(void)
+{
+  TermiteHandle file;
+  if (!open_file(RESULTS_INDEX, &file, foFileCreate))
+    return (_Bool)0;
+  _Bool status = write_file(file, (const char*)&results_index, sizeof(ResultsIndex));
+  if (!close_file(file) || !status) {
+    delete_file(RESULTS_INDEX);
+    return (_Bool)0;
+  }
+  return (_Bool)1;
+}
+
+// index is only changed under the lock, so that concurrent workers don't lose each other's updates
+static _Bool
+lock_index(TermiteHandle* lock)
+{
+  if (!open_file(RESULTS_LOCK, lock, foFileCreate))
+    return (_Bool)0;
+  if (!lock_file(*lock)) {
+    close_file(*lock);
+    return (_Bool)0;
+  }
+  return (_Bool)1;
+}
+
+// returns RESULTS_ENTRY_LIMIT if key isn't indexed
+static unsigned int
+find_entry(unsigned long long key)
+{
+  for (unsigned int i = 0U; i < results_index.count; i++) {
+    if (results_index.entries[i].key == key)
+      return i;
+  }
+  return RESULTS_ENTRY_LIMIT;
+}
+
+// order of entries doesn't matter, so the last one takes place of removed one
+static void
+evict_entry(unsigned int entry)
+{
+  char path[RESULTS_PATH_SIZE];
+  form_entry_path(results_index.entries[entry].key, path);
+  delete_file(path);
+  results_index.entries[entry] = results_index.entries[--results_index.count];
+}
+
+_Bool
+results_load(unsigned long long key, unsigned char* output, unsigned int capacity, unsigned int* size, int* exit_code)
+{
+  char path[RESULTS_PATH_SIZE];
+  form_entry_path(key, path);
+
+  TermiteHandle file;
+  if (!open_file(path, &file, foFileRead))
+    return (_Bool)0;
+
+  ResultsHeader header;
+  unsigned int header_size;
+  _Bool is_valid =
+    read_whole(file, (unsigned char*)&header, sizeof(ResultsHeader), &header_size) &&
+    header_size == sizeof(ResultsHeader) &&
+    header.magic == RESULTS_MAGIC &&
+    header.version == RESULTS_VERSION &&
+    header.key == key &&
+    header.output_size <= capacity &&
+    read_whole(file, output, header.output_size, size) &&
+    *size == header.output_size &&
+    hash_byte_array(HASH_SEED, output, *size) == header.output_hash;
+  close_file(file);
+  if (!is_valid)
+    return (_Bool)0;
+  *exit_code = header.exit_code;
+
+  // failing to record use only makes entry older than it is
+  TermiteHandle lock;
+  if (!lock_index(&lock))
+    return (_Bool)1;
+  load_index();
+  unsigned int entry = find_entry(key);
+  if (entry != RESULTS_ENTRY_LIMIT && results_index.entries[entry].last_use != results_index.clock) {
+    results_index.entries[entry].last_use = ++results_index.clock;
+    save_index();
+  }
+  close_file(lock);
+  return (_Bool)1;
+}
+
+_Bool
+results_store(unsigned long long key, int exit_code, const unsigned char* output, unsigned int size)
+{
+  if (size > RESULTS_BUDGET - sizeof(ResultsHeader))
+    return (_Bool)0;
+  TermiteHandle lock;
+  if (!create_directory(CACHE_DIRECTORY) || !lock_index(&lock))
+    return (_Bool)0;
+
+  load_index();
+  unsigned int entry = find_entry(key);
+  if (entry != RESULTS_ENTRY_LIMIT)
+    evict_entry(entry);
+
+  unsigned int entry_size = size + sizeof(ResultsHeader);
+  unsigned long long total = entry_size;
+  for (unsigned int i = 0U; i < results_index.count; i++)
+    total += results_index.entries[i].size;
+
+  // least recently used go first, until new entry fits both limits
+  while (results_index.count == RESULTS_ENTRY_LIMIT || total > RESULTS_BUDGET) {
+    unsigned int oldest = 0U;
+    for (unsigned int i = 1U; i < results_index.count; i++) {
+      if (results_index.entries[i].last_use < results_index.entries[oldest].last_use)
+        oldest = i;
+    }
+    total -= results_index.entries[oldest].size;
+    evict_entry(oldest);
+  }
+
+  char path[RESULTS_PATH_SIZE];
+  form_entry_path(key, path);
+
+  ResultsHeader header = {
+    .magic = RESULTS_MAGIC,
+    .version = RESULTS_VERSION,
+    .key = key,
+    .exit_code = exit_code,
+    .output_size = size,
+    .output_hash = hash_byte_array(HASH_SEED, output, size),
+  };
+
+  TermiteHandle file;
+  _Bool status = open_file(path, &file, foFileCreate);
+  if (status) {
+    status = write_file(file, (const char*)&header, sizeof(ResultsHeader));
+    if (status && size != 0U)
+      status = write_file(file, (const char*)output, size);
+    status &= close_file(file);
+  }
+
+  if (status) {
+    results_index.entries[results_index.count++] = (ResultsIndexEntry){
+      .key = key,
+      .size = entry_size,
+      .last_use = ++results_index.clock,
+    };
+  } else
+    // never leave partially written entry behind
+    delete_file(path);
+
+  // evictions are saved either way
+  status &= save_index();
+  close_file(lock);
+  return status;
+}
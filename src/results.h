@@ -0,0 +1,36 @@
+#ifndef RESULTS_H
+#define RESULTS_H
+
+#include "io.h"
+
+// On-disk cache of run results, termite programs are deterministic functions of source and stdin
+//   Entries are keyed by hash of source, stdin and switches that change output, caller forms the key
+//   Every entry keeps exit code and whole stdout of the run, and lives in CACHE_DIRECTORY next to program entries
+//   Sizes and order of use are kept in the index, entries that were used least recently are evicted over RESULTS_BUDGET
+//   Files are read rather than mapped, as other worker could rewrite them at the same time,
+//   entry that is torn that way fails its hash and is treated as missing
+
+#define RESULTS_MAGIC       0x524D5254U // "TRMR"
+#define RESULTS_VERSION     1U
+#define RESULTS_BUDGET      (64U << 20U)
+#define RESULTS_ENTRY_LIMIT 1024U
+
+typedef struct {
+  unsigned int       magic;
+  unsigned int       version;
+  unsigned long long key;
+  int                exit_code;
+  unsigned int       output_size;
+  unsigned long long output_hash;
+} ResultsHeader;
+
+// reads stored output into given buffer
+// returns 0 if there's no valid entry for the key, or if its output doesn't fit
+_Bool
+results_load(unsigned long long key, unsigned char* output, unsigned int capacity, unsigned int* size, int* exit_code);
+
+// returns 0 on error, or if output is bigger than the whole budget
+_Bool
+results_store(unsigned long long key, int exit_code, const unsigned char* output, unsigned int size);
+
+#endif
@@ -0,0 +1,385 @@
+/*
+  Termite sessions
+
+  Serves many interactive runs of single program on one thread, every connection to unix domain socket is its own run
+  Bytes that client sends are stdin of the run, shutting down writing side of connection closes it
+  Output is sent back as it's produced, connection is closed once run is over and all of its output is sent
+
+  Runs never block: '>' suspends run until more input arrives, and rewinds preempt it after SLICE_STEPS steps,
+    so that single epoll loop could multiplex thousands of them
+  Runs that have more than OUTPUT_HIGH_WATER bytes of unsent output aren't resumed until client reads some of it
+  Exit code isn't sent to client, as stream is raw output, failed runs are reported to stderr instead
+
+  Usage: termite-sessions <socket path> <program> [worker switches]...
+*/
+
+#define _GNU_SOURCE
+#define TERM_NO_WORKER_MAIN
+#define TERM_RESUMABLE_VM
+#include "worker.c"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define SESSION_LIMIT       4096U
+#define SLICE_STEPS         1000000U
+#define INPUT_BUFFER_SIZE   4096U
+#define OUTPUT_HIGH_WATER   (256U * 1024U)
+#define EVENT_BATCH         64U
+
+typedef struct Session {
+  int             fd;
+  unsigned int    number;
+  VmState         vm;
+  TermiteMemory   in;
+  TermiteMemory   out;
+  unsigned int    out_sent;  // leading part of out that is already written to socket
+  unsigned int    events;    // epoll events it's registered for
+  _Bool           is_queued; // waits in run queue
+  _Bool           is_over;
+  struct Session* next;      // in run queue
+} Session;
+
+static Program program;
+static WorkerArgs args;
+static int poller;
+static unsigned int session_count;
+static unsigned int session_numbers;
+
+// sessions that are ready to be resumed, in order of their turns
+static Session* queue_head;
+static Session* queue_tail;
+
+static volatile sig_atomic_t is_stopping;
+
+static _Bool
+grow_output(TermiteMemory* memory, unsigned int required)
+{
+  unsigned int capacity = memory->capacity != 0U ? memory->capacity : 4096U;
+  while (capacity < required)
+    capacity = capacity > 0x7FFFFFFFU ? required : capacity * 2U;
+
+  unsigned char* data = realloc(memory->data, capacity);
+  if (data == NULL)
+    return (_Bool)0;
+  memory->data = data;
+  memory->capacity = capacity;
+  return (_Bool)1;
+}
+
+static void
+enqueue(Session* session)
+{
+  if (session->is_queued || session->is_over)
+    return;
+  session->is_queued = (_Bool)1;
+  session->next = NULL;
+  if (queue_tail != NULL)
+    queue_tail->next = session;
+  else
+    queue_head = session;
+  queue_tail = session;
+}
+
+static Session*
+dequeue(void)
+{
+  Session* session = queue_head;
+  queue_head = session->next;
+  if (queue_head == NULL)
+    queue_tail = NULL;
+  session->is_queued = (_Bool)0;
+  return session;
+}
+
+static unsigned int
+pending_output(const Session* session)
+{
+  return session->out.size - session->out_sent;
+}
+
+static void
+free_session(Session* session)
+{
+  free(session->vm.cells);
+  free(session->in.data);
+  free(session->out.data);
+  free(session);
+  session_count--;
+}
+
+// session that is still queued is only freed once it leaves the queue
+static void
+close_session(Session* session)
+{
+  epoll_ctl(poller, EPOLL_CTL_DEL, session->fd, NULL);
+  close(session->fd);
+  session->fd = -1;
+  session->is_over = (_Bool)1;
+  if (!session->is_queued)
+    free_session(session);
+}
+
+// registers for reading while there's room for input, and for writing while there's output to send
+// returns 0 if session should be closed
+static _Bool
+update_events(Session* session)
+{
+  if (session->is_over && pending_output(session) == 0U)
+    return (_Bool)0;
+
+  unsigned int events = 0U;
+  if (!session->is_over && !session->vm.is_input_closed && session->in.size - session->in.position != session->in.capacity)
+    events |= EPOLLIN;
+  if (pending_output(session) != 0U)
+    events |= EPOLLOUT;
+
+  if (events != session->events) {
+    struct epoll_event event = { .events = events, .data.ptr = session };
+    epoll_ctl(poller, EPOLL_CTL_MOD, session->fd, &event);
+    session->events = events;
+  }
+  return (_Bool)1;
+}
+
+// returns 0 if client is gone
+static _Bool
+send_output(Session* session)
+{
+  while (pending_output(session) != 0U) {
+    ssize_t sent = send(session->fd, &session->out.data[session->out_sent], pending_output(session), MSG_DONTWAIT);
+    if (sent < 0 && errno == EINTR)
+      continue;
+    if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return (_Bool)1;
+    if (sent <= 0)
+      return (_Bool)0;
+    session->out_sent += (unsigned int)sent;
+  }
+  session->out.size = 0U;
+  session->out_sent = 0U;
+  return (_Bool)1;
+}
+
+// returns 0 if client is gone
+static _Bool
+receive_input(Session* session)
+{
+  TermiteMemory* in = &session->in;
+
+  // consumed input is dropped to make room at the end
+  if (in->position != 0U) {
+    memmove(in->data, &in->data[in->position], in->size - in->position);
+    in->size -= in->position;
+    in->position = 0U;
+  }
+
+  while (in->size != in->capacity) {
+    ssize_t received = recv(session->fd, &in->data[in->size], in->capacity - in->size, MSG_DONTWAIT);
+    if (received < 0 && errno == EINTR)
+      continue;
+    if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      break;
+    if (received < 0)
+      return (_Bool)0;
+    if (received == 0) {
+      session->vm.is_input_closed = (_Bool)1;
+      break;
+    }
+    in->size += (unsigned int)received;
+  }
+  return (_Bool)1;
+}
+
+static void
+accept_sessions(int listener)
+{
+  while (1) {
+    int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0)
+      return;
+
+    Session* session = calloc(1U, sizeof(Session));
+    void* cells = session != NULL ? malloc(STACK_LIMIT * (args.wide_cells ? sizeof(unsigned short) : 1U)) : NULL;
+    unsigned char* input = cells != NULL ? malloc(INPUT_BUFFER_SIZE) : NULL;
+    if (session_count == SESSION_LIMIT || input == NULL) {
+      free(input);
+      free(cells);
+      free(session);
+      close(fd);
+      continue;
+    }
+
+    session->fd = fd;
+    session->number = ++session_numbers;
+    session->in = (TermiteMemory){ .data = input, .capacity = INPUT_BUFFER_SIZE };
+    session->out = (TermiteMemory){ .reserve = grow_output };
+    init_vm(&session->vm, &program, &session->in, cells);
+
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = session };
+    if (epoll_ctl(poller, EPOLL_CTL_ADD, fd, &event) != 0) {
+      free(input);
+      free(cells);
+      free(session);
+      close(fd);
+      continue;
+    }
+    session->events = EPOLLIN;
+    session_count++;
+
+    // program could have something to say before reading anything
+    enqueue(session);
+  }
+}
+
+static void
+report_exit(const Session* session, int exit_code)
+{
+  if (exit_code == OC_OK)
+    return;
+  TermiteHandle err = get_stderr();
+  write_cstring(err, "session ");
+  write_uint(err, session->number);
+  write_cstring(err, " exited with ");
+  write_uint(err, (unsigned int)exit_code);
+  write_cstring(err, "\n");
+}
+
+// runs single slice of session
+static void
+run_slice(Session* session)
+{
+  session->vm.slice_end = session->vm.steps + SLICE_STEPS;
+  int status = resume_program(&session->vm, memory_handle(&session->out), args);
+
+  if (status != VM_WAITING && status != VM_PREEMPTED) {
+    session->is_over = (_Bool)1;
+    report_exit(session, status);
+  }
+
+  if (!send_output(session) || !update_events(session)) {
+    close_session(session);
+    return;
+  }
+
+  // preempted run takes its next turn after everyone else, unless client doesn't keep up with its output
+  if (status == VM_PREEMPTED && pending_output(session) <= OUTPUT_HIGH_WATER)
+    enqueue(session);
+}
+
+static void
+handle_event(Session* session, unsigned int events)
+{
+  if ((events & EPOLLOUT) != 0U) {
+    unsigned int was_pending = pending_output(session);
+    if (!send_output(session)) {
+      close_session(session);
+      return;
+    }
+    // run that was held back by its output continues
+    if (was_pending > OUTPUT_HIGH_WATER && pending_output(session) <= OUTPUT_HIGH_WATER)
+      enqueue(session);
+  }
+
+  if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0U && !session->is_over) {
+    _Bool was_closed = session->vm.is_input_closed;
+    unsigned int was_received = session->in.size - session->in.position;
+    if (!receive_input(session)) {
+      close_session(session);
+      return;
+    }
+    if (session->in.size - session->in.position != was_received || session->vm.is_input_closed != was_closed)
+      enqueue(session);
+  }
+
+  if (!update_events(session))
+    close_session(session);
+}
+
+static void
+handle_stop(int signal)
+{
+  (void)signal;
+  is_stopping = 1;
+}
+
+int
+term_main(int argc, const char** argv)
+{
+  if (argc < 3)
+    return OC_INVALID_INPUT;
+
+  for (int i = 3; i < argc; i++)
+    parse_worker_arg(argv[i], &args);
+
+  TermiteHandle program_file;
+  if (!open_file(argv[2], &program_file, foFileRead))
+    return OC_FILE_ERROR;
+  int return_code = prepare_program(&program, program_file, args);
+  close_file(program_file);
+  if (return_code != OC_OK)
+    return return_code;
+
+  struct sockaddr_un address = { .sun_family = AF_UNIX };
+  if (count_cstring(argv[1]) >= sizeof(address.sun_path))
+    return OC_INVALID_INPUT;
+  strcpy(address.sun_path, argv[1]);
+
+  int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  poller = epoll_create1(EPOLL_CLOEXEC);
+  if (listener < 0 || poller < 0)
+    return OC_FILE_ERROR;
+
+  unlink(argv[1]);
+  struct epoll_event listener_event = { .events = EPOLLIN, .data.ptr = NULL };
+  if (bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+      listen(listener, SOMAXCONN) != 0 ||
+      epoll_ctl(poller, EPOLL_CTL_ADD, listener, &listener_event) != 0)
+  {
+    close(listener);
+    return OC_FILE_ERROR;
+  }
+
+  // clients going away are noticed on send instead
+  signal(SIGPIPE, SIG_IGN);
+
+  struct sigaction stop_action = { .sa_handler = handle_stop };
+  sigaction(SIGTERM, &stop_action, NULL);
+  sigaction(SIGINT, &stop_action, NULL);
+
+  init_io();
+  struct epoll_event events[EVENT_BATCH];
+  while (!is_stopping) {
+    // runnable sessions only let the loop peek at events between their slices
+    int count = epoll_wait(poller, events, EVENT_BATCH, queue_head != NULL ? 0 : -1);
+    for (int i = 0; i < count; i++) {
+      if (events[i].data.ptr == NULL)
+        accept_sessions(listener);
+      else
+        handle_event(events[i].data.ptr, events[i].events);
+    }
+
+    // every session that is runnable now gets single slice, ones that are requeued wait for the next round
+    for (Session* last = queue_tail; queue_head != NULL;) {
+      Session* session = dequeue();
+      _Bool is_last = session == last ? (_Bool)1 : (_Bool)0;
+      if (session->fd < 0)
+        free_session(session);
+      else
+        run_slice(session);
+      if (is_last)
+        break;
+    }
+  }
+  deinit_io();
+
+  close(listener);
+  unlink(argv[1]);
+  return OC_OK;
+}
@@ -6,6 +6,11 @@
 #define FILEPATH_LIMIT      128U    // 128 bytes
 
 #define STDOUT_BUFFER_SIZE  128U
+#define TRANSFER_CHUNK_SIZE 65536U  // when transfer_file has to copy through the process
+
+#define CACHE_DIRECTORY     "termite-cache"
+
+#define HIVEMIND_EXIT       0x98    // program asks hivemind host to apply commands from its output
 
 enum OutputCodes {
   OC_OK,
@@ -16,6 +21,8 @@ enum OutputCodes {
   OC_INVALID_INPUT,
   OC_ZERO_DIVISION,
   OC_INFINITE_LOOP,
+  OC_STEP_LIMIT,
+  OC_BREAKPOINT,
 
   OC_FILE_ERROR = 0x10, // todo: make it generic 'IO error'?
 
@@ -5,6 +5,7 @@
 #include "io.h"
 #include "common.h"
 #include "terms.h"
+#include "memory.h"
 
 typedef void*           HANDLE;
 typedef int             HFILE;
@@ -23,6 +24,17 @@ typedef const char*     LPCSTR;
 
 #define OF_READ         0x00000000
 #define OF_WRITE        0x00000001
+#define OF_DELETE       0x00000200
+#define OF_CREATE       0x00001000
+
+#define PAGE_READONLY   0x02
+#define FILE_MAP_READ   0x0004
+
+#define ERROR_ALREADY_EXISTS 183
+
+#define LOCKFILE_EXCLUSIVE_LOCK 0x00000002
+
+#define MOVEFILE_REPLACE_EXISTING 0x00000001
 
 typedef struct _OFSTRUCT {
   BYTE cBytes;
@@ -33,6 +45,15 @@ typedef struct _OFSTRUCT {
   CHAR szPathName[OFS_MAXPATHNAME];
 } OFSTRUCT, *LPOFSTRUCT;
 
+// only used for locking, which takes range of file from it
+typedef struct _OVERLAPPED {
+  size_t Internal;
+  size_t InternalHigh;
+  DWORD  Offset;
+  DWORD  OffsetHigh;
+  HANDLE hEvent;
+} OVERLAPPED;
+
 // overlapped structure is left as void* as we will not use it in any way as console output couldn't be async
 extern BOOL   __stdcall WriteFile(HANDLE hFile, LPCVOID lpBuffer, DWORD nNumberOfBytesToWrite, LPDWORD lpNumberOfBytesWritten, void* lpOverlapped);
 extern BOOL   __stdcall ReadFile(HANDLE hFile, LPCVOID lpBuffer, DWORD nNumberOfBytesToRead, LPDWORD lpNumberOfBytesRead, void* lpOverlapped);
@@ -40,12 +61,22 @@ extern HANDLE __stdcall GetStdHandle(DWORD nStdHandle);
 extern HFILE  __stdcall OpenFile(LPCSTR lpFileName, LPOFSTRUCT lpReOpenBuff, UINT uStyle);
 extern BOOL   __stdcall CloseHandle(HANDLE hObject);
 extern DWORD  __stdcall GetLastError(void);
+extern DWORD  __stdcall GetFileSize(HANDLE hFile, LPDWORD lpFileSizeHigh);
+extern HANDLE __stdcall CreateFileMappingA(HANDLE hFile, void* lpFileMappingAttributes, DWORD flProtect, DWORD dwMaximumSizeHigh, DWORD dwMaximumSizeLow, LPCSTR lpName);
+extern void*  __stdcall MapViewOfFile(HANDLE hFileMappingObject, DWORD dwDesiredAccess, DWORD dwFileOffsetHigh, DWORD dwFileOffsetLow, size_t dwNumberOfBytesToMap);
+extern BOOL   __stdcall UnmapViewOfFile(LPCVOID lpBaseAddress);
+extern BOOL   __stdcall MoveFileExA(LPCSTR lpExistingFileName, LPCSTR lpNewFileName, DWORD dwFlags);
+extern DWORD  __stdcall GetCurrentProcessId(void);
+extern BOOL   __stdcall CreateDirectoryA(LPCSTR lpPathName, void* lpSecurityAttributes);
+extern BOOL   __stdcall LockFileEx(HANDLE hFile, DWORD dwFlags, DWORD dwReserved, DWORD nNumberOfBytesToLockLow, DWORD nNumberOfBytesToLockHigh, OVERLAPPED* lpOverlapped);
 
 #define STD_INPUT_HANDLE ((DWORD)-10)
 #define STD_OUTPUT_HANDLE ((DWORD)-11)
+#define STD_ERROR_HANDLE ((DWORD)-12)
 
 static HANDLE stdout;
 static HANDLE stdin;
+static HANDLE stderr;
 static char stdout_buffer[STDOUT_BUFFER_SIZE];
 static unsigned int stdout_buffer_written;
 
@@ -63,6 +94,7 @@ init_io(void)
 {
   stdout = (TermiteHandle)GetStdHandle(STD_OUTPUT_HANDLE);
   stdin = (TermiteHandle)GetStdHandle(STD_INPUT_HANDLE);
+  stderr = (TermiteHandle)GetStdHandle(STD_ERROR_HANDLE);
 }
 
 void
@@ -77,6 +109,13 @@ deinit_io(void)
   // close_file(get_stdin());
 }
 
+// todo: overlapped console io
+_Bool
+start_io_thread(void)
+{
+  return (_Bool)0;
+}
+
 TermiteHandle
 get_stdin(void)
 {
@@ -89,6 +128,12 @@ get_stdout(void)
   return (TermiteHandle)stdout;
 }
 
+TermiteHandle
+get_stderr(void)
+{
+  return (TermiteHandle)stderr;
+}
+
 _Bool
 open_file(const char* path, TermiteHandle* result, FileOpenIntents intent)
 {
@@ -104,6 +149,9 @@ open_file(const char* path, TermiteHandle* result, FileOpenIntents intent)
     case foFileWrite:
       file = OpenFile(path, &file_struct, OF_WRITE);
       break;
+    case foFileCreate:
+      file = OpenFile(path, &file_struct, OF_CREATE | OF_WRITE);
+      break;
   }
   (void)file_struct;
 
@@ -117,6 +165,9 @@ open_file(const char* path, TermiteHandle* result, FileOpenIntents intent)
 _Bool
 close_file(TermiteHandle file)
 {
+  if (is_memory_handle(file))
+    return (_Bool)1;
+
   BOOL status = CloseHandle((HANDLE)file);
   return status == (BOOL)0 ? (_Bool)0 : (_Bool)1;
 }
@@ -124,6 +175,17 @@ close_file(TermiteHandle file)
 _Bool
 write_file(TermiteHandle file, const char* msg, unsigned int len)
 {
+  if (is_memory_handle(file))
+    return write_memory(file, msg, len);
+
+  // messages that would fill the buffer anyway go right after what's buffered, without copying them through it
+  if (file == (TermiteHandle)stdout && len >= STDOUT_BUFFER_SIZE) {
+    if (stdout_buffer_written != 0U)
+      write_file_impl(stdout, stdout_buffer, stdout_buffer_written);
+    stdout_buffer_written = 0U;
+    return write_file_impl(stdout, msg, len);
+  }
+
   if (file == (TermiteHandle)stdout) {
     unsigned int base = 0U;
     while (len > 0U) {
@@ -159,6 +221,9 @@ read_file(TermiteHandle file,
           unsigned int limit,
           unsigned int* restrict read_result)
 {
+  if (is_memory_handle(file))
+    return read_memory(file, buff, limit, read_result);
+
   DWORD chars_read;
   if (ReadFile((HANDLE)file, buff, limit, &chars_read, NULL) == (BOOL)0) {
     *read_result = 0U;
@@ -173,3 +238,100 @@ read_file(TermiteHandle file,
   *read_result = (unsigned int)chars_read;
   return (_Bool)1;
 }
+
+// todo: TransmitFile could move file to socket without copying, pipes and consoles have nothing like it
+_Bool
+transfer_file(TermiteHandle in, TermiteHandle out, unsigned long long* transferred)
+{
+  char chunk[TRANSFER_CHUNK_SIZE];
+  unsigned int chars_read;
+  *transferred = 0U;
+  while (1) {
+    if (!read_file(in, chunk, TRANSFER_CHUNK_SIZE, &chars_read))
+      return (_Bool)0;
+    if (chars_read == 0U)
+      return (_Bool)1;
+    write_file(out, chunk, chars_read);
+    *transferred += chars_read;
+  }
+}
+
+_Bool
+map_file(const char* path, TermiteMapping* result)
+{
+  if (!open_file(path, &result->file, foFileRead))
+    return (_Bool)0;
+
+  DWORD size_high;
+  DWORD size = GetFileSize((HANDLE)result->file, &size_high);
+  if (size == 0U || size_high != 0U) {
+    close_file(result->file);
+    return (_Bool)0;
+  }
+
+  result->view = (TermiteHandle)CreateFileMappingA((HANDLE)result->file, NULL, PAGE_READONLY, 0U, 0U, NULL);
+  if (result->view == NULL) {
+    close_file(result->file);
+    return (_Bool)0;
+  }
+
+  result->data = (const unsigned char*)MapViewOfFile((HANDLE)result->view, FILE_MAP_READ, 0U, 0U, 0U);
+  if (result->data == NULL) {
+    CloseHandle((HANDLE)result->view);
+    close_file(result->file);
+    return (_Bool)0;
+  }
+  result->size = (unsigned int)size;
+  return (_Bool)1;
+}
+
+_Bool
+unmap_file(TermiteMapping* mapping)
+{
+  BOOL status = UnmapViewOfFile(mapping->data);
+  status &= CloseHandle((HANDLE)mapping->view);
+  status &= CloseHandle((HANDLE)mapping->file);
+  return status == (BOOL)0 ? (_Bool)0 : (_Bool)1;
+}
+
+_Bool
+delete_file(const char* path)
+{
+  if (count_cstring(path) > FILEPATH_LIMIT)
+    return (_Bool)0;
+
+  OFSTRUCT file_struct;
+  return OpenFile(path, &file_struct, OF_DELETE) == HFILE_ERROR ? (_Bool)0 : (_Bool)1;
+}
+
+// todo: destination that is mapped can't be replaced, so entry in use is only updated once it's released
+_Bool
+replace_file(const char* source, const char* destination)
+{
+  if (count_cstring(source) > FILEPATH_LIMIT || count_cstring(destination) > FILEPATH_LIMIT)
+    return (_Bool)0;
+
+  return MoveFileExA(source, destination, MOVEFILE_REPLACE_EXISTING) == (BOOL)0 ? (_Bool)0 : (_Bool)1;
+}
+
+unsigned int
+get_process_id(void)
+{
+  return (unsigned int)GetCurrentProcessId();
+}
+
+_Bool
+create_directory(const char* path)
+{
+  if (CreateDirectoryA(path, NULL) == (BOOL)0)
+    return GetLastError() == ERROR_ALREADY_EXISTS ? (_Bool)1 : (_Bool)0;
+  return (_Bool)1;
+}
+
+_Bool
+lock_file(TermiteHandle file)
+{
+  OVERLAPPED overlapped = {0};
+  BOOL status = LockFileEx((HANDLE)file, LOCKFILE_EXCLUSIVE_LOCK, 0U, ~(DWORD)0, ~(DWORD)0, &overlapped);
+  return status == (BOOL)0 ? (_Bool)0 : (_Bool)1;
+}
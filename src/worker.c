@@ -7,30 +7,69 @@
   // todo: description + explanation of certain design choices
 */
 
+#include <stddef.h>
+
 #include "io.h"
 #include "common.h"
 #include "terms.h"
+#include "program.h"
+#include "cache.h"
+#include "perf.h"
+#include "profile.h"
+#include "cfg.h"
+#include "intrinsics.h"
+#include "results.h"
 
 // todo: catch infinitely conveyoring loops
 // todo: do not include sequential pushes in debug stack output
 // todo: std/check-range-2 false positively detects infinite loop
 
+// limits which steps are traced, every given filter has to match
+//   ranges are inclusive, tokens are counted from 1 the same way as in trace output
+typedef struct {
+  unsigned int filters; // TraceFilters that are given
+  unsigned int offset_low, offset_high;
+  unsigned int token_low, token_high;
+  unsigned int depth_low, depth_high;
+  unsigned int top_low, top_high;
+  unsigned int every; // only every Kth step that matches others is traced
+} TraceFilter;
+
+typedef enum {
+  tfOffset = 1U << 0U,
+  tfTokens = 1U << 1U,
+  tfDepth  = 1U << 2U,
+  tfTop    = 1U << 3U,
+  tfEvery  = 1U << 4U,
+} TraceFilters;
+
+// trace filter resolved against program, filters that aren't given cover everything
+typedef struct {
+  unsigned int offset_low, offset_span;
+  unsigned int depth_low, depth_span;
+  unsigned int top_low, top_span;
+  unsigned int is_top_filtered;
+  unsigned int every;
+} TraceWindow;
+
 typedef struct {
   _Bool print_stack_steps;
   _Bool print_stack_on_exit;
   _Bool catch_infinite_recursion;
+  _Bool use_cache;
+  _Bool wide_cells; // stack values are 16 bit, only '<' and '>' operate on bytes
+  _Bool report_perf;
+  _Bool profile; // sample hot spots of the run and report them to stderr
+  _Bool stop_on_trace; // run is stopped with OC_BREAKPOINT on the first traced step
+  _Bool no_intrinsics; // std routine bodies are always interpreted
+  TraceFilter trace_filter;
+  unsigned int step_limit; // 0 for unlimited, checked on rewinds as only they could loop
+  unsigned long long* executed_steps; // if not NULL, receives count of executed tokens
 } WorkerArgs;
 
-// todo: move these funcs to common.h?
-static _Bool
-is_hex_char(char ch)
-{
- return (ch >= 'A' && ch <= 'F') || (ch >= '0' && ch <= '9') ? (_Bool)1 : (_Bool)0;
-}
-
 // todo: signal reasoning behind failure? for example non ascii chars
 static _Bool
-parse_hex(char* input_low, char* input_high, unsigned int pos)
+parse_hex(const char* input_low, const char* input_high, unsigned int pos)
 {
   if ((input_low + pos + 1U <= input_high) &&
       ((input_low[pos] >= 'A' && input_low[pos] <= 'F') ||
@@ -44,7 +83,7 @@ parse_hex(char* input_low, char* input_high, unsigned int pos)
 
 // todo: should it be 0 based?
 static unsigned int
-count_tokens(char* input_low, char* input_high, unsigned int pos)
+count_tokens(const char* input_low, const char* input_high, unsigned int pos)
 {
   unsigned int result = 0U;
   unsigned int cur = pos;
@@ -74,426 +113,689 @@ count_tokens(char* input_low, char* input_high, unsigned int pos)
   return result;
 }
 
+// attaches token index to loaded program, either cached or freshly built
+static void
+attach_index(Program* program, WorkerArgs args)
+{
+  if (!args.use_cache || !cache_load(program)) {
+    index_program(program);
+    // failing to cache is not fatal, next run will just try again
+    if (args.use_cache)
+      cache_store(program);
+  }
+}
+
+// loads program and attaches its token index
+static int
+prepare_program(Program* program, TermiteHandle input_handle, WorkerArgs args)
+{
+  int status = load_program(input_handle, program);
+  if (status != OC_OK)
+    return status;
+
+  attach_index(program, args);
+  return OC_OK;
+}
+
+static TraceWindow
+resolve_trace_filter(const Program* program, const TraceFilter* filter)
+{
+  TraceWindow window = {
+    .offset_span = ~0U,
+    .depth_span = ~0U,
+    .top_span = ~0U,
+    .every = 1U,
+  };
+  unsigned int offset_high = ~0U;
+
+  if ((filter->filters & tfOffset) != 0U) {
+    window.offset_low = filter->offset_low;
+    offset_high = filter->offset_high;
+  }
+  if ((filter->filters & tfTokens) != 0U) {
+    unsigned int first = filter->token_low != 0U ? filter->token_low : 1U;
+    unsigned int last = filter->token_high < program->token_count ? filter->token_high : program->token_count;
+    if (first <= last) {
+      if (program->token_offsets[first - 1U] > window.offset_low)
+        window.offset_low = program->token_offsets[first - 1U];
+      if (token_end(program, last - 1U) - 1U < offset_high)
+        offset_high = token_end(program, last - 1U) - 1U;
+    } else {
+      window.offset_low = ~0U;
+      offset_high = 0U;
+    }
+  }
+  // empty range is left at offset that couldn't be reached
+  if (window.offset_low > offset_high) {
+    window.offset_low = ~0U;
+    window.offset_span = 0U;
+  } else
+    window.offset_span = offset_high - window.offset_low;
+
+  if ((filter->filters & tfDepth) != 0U) {
+    window.depth_low = filter->depth_low;
+    window.depth_span = filter->depth_high - filter->depth_low;
+  }
+  if ((filter->filters & tfTop) != 0U) {
+    window.top_low = filter->top_low;
+    window.top_span = filter->top_high - filter->top_low;
+    window.is_top_filtered = 1U;
+  }
+  if ((filter->filters & tfEvery) != 0U && filter->every != 0U)
+    window.every = filter->every;
+  return window;
+}
+
+// filters are combined without branches, so step that isn't traced costs single branch on the result
+static inline _Bool
+is_step_traced(const TraceWindow* window, unsigned int offset, unsigned int depth, unsigned int top)
+{
+  unsigned int matches =
+    (unsigned int)(offset - window->offset_low <= window->offset_span) &
+    (unsigned int)(depth - window->depth_low <= window->depth_span) &
+    (unsigned int)(top - window->top_low <= window->top_span) &
+    ((unsigned int)(depth != 0U) | (window->is_top_filtered ^ 1U));
+  return matches != 0U ? (_Bool)1 : (_Bool)0;
+}
+
+// interpreter loop is instantiated for every cell width, so neither of them pays for the other
+#define CELL unsigned char
+#define RUN_PROGRAM run_program_bytes
+#define WRITE_CELLS write_byte_array
+#define INTRINSICS 1
+#include "dispatch.h"
+
+#define CELL unsigned short
+#define RUN_PROGRAM run_program_words
+#define WRITE_CELLS write_short_array
+#define INTRINSICS 0
+#include "dispatch.h"
+
+// publishing cursor on every step isn't free, so only runs that are sampled do it
+#define PROFILED
+#define CELL unsigned char
+#define RUN_PROGRAM run_program_bytes_profiled
+#define WRITE_CELLS write_byte_array
+#define INTRINSICS 1
+#include "dispatch.h"
+
+#define PROFILED
+#define CELL unsigned short
+#define RUN_PROGRAM run_program_words_profiled
+#define WRITE_CELLS write_short_array
+#define INTRINSICS 0
+#include "dispatch.h"
+
+#ifdef TERM_RESUMABLE_VM
+// run that could be suspended and resumed later, it's defined for embedders that multiplex many of them
+//   input is only what has arrived so far, '>' suspends the run when it's all consumed and input isn't closed
+//   rewinds suspend the run once it's over slice_end steps, so looping program couldn't hold the thread
+
+#define VM_WAITING   -1 // resume once there's more input or it's closed
+#define VM_PREEMPTED -2 // resume whenever
+
+typedef struct {
+  const Program*     program;
+  TermiteMemory*     input;
+  _Bool              is_input_closed; // reads past input give zeros instead of suspending
+  void*              cells;           // STACK_LIMIT values, bytes or words depending on cell width
+  unsigned int       stack_head;
+  unsigned int       cursor;
+  unsigned int       trace_countdown;
+  unsigned long long steps;
+  unsigned long long slice_end;
+} VmState;
+
+// vm is started from the beginning of the program
+static void
+init_vm(VmState* vm, const Program* program, TermiteMemory* input, void* cells)
+{
+  *vm = (VmState){ .program = program, .input = input, .cells = cells };
+}
+
+// native routines treat input that isn't there as exhausted, so they're never used by resumable runs
+#define RESUMABLE
+#define CELL unsigned char
+#define RUN_PROGRAM resume_program_bytes
+#define WRITE_CELLS write_byte_array
+#define INTRINSICS 0
+#include "dispatch.h"
+
+#define RESUMABLE
+#define CELL unsigned short
+#define RUN_PROGRAM resume_program_words
+#define WRITE_CELLS write_short_array
+#define INTRINSICS 0
+#include "dispatch.h"
+
+// returns exit code once run is over, VM_WAITING or VM_PREEMPTED when it's suspended
+static int
+resume_program(VmState* vm, TermiteHandle out_handle, WorkerArgs args)
+{
+  if (args.wide_cells)
+    return resume_program_words(vm, out_handle, args);
+  return resume_program_bytes(vm, out_handle, args);
+}
+#endif
+
+// runs prepared program, it's not modified in any way so it could be reused for any number of runs
+static int
+run_program(const Program* program,
+            TermiteHandle out_handle,
+            TermiteHandle in_handle,
+            WorkerArgs args)
+{
+  if (args.profile && args.wide_cells)
+    return run_program_words_profiled(program, out_handle, in_handle, args);
+  if (args.profile)
+    return run_program_bytes_profiled(program, out_handle, in_handle, args);
+  if (args.wide_cells)
+    return run_program_words(program, out_handle, in_handle, args);
+  return run_program_bytes(program, out_handle, in_handle, args);
+}
+
+// loads program from given handle and runs it
+#ifdef __GNUC__
+__attribute__((unused)) // embedders are free to not use it
+#endif
 static int
 read_input(TermiteHandle input_handle,
            TermiteHandle out_handle,
            TermiteHandle in_handle,
            WorkerArgs args)
 {
-  int exit_code = 0;
+  // single program at a time, it's too big to be placed on stack
+  static Program program;
 
-  char input[INPUT_LIMIT + 1U]; // todo: initialize it with zeroes?
-  unsigned int size;
-  unsigned int cursor = 0U;
+  int exit_code = prepare_program(&program, input_handle, args);
 
-  if (!read_file(input_handle, input, INPUT_LIMIT, &size)) {
-    return OC_FILE_ERROR;
-  }
+  // without timer report just says that there are no samples
+  _Bool is_profiled = exit_code == OC_OK && args.profile ? (_Bool)1 : (_Bool)0;
+  if (is_profiled)
+    profile_begin();
 
-  if (size == INPUT_LIMIT + 1U) {
-    return OC_INPUT_OVERFLOW;
-  }
+  if (exit_code == OC_OK && args.report_perf) {
+    unsigned long long steps = 0U;
+    args.executed_steps = &steps;
 
-  unsigned char stack[STACK_LIMIT];
-  unsigned int stack_head = 0U;
+    PerfSample sample;
+    perf_begin(&sample);
+    exit_code = run_program(&program, out_handle, in_handle, args);
+    perf_end(&sample);
 
-  // EXPERIMENTAL: required for checking of infinite loops on rewinds
-  // todo: make it compile-time optional?
-  // todo: could be dangerous to just mul to 0
-  unsigned char shadow_stack[STACK_LIMIT * args.catch_infinite_recursion];
-  unsigned int shadow_stack_rewinded_at = 0U;
-  unsigned char shadow_stack_rewinded_with = 0U;
-  unsigned int  shadow_stack_len = 0U;
+    perf_report(get_stderr(), &sample, steps);
+  } else if (exit_code == OC_OK)
+    exit_code = run_program(&program, out_handle, in_handle, args);
 
-  #define crash(code) \
-    do { \
-      exit_code = code; \
-      goto EXIT_LOOP; \
-    } while (0)
+  if (is_profiled) {
+    profile_end();
+    profile_report(get_stderr(), &program);
+  }
 
-  char op_char = '\0';
+  unload_program(&program);
+  return exit_code;
+}
 
-  while (1) {
-    if (cursor == size)
-      break;
+// "N" or "N-M" in decimal, returns 0 if it's malformed
+static _Bool
+parse_range(const char* text, unsigned int* low, unsigned int* high)
+{
+  unsigned int* value = low;
+  *low = 0U;
+  *high = 0U;
+  _Bool has_digits = (_Bool)0;
+
+  for (; *text != '\0'; text++) {
+    if (*text == '-' && value == low && has_digits) {
+      value = high;
+      has_digits = (_Bool)0;
+      continue;
+    }
+    if (*text < '0' || *text > '9' || *value > (~0U - 9U) / 10U)
+      return (_Bool)0;
+    *value = *value * 10U + (unsigned int)(*text - '0');
+    has_digits = (_Bool)1;
+  }
+  if (!has_digits)
+    return (_Bool)0;
+  if (value == low)
+    *high = *low;
+  return *low <= *high ? (_Bool)1 : (_Bool)0;
+}
 
-    switch (input[cursor]) {
-      case  ' ':
-      case '\n':
-      case '\r':
-      case '\t': cursor++; continue;
-
-      // pop value from stack and return it as exit code
-      // this effectively terminates the program in predictable manner
-      case '%': {
-        op_char = '%';
-        if (stack_head == 0U)
-          crash(OC_STACK_EXHAUSTED);
-
-        stack_head--;
-        crash(stack[stack_head]);
-        break;
-      }
+// returns rest of arg if it starts with given key, NULL otherwise
+static const char*
+match_arg_key(const char* arg, const char* key)
+{
+  while (*key != '\0') {
+    if (*arg != *key)
+      return NULL;
+    arg++;
+    key++;
+  }
+  return arg;
+}
 
-      // drop value from stack
-      case '.': {
-        op_char = '.';
-        if (stack_head == 0U)
-          crash(OC_STACK_EXHAUSTED);
-        stack_head--;
-        cursor++;
-        break;
-      }
+// "key=N" or "key=N-M" switch of trace filter, which turns tracing on
+static _Bool
+parse_trace_filter(const char* arg, TraceFilter* filter)
+{
+  const char* range;
+  unsigned int low, high;
+
+  if ((range = match_arg_key(arg, "offset=")) != NULL && parse_range(range, &low, &high)) {
+    filter->filters |= tfOffset;
+    filter->offset_low = low;
+    filter->offset_high = high;
+  } else if ((range = match_arg_key(arg, "tokens=")) != NULL && parse_range(range, &low, &high)) {
+    filter->filters |= tfTokens;
+    filter->token_low = low;
+    filter->token_high = high;
+  } else if ((range = match_arg_key(arg, "depth=")) != NULL && parse_range(range, &low, &high)) {
+    filter->filters |= tfDepth;
+    filter->depth_low = low;
+    filter->depth_high = high;
+  } else if ((range = match_arg_key(arg, "top=")) != NULL && parse_range(range, &low, &high)) {
+    filter->filters |= tfTop;
+    filter->top_low = low;
+    filter->top_high = high;
+  } else if ((range = match_arg_key(arg, "every=")) != NULL && parse_range(range, &low, &high) && low == high) {
+    filter->filters |= tfEvery;
+    filter->every = low;
+  } else
+    return (_Bool)0;
+
+  return (_Bool)1;
+}
 
-      // duplicate last value on stack
-      case '@': {
-        op_char = '@';
-        if (stack_head == STACK_LIMIT)
-          crash(OC_STACK_OVERFLOW);
-        if (stack_head == 0U)
-          crash(OC_STACK_EXHAUSTED);
-        stack[stack_head] = stack[stack_head - 1U];
-        stack_head++;
-        cursor++;
-        break;
-      }
+// returns 0 if switch isn't recognized
+#ifdef __GNUC__
+__attribute__((unused))
+#endif
+static _Bool
+parse_worker_arg(const char* arg, WorkerArgs* args)
+{
+  // turn all debug switches
+  if (compare_cstring(arg, "d")) {
+    args->print_stack_steps = (_Bool)1;
+    args->catch_infinite_recursion = (_Bool)1;
+    args->print_stack_on_exit = (_Bool)1;
+
+  // turn on stack step printing
+  } else if (compare_cstring(arg, "s")) {
+    args->print_stack_steps = (_Bool)1;
+
+  // show state of stack on program exit
+  } else if (compare_cstring(arg, "e")) {
+    args->print_stack_on_exit = (_Bool)1;
+
+  // EXPERIMENTAL: try to catch rewinds that don't change state of stack
+  // and thus are most likely infinitely looped
+  } else if (compare_cstring(arg, "l")) {
+    args->catch_infinite_recursion = (_Bool)1;
+
+  // reuse load-time artifacts from cache directory, storing them if there's no entry yet
+  } else if (compare_cstring(arg, "cache")) {
+    args->use_cache = (_Bool)1;
+
+  // 16 bit arithmetic
+  } else if (compare_cstring(arg, "wide")) {
+    args->wide_cells = (_Bool)1;
+
+  // report hardware counters of the run to stderr
+  } else if (compare_cstring(arg, "perf")) {
+    args->report_perf = (_Bool)1;
+
+  // report hottest tokens and lines of the run to stderr
+  } else if (compare_cstring(arg, "profile")) {
+    args->profile = (_Bool)1;
+
+  // interpret bodies of std routines instead of running their native implementations
+  } else if (compare_cstring(arg, "nointrinsics")) {
+    args->no_intrinsics = (_Bool)1;
+
+  // stop on the first traced step
+  } else if (compare_cstring(arg, "break")) {
+    args->print_stack_steps = (_Bool)1;
+    args->stop_on_trace = (_Bool)1;
+
+  // trace only steps that match filter
+  } else if (parse_trace_filter(arg, &args->trace_filter)) {
+    args->print_stack_steps = (_Bool)1;
+
+  } else
+    return (_Bool)0;
+
+  return (_Bool)1;
+}
 
-      // swap two last values on stack
-      case '^': {
-        op_char = '^';
-        if (stack_head < 2U)
-          crash(OC_STACK_EXHAUSTED);
-        unsigned char buff = stack[stack_head - 1U];
-        stack[stack_head - 1U] = stack[stack_head - 2U];
-        stack[stack_head - 2U] = buff;
-        cursor++;
-        break;
-      }
+#ifndef TERM_NO_WORKER_MAIN
+#define SELFTEST_OUTPUT_SIZE 4096U
 
-      // 'conveyor belt' operator
-      // place last value on the stack at the beginning
-      case '#': {
-        op_char = '#';
-        if (stack_head == 0U) {
-          cursor++;
-          break;
-        }
-        unsigned char buff = stack[stack_head - 1U];
-        for (unsigned int i = 0U; i < stack_head; i++) {
-          unsigned char convey = stack[i];
-          stack[i] = buff;
-          buff = convey;
-        }
-        cursor++;
-        break;
-      }
+typedef struct {
+  const char*  data;
+  unsigned int len;
+} SelftestInput;
 
-      // 'ronveyor belt' operator aka 'reverse conveyor'
-      // place first value on the stack at the end
-      case '$': {
-        op_char = '$';
-        if (stack_head == 0U) {
-          cursor++;
-          break;
-        }
-        unsigned char buff = stack[0U];
-        for (unsigned int i = stack_head; i--;) {
-          unsigned char convey = stack[i];
-          stack[i] = buff;
-          buff = convey;
-        }
-        cursor++;
-        break;
-      }
+// runs program over given input with and without intrinsics, returns 0 if runs differ in anything
+static _Bool
+compare_intrinsic_runs(const Program* program, SelftestInput input)
+{
+  static unsigned char outputs[2][SELFTEST_OUTPUT_SIZE];
+  unsigned int sizes[2];
+  int exit_codes[2];
+  unsigned long long steps[2];
+
+  for (unsigned int native = 0U; native < 2U; native++) {
+    TermiteMemory in = { .data = (unsigned char*)input.data, .size = input.len, .capacity = input.len };
+    TermiteMemory out = { .data = outputs[native], .capacity = SELFTEST_OUTPUT_SIZE };
+
+    // stack is printed at exit, so it's compared as well
+    WorkerArgs args = {0};
+    args.print_stack_on_exit = (_Bool)1;
+    args.no_intrinsics = native == 0U ? (_Bool)1 : (_Bool)0;
+    args.executed_steps = &steps[native];
+    exit_codes[native] = run_program(program, memory_handle(&out), memory_handle(&in), args);
+    sizes[native] = out.size;
+  }
 
-      // not operator, toggles least significant bit
-      // todo: replace with proper bitwise operators?
-      case '~': {
-        op_char = '~';
-        if (stack_head == 0U)
-          crash(OC_STACK_EXHAUSTED);
-        stack[stack_head - 1U] ^= 1U;
-        cursor++;
-        break;
-      }
+  return exit_codes[0] == exit_codes[1] && steps[0] == steps[1] &&
+         compare_byte_array(outputs[0], sizes[0], outputs[1], sizes[1]) ? (_Bool)1 : (_Bool)0;
+}
 
-      // compare two stack values, consume them and push 1 or 0 depending on whether they're equal
-      case '=': {
-        op_char = '=';
-        if (stack_head < 2U)
-          crash(OC_STACK_EXHAUSTED);
-        stack[stack_head - 2U] = stack[stack_head - 2U] == stack[stack_head - 1U];
-        stack_head--;
-        cursor++;
-        break;
+// checks every intrinsic against interpretation of its body, on stacks of several depths
+static int
+run_intrinsics_selftest(TermiteHandle report)
+{
+  static const char* const prefixes[] = { "", "01 ", "41 42 43 " };
+  // loops that echo runs besides its own body, with maps of every kind
+  static const char* const pass_through_loops[] = {
+    ">~05*]20+<09[.", ">~07*]03*01-<0B[.", ">~06*]~61?<0A[.", ">~07*]03/ 20+<0B[.",
+  };
+  const unsigned int body_count = intrinsic_count + sizeof(pass_through_loops) / sizeof(pass_through_loops[0]);
+  static char all_bytes[256];
+  for (unsigned int i = 0U; i < 256U; i++)
+    all_bytes[i] = (char)i;
+
+  const SelftestInput inputs[] = {
+    { "", 0U },
+    { "a", 1U },
+    { "\n", 1U },
+    { "ab\ncd\n", 6U },
+    { "hello", 5U },
+    { "xy\0z", 4U },
+    { "\x05\x0A\x07", 3U },
+    { "\x05\x0A\x0C", 3U },
+    { "\x0A\x05\x07", 3U },
+    { "\x05\x05\x07", 3U },
+    { all_bytes, 256U },
+  };
+
+  static Program program;
+  static char source[256];
+  int exit_code = OC_OK;
+
+  for (unsigned int i = 0U; i < body_count; i++) {
+    const char* body = i < intrinsic_count ? intrinsics[i].body : pass_through_loops[i - intrinsic_count];
+    _Bool is_passed = (_Bool)1;
+
+    for (unsigned int p = 0U; p < sizeof(prefixes) / sizeof(prefixes[0]); p++) {
+      // something is pushed after the body to check that interpretation resumes right past it
+      unsigned int len = 0U;
+      for (const char* ch = prefixes[p]; *ch != '\0'; ch++)
+        source[len++] = *ch;
+      for (const char* ch = body; *ch != '\0'; ch++)
+        source[len++] = *ch;
+      source[len++] = ' ';
+      source[len++] = '~';
+
+      load_program_bytes(source, len, &program);
+      index_program(&program);
+      if (program.intrinsic_site_count != 1U)
+        is_passed = (_Bool)0;
+
+      for (unsigned int n = 0U; n < sizeof(inputs) / sizeof(inputs[0]); n++) {
+        if (!compare_intrinsic_runs(&program, inputs[n]))
+          is_passed = (_Bool)0;
       }
+    }
 
-      // compare two stack values, consume them and push 1 or 0 depending on how they compare
-      // if last is bigger than next then 0, otherwise 1
-      case '?': {
-        op_char = '?';
-        if (stack_head < 2U)
-          crash(OC_STACK_EXHAUSTED);
-        stack[stack_head - 2U] = stack[stack_head - 2U] < stack[stack_head - 1U];
-        stack_head--;
-        cursor++;
-        break;
-      }
+    if (i < intrinsic_count) {
+      write_cstring(report, intrinsics[i].name);
+    } else {
+      write_cstring(report, "pass-through ");
+      write_cstring(report, body);
+    }
+    write_cstring(report, is_passed ? " ok\n" : " mismatch\n");
+    if (!is_passed)
+      exit_code = OC_INVALID_INPUT;
+  }
+  return exit_code;
+}
 
-      // add two stack values, consume them and push result of addition 
-      case '+': {
-        op_char = '+';
-        if (stack_head < 2U)
-          crash(OC_STACK_EXHAUSTED);
-        stack[stack_head - 2U] = stack[stack_head - 2U] + stack[stack_head - 1U];
-        stack_head--;
-        cursor++;
-        break;
-      }
+#define MEMO_INPUT_LIMIT  (1U << 20U)
+#define MEMO_OUTPUT_LIMIT (1U << 20U)
 
-      // subtract two stack values, consume them and push result of subtraction
-      // pops subtractor first, then subtrahend
-      case '-': {
-        op_char = '-';
-        if (stack_head < 2U)
-          crash(OC_STACK_EXHAUSTED);
-        stack[stack_head - 2U] = stack[stack_head - 2U] - stack[stack_head - 1U];
-        stack_head--;
-        cursor++;
-        break;
-      }
+typedef struct {
+  TermiteHandle file;
+  _Bool         is_overflown; // some of the stream didn't fit into the buffer
+} MemoStream;
 
-      // multiply two stack values, consume them and push result of multiplication 
-      case '*': {
-        op_char = '*';
-        if (stack_head < 2U)
-          crash(OC_STACK_EXHAUSTED);
-        stack[stack_head - 2U] = stack[stack_head - 2U] * stack[stack_head - 1U];
-        stack_head--;
-        cursor++;
-        break;
-      }
+// input that doesn't fit is read further into the same buffer, run isn't memoized then
+static _Bool
+refill_memo_input(TermiteMemory* memory)
+{
+  MemoStream* stream = memory->context;
+  stream->is_overflown = (_Bool)1;
+  memory->position = 0U;
+  return read_file(stream->file, (char*)memory->data, memory->capacity, &memory->size);
+}
 
-      // divide two stack values, consume them and push result of division
-      // pops divider first, then dividend
-      case '/': {
-        op_char = '/';
-        if (stack_head < 2U)
-          crash(OC_STACK_EXHAUSTED);
-        if (stack[stack_head - 1U] == 0U) {
-          crash(OC_ZERO_DIVISION);
-          break;
-        }
-        stack[stack_head - 2U] = stack[stack_head - 2U] / stack[stack_head - 1U];
-        stack_head--;
-        cursor++;
-        break;
-      }
+// pipes give input in pieces, so it's read until it's exhausted or the buffer is full
+static _Bool
+read_memo_input(TermiteHandle file, unsigned char* input, unsigned int limit, unsigned int* size)
+{
+  *size = 0U;
+  while (*size != limit) {
+    unsigned int chars_read;
+    if (!read_file(file, (char*)&input[*size], limit - *size, &chars_read))
+      return (_Bool)0;
+    if (chars_read == 0U)
+      break;
+    *size += chars_read;
+  }
+  return (_Bool)1;
+}
 
-      // pop from stack and print
-      case '<': {
-        op_char = '<';
-        if (stack_head == 0U)
-          crash(OC_STACK_EXHAUSTED);
-        if (args.print_stack_steps)
-          write_cstring(out_handle, "\n");
-        write_byte(out_handle, stack[stack_head - 1U]);
-        stack_head--;
-        cursor++;
-        break;
-      }
+// output that doesn't fit is dropped from the buffer, everything is still passed through as it's written
+static _Bool
+reserve_memo_output(TermiteMemory* memory, unsigned int required)
+{
+  (void)required;
+  MemoStream* stream = memory->context;
+  stream->is_overflown = (_Bool)1;
+  memory->size = 0U;
+  return (_Bool)1;
+}
 
-      // push single byte from stdin into stack
-      case '>': {
-        op_char = '>';
-        if (stack_head == STACK_LIMIT - 1U)
-          crash(OC_STACK_OVERFLOW);
-
-        char stdin_char;
-        unsigned int chars_read;
-        if (!read_file(in_handle, &stdin_char, 1U, &chars_read)) // todo: we could probably retrieve STDIN only once per startup
-          crash(OC_FILE_ERROR); // todo: could be triggered when there's no input, should give INPUT_EXHAUTED error on such cases
-
-        if (chars_read != 0U) {
-          stack[stack_head++] = (unsigned char)stdin_char;
-          stack[stack_head++] = 1U;
-        } else {
-          stack[stack_head++] = 0U; // todo: what about outputting random value here?
-          stack[stack_head++] = 0U;
-        }
+static void
+pass_memo_output(TermiteMemory* memory, unsigned int offset)
+{
+  MemoStream* stream = memory->context;
+  write_file(stream->file, (const char*)&memory->data[offset], memory->size - offset);
+  if (stream->is_overflown)
+    memory->size = 0U;
+}
 
-        cursor++;
-        break;
-      }
+static unsigned long long
+hash_uint(unsigned long long hash, unsigned int value)
+{
+  return hash_byte_array(hash, (const unsigned char*)&value, sizeof(value));
+}
 
-      // pop from stack and rewind N tokens back
-      case '[': {
-        op_char = '[';
-        if (stack_head == 0U)
-          crash(OC_STACK_EXHAUSTED);
-
-        unsigned char n_tokens = stack[stack_head - 1U];
-        stack_head--;
-
-        if (args.catch_infinite_recursion) {
-          if (shadow_stack_rewinded_at != 0U &&
-              shadow_stack_rewinded_at == cursor &&
-              shadow_stack_rewinded_with == n_tokens &&
-              compare_byte_array(shadow_stack, shadow_stack_len, stack, stack_head))
-          {
-            crash(OC_INFINITE_LOOP);
-          }
-          shadow_stack_rewinded_at = cursor;
-          shadow_stack_rewinded_with = n_tokens;
-          shadow_stack_len = stack_head;
-          for (unsigned int i = stack_head; i--;)
-            shadow_stack[i] = stack[i];
-        }
+// every switch that could change output or exit code is part of the key
+static unsigned long long
+hash_memo_switches(unsigned long long hash, const WorkerArgs* args)
+{
+  unsigned int switches =
+    (unsigned int)args->print_stack_steps << 0U |
+    (unsigned int)args->print_stack_on_exit << 1U |
+    (unsigned int)args->catch_infinite_recursion << 2U |
+    (unsigned int)args->wide_cells << 3U |
+    (unsigned int)args->stop_on_trace << 4U;
+  const TraceFilter* filter = &args->trace_filter;
+  const unsigned int values[] = {
+    switches, args->step_limit, filter->filters,
+    filter->offset_low, filter->offset_high, filter->token_low, filter->token_high,
+    filter->depth_low, filter->depth_high, filter->top_low, filter->top_high, filter->every,
+  };
+  for (unsigned int i = 0U; i < sizeof(values) / sizeof(values[0]); i++)
+    hash = hash_uint(hash, values[i]);
+  return hash;
+}
 
-        if (n_tokens != 0U)
-          // '[' itself should not count
-          cursor--;
-        else
-          // move along
-          cursor++;
-
-        while (n_tokens != 0U) {
-          switch (input[cursor]) {
-            case  ' ':
-            case '\n':
-            case '\r':
-            case '\t': break;
-            default: {
-              if (is_hex_char(input[cursor])) {
-                if ((cursor != 0U) && parse_hex(input, &input[size - 1U], cursor - 1U))
-                  cursor--;
-                else
-                  crash(OC_INVALID_INPUT);
-              }
-              n_tokens--;
-            }
-          }
-
-          if ((cursor == 0U) && (n_tokens != 0U))
-            crash(OC_INPUT_EXHAUSTED);
-          else if (n_tokens != 0U)
-            cursor--;
-        }
-        break;
-      }
+// same as read_input, but stdin is taken whole first, so that runs over the same source and input are only done once
+// runs that aren't reproducible from source and input alone aren't stored:
+//   ones with input or output over the limits, ones that failed on io and ones that ask hivemind host for something
+static int
+read_input_memoized(TermiteHandle input_handle,
+                    TermiteHandle out_handle,
+                    TermiteHandle in_handle,
+                    WorkerArgs args)
+{
+  static Program program;
+  static unsigned char input[MEMO_INPUT_LIMIT];
+  static unsigned char output[MEMO_OUTPUT_LIMIT];
 
-      // pop from stack and seek N tokens forward
-      case ']': {
-        op_char = ']';
-        if (stack_head == 0U)
-          crash(OC_STACK_EXHAUSTED);
-
-        unsigned char n_tokens = stack[stack_head - 1U];
-        stack_head--;
-        cursor++;
-
-        while (n_tokens != 0U) {
-          if (cursor == size)
-            crash(OC_INPUT_EXHAUSTED);
-
-          switch (input[cursor]) {
-            case  ' ':
-            case '\n':
-            case '\r':
-            case '\t': break;
-            default: {
-              if (is_hex_char(input[cursor])) {
-                if ((cursor != (size - 1U)) && parse_hex(input, &input[size - 1U], cursor))
-                  cursor++;
-                else
-                  crash(OC_INVALID_INPUT);
-              }
-              n_tokens--;
-            }
-          }
-
-          if ((cursor == size) && (n_tokens != 0U))
-            crash(OC_INPUT_EXHAUSTED);
-          cursor++;
-        }
-        break;
-      }
+  int exit_code = load_program(input_handle, &program);
+  if (exit_code != OC_OK)
+    return exit_code;
 
-      // otherwise push it as character or hex value
-      default: {
-        if (stack_head == STACK_LIMIT)
-          crash(OC_STACK_OVERFLOW);
+  MemoStream in_stream = { .file = in_handle };
+  TermiteMemory in = { .data = input, .capacity = MEMO_INPUT_LIMIT, .context = &in_stream };
+  if (!read_memo_input(in_handle, input, MEMO_INPUT_LIMIT, &in.size))
+    return OC_FILE_ERROR;
+  in.refill = in.size == MEMO_INPUT_LIMIT ? refill_memo_input : NULL;
 
-        if (is_hex_char(input[cursor])) {
-          if ((cursor != (size - 1U)) && parse_hex(input, &input[size - 1U], cursor)) {
-            unsigned char leading = input[cursor] - '0';
-            if (leading > 9U)
-              leading -= 7U;
+  unsigned long long key = hash_byte_array(program.hash, input, in.size);
+  key = hash_uint(hash_uint(key, program.size), in.size);
+  key = hash_memo_switches(key, &args);
 
-            unsigned char following = input[cursor + 1U] - '0';
-            if (following > 9U)
-              following -= 7U;
+  // whole input could've fit exactly, which is only known after the run
+  unsigned int output_size;
+  if (in.refill == NULL && results_load(key, output, MEMO_OUTPUT_LIMIT, &output_size, &exit_code)) {
+    write_file(out_handle, (const char*)output, output_size);
+    return exit_code;
+  }
 
-            cursor += 2U;
-            stack[stack_head] = (leading << 4U) | following;
-          } else
-            crash(OC_INVALID_INPUT);
+  attach_index(&program, args);
+
+  MemoStream out_stream = { .file = out_handle };
+  TermiteMemory out = {
+    .data = output,
+    .capacity = MEMO_OUTPUT_LIMIT,
+    .reserve = reserve_memo_output,
+    .written = pass_memo_output,
+    .context = &out_stream,
+  };
+  exit_code = run_program(&program, memory_handle(&out), memory_handle(&in), args);
+  unload_program(&program);
+
+  // failing to store is not fatal, run is just repeated next time
+  if (!in_stream.is_overflown && !out_stream.is_overflown && exit_code != OC_FILE_ERROR && exit_code != HIVEMIND_EXIT)
+    results_store(key, exit_code, output, out.size);
+  return exit_code;
+}
 
-        } else
-          stack[stack_head] = (unsigned char)input[cursor++];
+typedef struct {
+  const char*  data;
+  unsigned int len;
+  unsigned int position;
+} SelftestPipe;
 
-        op_char = stack[stack_head];
-        stack_head++;
-      }
-    }
-    if (args.print_stack_steps == (_Bool)1) {
-      write_cstring(out_handle, "\n|");
-      write_byte_array(out_handle, stack, stack_head);
-      write_cstring(out_handle, "| (");
-      write_file(get_stdout(), (const char*)&op_char, 1U);
-      write_cstring(out_handle, " ");
-      write_uint(out_handle, count_tokens(input, &input[size - 1U], cursor - 1U));
-      write_cstring(out_handle, ")");
+// gives input three bytes at a time, as pipe that is written in pieces does
+static _Bool
+refill_selftest_pipe(TermiteMemory* memory)
+{
+  SelftestPipe* pipe = memory->context;
+  memory->position = 0U;
+  memory->size = 0U;
+  while (memory->size != memory->capacity && pipe->position != pipe->len)
+    memory->data[memory->size++] = (unsigned char)pipe->data[pipe->position++];
+  return (_Bool)1;
+}
+
+// checks that memoized runs take whole input that comes in pieces, and no more than the limit of it
+static int
+run_memo_selftest(TermiteHandle report)
+{
+  static const char text[] = "first-second-third";
+  const unsigned int text_len = sizeof(text) - 1U;
+  const unsigned int limits[] = { text_len + 1U, text_len, 8U };
+  _Bool is_passed = (_Bool)1;
+
+  for (unsigned int i = 0U; i < sizeof(limits) / sizeof(limits[0]); i++) {
+    unsigned char piece[3];
+    unsigned char input[sizeof(text)];
+    unsigned int size;
+    SelftestPipe pipe = { text, text_len, 0U };
+    TermiteMemory in = { .data = piece, .capacity = sizeof(piece), .refill = refill_selftest_pipe, .context = &pipe };
+    unsigned int expected = limits[i] < text_len ? limits[i] : text_len;
+    if (!read_memo_input(memory_handle(&in), input, limits[i], &size) ||
+        !compare_byte_array(input, size, (unsigned char*)text, expected))
+    {
+      is_passed = (_Bool)0;
     }
   }
 
-EXIT_LOOP:
-  if (args.print_stack_on_exit == (_Bool)1 || args.print_stack_steps == (_Bool)1) {
-    write_cstring(out_handle, "\n|");
-    write_byte_array(out_handle, stack, stack_head);
-    write_cstring(out_handle, "|");
-  }
-  return exit_code;
+  write_cstring(report, is_passed ? "memo input ok\n" : "memo input mismatch\n");
+  return is_passed ? OC_OK : OC_INVALID_INPUT;
 }
 
-#ifndef TERM_NO_WORKER_MAIN
 int
 term_main(int argc, const char** argv)
 {
   if (argc == 1)
     return OC_FILE_ERROR; //no file given
 
+  // given instead of program, checks native implementations of std routines against their bodies
+  if (compare_cstring(argv[1], "selftest")) {
+    init_io();
+    int return_code = run_intrinsics_selftest(get_stdout());
+    if (run_memo_selftest(get_stdout()) != OC_OK)
+      return_code = OC_INVALID_INPUT;
+    deinit_io();
+    return return_code;
+  }
+
   WorkerArgs args = {0};
+  enum { waRun, waWarm, waPurge, waGraph } action = waRun;
+  _Bool is_io_overlapped = (_Bool)0;
+  _Bool is_memoized = (_Bool)0;
 
   for (int i = 2; i < argc; i++) {
-    // turn all debug switches
-    if (compare_cstring(argv[i], "d")) {
-      args.print_stack_steps = (_Bool)1;
-      args.catch_infinite_recursion = (_Bool)1;
-      args.print_stack_on_exit = (_Bool)1;
-
-    // turn on stack step printing
-    } else if (compare_cstring(argv[i], "s")) {
-      args.print_stack_steps = (_Bool)1;
-
-    // show state of stack on program exit
-    } else if (compare_cstring(argv[i], "e")) {
-      args.print_stack_on_exit = (_Bool)1;
-
-    // EXPERIMENTAL: try to catch rewinds that don't change state of stack
-    // and thus are most likely infinitely looped
-    } else if (compare_cstring(argv[i], "l")) {
-      args.catch_infinite_recursion = (_Bool)1;
+    if (parse_worker_arg(argv[i], &args))
+      continue;
+
+    // only build cache entry for the program, without running it
+    if (compare_cstring(argv[i], "warm")) {
+      action = waWarm;
+
+    // only remove cache entry of the program, without running it
+    } else if (compare_cstring(argv[i], "purge")) {
+      action = waPurge;
+
+    // only output control flow graph of the program in DOT format
+    } else if (compare_cstring(argv[i], "cfg")) {
+      action = waGraph;
+
+    // do stdin and stdout transfers on separate thread, falls back to regular io where it's unsupported
+    } else if (compare_cstring(argv[i], "async")) {
+      is_io_overlapped = (_Bool)1;
+
+    // reuse exit code and output of previous run over the same source, stdin and switches
+    } else if (compare_cstring(argv[i], "memo")) {
+      is_memoized = (_Bool)1;
     }
   }
 
@@ -506,19 +808,46 @@ term_main(int argc, const char** argv)
   if (!open_file(argv[1], &input_file, foFileRead))
     return OC_FILE_ERROR;
 
-  int return_code =
-    read_input(
-      input_file,
-      get_stdout(),
-      get_stdin(),
-      args
-    );
-
-  if (!close_file(input_file))
-    return OC_FILE_ERROR;
+  int return_code;
+  if (action == waRun) {
+    if (is_io_overlapped)
+      start_io_thread();
+    // hardware counters and samples are only meaningful for actual run
+    if (is_memoized && !args.report_perf && !args.profile)
+      return_code = read_input_memoized(input_file, get_stdout(), get_stdin(), args);
+    else
+      return_code =
+        read_input(
+          input_file,
+          get_stdout(),
+          get_stdin(),
+          args
+        );
+  } else {
+    static Program program;
+    return_code = load_program(input_file, &program);
+    if (return_code == OC_OK && action == waWarm) {
+      index_program(&program);
+      if (!cache_store(&program))
+        return_code = OC_FILE_ERROR;
+    } else if (return_code == OC_OK && action == waPurge) {
+      if (!cache_purge(&program))
+        return_code = OC_FILE_ERROR;
+    } else if (return_code == OC_OK && action == waGraph) {
+      if (!args.use_cache || !cache_load(&program))
+        index_program(&program);
+      if (!write_cfg(get_stdout(), &program))
+        return_code = OC_INVALID_INPUT;
+      unload_program(&program);
+    }
+  }
 
+  // output is flushed on every exit, even when closing fails
+  _Bool is_closed = close_file(input_file);
   deinit_io();
 
+  if (!is_closed)
+    return OC_FILE_ERROR;
   return return_code;
 }
 #endif
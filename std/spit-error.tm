@@ -28,6 +28,14 @@
   .infinite20loop00
   $@00=03*]<09[
 
+@08=~16*]
+  .step20limit00
+  $@00=03*]<09[
+
+@09=~16*]
+  .breakpoint00
+  $@00=03*]<09[
+
 @10=~16*]
   .file20error00
   $@00=03*]<09[
@@ -0,0 +1,106 @@
+"""Termite hex syntax conversions backed by libtermite-codec, built from src/codec.c with 'make codec'
+
+  Library is looked up at TERMITE_CODEC path or in repository root,
+  when it's not there the same conversions are done in Python, only slower
+
+  Hex char without a pair raises UnpairedHex with offset of it
+
+"""
+
+import os, ctypes
+
+LibraryPath = os.environ.get("TERMITE_CODEC",
+    os.path.join(os.path.dirname(os.path.abspath(__file__)), os.pardir, "libtermite-codec.so"))
+
+
+class UnpairedHex(Exception):
+    def __init__(self, offset: int):
+        super().__init__(f"hex char without a pair at offset {offset}")
+        self.offset = offset
+
+
+def _load_library():
+    try:
+        library = ctypes.CDLL(LibraryPath)
+    except OSError:
+        return None
+    library.codec_escape.argtypes = [ctypes.c_char_p, ctypes.c_uint, ctypes.c_char_p]
+    library.codec_escape.restype = ctypes.c_uint
+    library.codec_decode.argtypes = [ctypes.c_char_p, ctypes.c_uint, ctypes.c_char_p, ctypes.POINTER(ctypes.c_uint)]
+    library.codec_decode.restype = ctypes.c_bool
+    library.codec_count_tokens.argtypes = [ctypes.c_char_p, ctypes.c_uint, ctypes.POINTER(ctypes.c_uint)]
+    library.codec_count_tokens.restype = ctypes.c_bool
+    return library
+
+library = _load_library()
+
+HexChars = frozenset(b"0123456789ABCDEF")
+DataWhitespace = frozenset(b" \n\t")
+ProgramWhitespace = frozenset(b" \n\t\r")
+
+# unsigned int lengths on C side, escaped output included
+SizeLimit = 0x7FFFFFFF
+
+
+def _is_invisible(byte: int) -> bool:
+    return byte == 0x7F or (byte < 0x20 and byte != 0x9 and byte != 0xA)
+
+
+def escape(data: bytes) -> bytes:
+    """Invisible bytes, below 20 except \\t and \\n and 7F, become hex pairs"""
+    if library is not None and len(data) <= SizeLimit:
+        out = ctypes.create_string_buffer(len(data) * 2 + 1)
+        size = library.codec_escape(data, len(data), out)
+        return out.raw[:size]
+    result = bytearray()
+    for byte in data:
+        if _is_invisible(byte):
+            result += b"%02X" % byte
+        else:
+            result.append(byte)
+    return bytes(result)
+
+
+def decode(text: bytes) -> bytes:
+    """Hex pairs become bytes, ' ', '\\n' and '\\t' are dropped and everything else is taken as it is"""
+    if library is not None and len(text) <= SizeLimit:
+        out = ctypes.create_string_buffer(len(text) + 1)
+        size = ctypes.c_uint()
+        if not library.codec_decode(text, len(text), out, ctypes.byref(size)):
+            raise UnpairedHex(size.value)
+        return out.raw[:size.value]
+    result = bytearray()
+    index = 0
+    while index != len(text):
+        byte = text[index]
+        if byte in HexChars:
+            if index + 1 == len(text) or text[index + 1] not in HexChars:
+                raise UnpairedHex(index)
+            result.append(int(text[index:index + 2], 16))
+            index += 1
+        elif byte not in DataWhitespace:
+            result.append(byte)
+        index += 1
+    return bytes(result)
+
+
+def count_tokens(text: bytes) -> int:
+    """Hex pairs and every other char that isn't whitespace are tokens, '\\r' is whitespace here"""
+    if library is not None and len(text) <= SizeLimit:
+        count = ctypes.c_uint()
+        if not library.codec_count_tokens(text, len(text), ctypes.byref(count)):
+            raise UnpairedHex(count.value)
+        return count.value
+    count = 0
+    index = 0
+    while index != len(text):
+        byte = text[index]
+        if byte in HexChars:
+            if index + 1 == len(text) or text[index + 1] not in HexChars:
+                raise UnpairedHex(index)
+            index += 1
+            count += 1
+        elif byte not in ProgramWhitespace:
+            count += 1
+        index += 1
+    return count
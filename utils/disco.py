@@ -2,6 +2,9 @@
 
     Supply .env file with DiscordBotToken value for running it from your own bot
 
+    Scripts run in ScriptPool, so the one that takes long delays only its author,
+    Frontend holds command logic and only needs ctx with async send, fake_discord.py drives it without Discord
+
 """
 
 # todo: make virtual file system or at least make sure that only internal files are possible to interact with
@@ -15,20 +18,18 @@
 import os, traceback
 from typing import List
 
-from dotenv import load_dotenv
-import discord
-from discord.ext import commands
-
 import hivemind
+from script_pool import ScriptPool, ScriptError
 
 CommandPrefix = ">"
 ScriptFolder = "shared"
 MaxMessagesPerResponse = 3
+PackageSize = 1500
 
 
 # todo: does byte count matters? as string might be lengthed by encoded characters, not bytes
 # todo: divide by \n if they are present
-def package_string(input_str: str, max_size: int = 1500) -> List[str]:
+def package_string(input_str: str, max_size: int = PackageSize) -> List[str]:
     result = []
     to_package = input_str
     while len(to_package) >= max_size:
@@ -93,32 +94,50 @@ async def filesystem_save(ctx, path, code, forced = False):
         await ctx.send(f"```\n[file already exists, use 'save forced <path>' to forced rewrite]```")
 
 
-class Commands(commands.Cog):
-    @commands.command(name="hm")
-    async def hivemind_op(self, ctx):
-        script = ctx.message.content[len(Commands.hivemind_op.name) + len(CommandPrefix):]
+async def send_output(ctx, chunks):
+    """Sends packages of output as soon as they're full, run is cancelled when there's more than discord takes"""
+    pending = ""
+    sent = 0
+    produced = False
+    async for chunk in chunks:
+        produced = True
+        packages = package_string(pending + str(chunk, encoding="latin1"))
+        # the last package might grow with the next chunk
+        pending = packages.pop()
+        for pack in packages:
+            if sent == MaxMessagesPerResponse:
+                await chunks.aclose()
+                await ctx.send("```\n[outupt is too big for discord]```")
+                return
+            await ctx.send(f"""```\n{pack}```""")
+            sent += 1
+    if len(pending) != 0:
+        if sent == MaxMessagesPerResponse:
+            await ctx.send("```\n[outupt is too big for discord]```")
+        else:
+            await ctx.send(f"""```\n{pending}```""")
+    elif not produced:
+        await ctx.send("```\n[no output]```")
+
+
+class Frontend:
+    def __init__(self, pool: ScriptPool):
+        self.pool = pool
+
+    async def hivemind_op(self, ctx, script: str):
         # script = format_discord_body_args(script)
         if script.strip().lower() == "help":
             await ctx.send(hivemind.HelpText)
         else:
             try:
-                output = hivemind.process(script)
-                if len(output) != 0:
-                    packages = package_string(str(output, encoding="latin1"))
-                    if len(packages) <= MaxMessagesPerResponse:
-                        for pack in packages:
-                            await ctx.send(f"""```\n{pack}```""")
-                    else:
-                        await ctx.send("```\n[outupt is too big for discord]```")
-                else:
-                    await ctx.send("```\n[no output]```")
+                await send_output(ctx, self.pool.run(ctx.author.id, script))
+            except ScriptError as e:
+                await ctx.send(f"```\n[error: {e}]```")
             except Exception as e:
                 print(traceback.format_exc())
                 await ctx.send(f"```\n[error: {e}]```")
 
-    @commands.command(name="tm")
-    async def termite_op(self, ctx):
-        script = ctx.message.content[len(Commands.termite_op.name) + len(CommandPrefix):]
+    async def termite_op(self, ctx, script: str):
         script = strip_discord_formatting(script)
         if script.strip().lower() == "help":
             try:
@@ -129,22 +148,11 @@ class Commands(commands.Cog):
         else:
             formed_script = f'run d "{script}"\nhex'
             try:
-                output = hivemind.process(formed_script)
-                if len(output) != 0:
-                    packages = package_string(str(output, encoding="latin1"))
-                    if len(packages) <= MaxMessagesPerResponse:
-                        for pack in packages:
-                            await ctx.send(f"""```\n{pack}```""")
-                    else:
-                        await ctx.send("```\n[outupt is too big for discord]```")
-                else:
-                    await ctx.send("```\n[no output]```")
+                await send_output(ctx, self.pool.run(ctx.author.id, formed_script))
             except Exception as e:
                 await ctx.send(f"```\n[error: {e}]```")
 
-    @commands.command(name="fs")
-    async def filesystem(self, ctx):
-        script = ctx.message.content[len(Commands.filesystem.name) + len(CommandPrefix):]
+    async def filesystem(self, ctx, script: str):
         command, _ = hivemind.parse_next_command(script)
         match command:
             case [path]:
@@ -159,12 +167,41 @@ class Commands(commands.Cog):
                 await ctx.send(f"```\n[invalid filesystem command: {command}]```")
 
 
-bot = commands.Bot(command_prefix=CommandPrefix)
+def run_bot():
+    from dotenv import load_dotenv
+    from discord.ext import commands
+
+    class Commands(commands.Cog):
+        def __init__(self, frontend: Frontend):
+            self.frontend = frontend
+
+        @commands.command(name="hm")
+        async def hivemind_op(self, ctx):
+            await self.frontend.hivemind_op(ctx, ctx.message.content[len("hm") + len(CommandPrefix):])
+
+        @commands.command(name="tm")
+        async def termite_op(self, ctx):
+            await self.frontend.termite_op(ctx, ctx.message.content[len("tm") + len(CommandPrefix):])
+
+        @commands.command(name="fs")
+        async def filesystem(self, ctx):
+            await self.frontend.filesystem(ctx, ctx.message.content[len("fs") + len(CommandPrefix):])
+
+    class Bot(commands.Bot):
+        async def on_ready(self):
+            # pool lives in the loop of the bot
+            if not hasattr(self, "pool"):
+                self.pool = ScriptPool()
+                await self.pool.start()
+                self.add_cog(Commands(Frontend(self.pool)))
+
+    load_dotenv(".env")
+    token = os.environ.get("DiscordBotToken")
+    if token is not None:
+        Bot(command_prefix=CommandPrefix).run(token)
+    else:
+        raise Exception("No token available in environment")
+
 
-load_dotenv(".env")
-token = os.environ.get("DiscordBotToken")
-if token is not None:
-    bot.add_cog(Commands())
-    bot.run(os.environ.get("DiscordBotToken"))
-else:
-    raise Exception("No token available in environment")
+if __name__ == "__main__":
+    run_bot()
@@ -0,0 +1,105 @@
+"""Local stand-in for Discord that drives disco.Frontend under concurrent load
+
+  Quick users send short scripts with pauses between them while heavy users keep the pool busy
+  with ones that run into the timeout, response latency of quick users is reported for rising number of them,
+  it should stay flat as long as there are more pool workers than heavy users and cpu isn't saturated
+
+  termite-worker should be in PATH, run it from the repository root as:
+    PATH=$PWD:$PATH python3 utils/fake_discord.py [workers] [heavy users]
+
+"""
+
+import sys, time, random, asyncio
+from typing import List
+
+import disco
+from script_pool import ScriptPool
+
+QuickScript = "00 ."
+# three nested loops of 256 iterations, it takes about a second
+HeavyScript = "00 00 00 01+ @00=~ 08*[ . 01+ @00=~ 13*[ . 01+ @00=~ 1E*[ . 77<"
+HeavyTimeout = 0.25
+Rounds = 10
+ThinkTime = 1.0 # at most, between requests of quick user
+QuickUserCounts = [1, 4, 16, 64]
+
+
+class FakeAuthor:
+    def __init__(self, id: int):
+        self.id = id
+
+
+class FakeMessage:
+    def __init__(self, content: str):
+        self.content = content
+
+
+class FakeContext:
+    """Records what's sent to the channel and when, in the same shape as discord.ext.commands.Context uses"""
+
+    def __init__(self, author_id: int, content: str):
+        self.author = FakeAuthor(author_id)
+        self.message = FakeMessage(content)
+        self.created = time.monotonic()
+        self.sent: List[str] = []
+        self.sent_at: List[float] = []
+
+    async def send(self, content: str):
+        self.sent.append(content)
+        self.sent_at.append(time.monotonic())
+
+    def latency(self) -> float:
+        return self.sent_at[0] - self.created
+
+
+def percentile(values: List[float], share: float) -> float:
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(len(ordered) * share))]
+
+
+async def heavy_user(frontend: disco.Frontend, user_id: int, stop: asyncio.Event):
+    while not stop.is_set():
+        ctx = FakeContext(user_id, "")
+        await frontend.termite_op(ctx, HeavyScript)
+        assert "timed out" in ctx.sent[0], ctx.sent
+
+
+async def quick_user(frontend: disco.Frontend, user_id: int) -> List[float]:
+    latencies = []
+    for _ in range(Rounds):
+        await asyncio.sleep(random.uniform(0.0, ThinkTime))
+        ctx = FakeContext(user_id, "")
+        await frontend.termite_op(ctx, QuickScript)
+        assert len(ctx.sent) == 1 and "[error" not in ctx.sent[0], ctx.sent
+        latencies.append(ctx.latency())
+    return latencies
+
+
+async def main(workers: int, heavy_users: int):
+    pool = ScriptPool(workers, timeout=HeavyTimeout)
+    await pool.start()
+    frontend = disco.Frontend(pool)
+    try:
+        # output streaming and its limit
+        ctx = FakeContext(0, "")
+        await frontend.hivemind_op(ctx, f'data "{"x" * disco.PackageSize * 4}"')
+        assert len(ctx.sent) == disco.MaxMessagesPerResponse + 1 and "too big" in ctx.sent[-1], ctx.sent
+
+        print(f"{workers} workers, {heavy_users} heavy users timing out after {HeavyTimeout}s")
+        print("quick users    requests    p50 ms    p99 ms")
+        for quick_users in QuickUserCounts:
+            stop = asyncio.Event()
+            heavy = [asyncio.create_task(heavy_user(frontend, 1000 + i, stop)) for i in range(heavy_users)]
+            results = await asyncio.gather(*(quick_user(frontend, 1 + i) for i in range(quick_users)))
+            stop.set()
+            await asyncio.gather(*heavy)
+            latencies = [latency for user in results for latency in user]
+            print(f"{quick_users:11}    {len(latencies):8}    {percentile(latencies, 0.5) * 1000:6.1f}"
+                  f"    {percentile(latencies, 0.99) * 1000:6.1f}")
+    finally:
+        await pool.close()
+
+
+if __name__ == "__main__":
+    asyncio.run(main(int(sys.argv[1]) if len(sys.argv) > 1 else 4,
+                     int(sys.argv[2]) if len(sys.argv) > 2 else 2))
@@ -18,6 +18,8 @@
                         If file already exists then rewrite its contents
     MAGIC 22 X:NAME - Load content of file at path X into buffer
 
+  Commands are only implemented by native host, termite-hivemind built from src/hive.c
+
 """
 
 # todo: capture return code from Command.do() call for uniform handling of them
@@ -29,8 +31,17 @@
 import os, sys, subprocess, tempfile, time
 from typing import List, Tuple, Iterator
 
+import codec, worker_client
+
 DefaultTimeout = 5.0
 
+# when set, workers are reached through termite-daemon listening on this socket instead of being spawned
+DaemonSocket = os.environ.get("TERMITE_DAEMON")
+daemon_client = worker_client.WorkerClient(DaemonSocket, DefaultTimeout) if DaemonSocket is not None else None
+
+# when set, spawned workers reuse results of previous runs over the same script and input
+MemoizeRuns = os.environ.get("TERMITE_MEMO") is not None
+
 # todo: make it better, it's confusing af
 HelpText = """```
     Hivemind scripts are composed from command sequence
@@ -67,30 +78,16 @@ def int_to_hex(byte: int) -> bytes:
     if following > 0x39: following += 7
     return bytes(chr(leading), encoding="ascii") + bytes(chr(following), encoding="ascii")
 
-# todo: work on bytes internally? or better yet mutable bytearray
-# todo: implement it in termite itself, as it's just data operation 
 def raw_to_termite(text: str) -> bytes:
-    result = b""
-    index = 0
-    while index != len(text):
-        # todo: isnumeric only checks for numerics in ascii range? if not then it might be erroneous
-        if text[index].isnumeric() or text[index] in {'A', 'B', 'C', 'D', 'E', 'F'}:
-            if index != len(text) - 1:
-                if text[index + 1].isnumeric() or text[index + 1] in {'A', 'B', 'C', 'D', 'E', 'F'}:
-                    leading = ord(text[index]) - ord('0')
-                    if leading > 9: leading -= 7
-                    following = ord(text[index + 1]) - ord('0')
-                    if following > 9: following -= 7
-                    result += bytes(chr(leading << 4 | following), encoding="latin-1")
-                    index += 1
-                else:
-                    raise Exception(f"[ill-formed hex token '{text[index:index+2]}']")
-            else:
-                raise Exception(f"[trailing unformed hex token]")
-        elif not text[index] in {' ', '\n', '\t'}:
-            result += bytes(text[index], encoding="utf-8")
-        index += 1
-    return result
+    data = text.encode("utf-8")
+    try:
+        return codec.decode(data)
+    except codec.UnpairedHex as error:
+        if error.offset == len(data) - 1:
+            raise Exception(f"[trailing unformed hex token]")
+        # offset is in utf-8 bytes, but it's at ascii char, so prefix before it decodes as it is
+        index = len(data[:error.offset].decode("utf-8"))
+        raise Exception(f"[ill-formed hex token '{text[index:index + 2]}']")
 
 
 class Command:
@@ -100,36 +97,47 @@ class Command:
 
 # todo: args
 def run_worker_script(path: str, instream: bytes = b"", timeout: float = DefaultTimeout, arg_string: str = "") -> Tuple[int, bytes]:
+    if daemon_client is not None:
+        return daemon_client.run_script(path, instream, arg_string)
     kwargs = {
         "capture_output": True,
         "input": instream,
         "timeout": timeout,
     }
-    execution = subprocess.run(["termite-worker", path, arg_string], **kwargs)
+    switches = [arg_string, "memo"] if MemoizeRuns else [arg_string]
+    execution = subprocess.run(["termite-worker", path] + switches, **kwargs)
     return (execution.returncode, execution.stdout)
 
 
+def with_error_description(returncode: int, output: bytes) -> bytes:
+    if returncode != 0:
+        returncode, errorout = run_worker_script(
+            "std/spit-error.tm",
+            bytes(chr(returncode), encoding="latin1")
+        )
+        if returncode != 0: # todo: show output even on error
+            raise Exception(f"return code {returncode} [can't run \"std/spit-error.tm\"]")
+        output += b"\n" + errorout
+    return output
+
+
 class RunCodeCommand(Command):
     def __init__(self, code: str, arg_string: str = ""):
         self.code = code
         self.arg_string = arg_string
 
     def do(self, input_data: bytes, **kwargs) -> bytes:
+        if daemon_client is not None:
+            # daemon takes source inline, so there's no need for temporary file
+            returncode, output = daemon_client.run_code(self.code.encode("utf-8"), input_data, self.arg_string)
+            return with_error_description(returncode, output)
         result = b""
         descriptor, tpath = tempfile.mkstemp(dir=os.getcwd())
         try:
             with open(tpath, "w+b") as f:
                 f.write(self.code.encode("utf-8"))
             returncode, output = run_worker_script(os.path.basename(tpath), input_data, arg_string=self.arg_string)
-            if returncode != 0:
-                returncode, errorout = run_worker_script(
-                    "std/spit-error.tm",
-                    bytes(chr(returncode), encoding="latin1")
-                )
-                if returncode != 0:
-                    raise Exception(f"return code {returncode} [can't run \"std/spit-error.tm\"]")
-                output += b"\n" + errorout
-            result = output
+            result = with_error_description(returncode, output)
         except Exception as e:
             os.close(descriptor)
             os.unlink(tpath)
@@ -149,15 +157,7 @@ class RunScriptCommand(Command):
 
     def do(self, input_data: bytes, **kwargs) -> bytes:
         returncode, output = run_worker_script(self.path, input_data, arg_string=self.arg_string)
-        if returncode != 0:
-            returncode, errorout = run_worker_script(
-                "std/spit-error.tm",
-                bytes(chr(returncode), encoding="latin1")
-            )
-            if returncode != 0: # todo: show output even on error
-                raise Exception(f"return code {returncode} [can't run \"std/spit-error.tm\"]")
-            output += b"\n" + errorout
-        return output
+        return with_error_description(returncode, output)
 
 
 class DropOutputCommand(Command):
@@ -194,13 +194,7 @@ class PushDataCommand(Command):
 
 class InvisToHex(Command):
     def do(self, input_data: bytes, **kwargs) -> bytes:
-        result = b""
-        for ch in input_data:
-            if ch == 0x7F or (ch < 0x20 and ch != 0x9 and ch != 0xA):
-                result += int_to_hex(ch)
-            else:
-                result += bytes(chr(ch), encoding="latin1")
-        return result
+        return codec.escape(input_data)
 
 
 # todo: could break easily, maybe just use regex instead?
@@ -0,0 +1,219 @@
+"""Bounded pool of persistent hivemind workers for asynchronous frontends
+
+  Every worker is separate Python process running script_worker.py, which keeps hivemind loaded and runs scripts
+  one after another, so event loop of the frontend never blocks on them
+  Requests are queued per user and users take turns, so the one who submits many slow scripts
+  only delays themselves, every user has no more than UserQueueLimit requests pending
+  Request that runs over its timeout or is abandoned by its caller gets its worker killed, with termite
+  processes it spawned, and worker is respawned for the next request
+  Worker is given KillGrace to remove temporary files of hivemind before it's killed for sure
+  Worker that fails to start is spawned again after growing delay, requests wait for lanes that are up,
+  and once every lane is down pending requests fail, so they're never left waiting for nothing
+
+"""
+
+import os, sys, signal, struct, asyncio
+from collections import deque
+from typing import AsyncIterator, Deque, Dict, Hashable, Optional
+
+from script_worker import KindOutput, KindError
+
+DefaultTimeout = 10.0
+UserQueueLimit = 4
+KillGrace = 1.0
+StartDelay = 0.1 # before the first retry of failed spawn, doubled on every next one
+StartDelayLimit = 5.0
+WorkerPath = os.path.join(os.path.dirname(os.path.abspath(__file__)), "script_worker.py")
+
+
+class ScriptError(Exception):
+    pass
+
+
+class ScriptTimeout(ScriptError):
+    def __init__(self, timeout: float):
+        super().__init__(f"timed out after {timeout:g}s")
+
+
+class QueueFull(ScriptError):
+    def __init__(self):
+        super().__init__("too many pending requests")
+
+
+class _Job:
+    def __init__(self, script: str, timeout: float):
+        self.script = script
+        self.timeout = timeout
+        # items are output chunks, the last one is None or exception
+        self.results: asyncio.Queue = asyncio.Queue()
+        self.abandoned = asyncio.Event()
+
+
+class _Worker:
+    """Persistent worker process, it's started ahead of requests and again after every kill"""
+
+    def __init__(self):
+        self.process: Optional[asyncio.subprocess.Process] = None
+
+    async def ensure_started(self):
+        if self.process is None or self.process.returncode is not None:
+            # own session, so that whole process group could be killed with termite workers spawned by hivemind
+            self.process = await asyncio.create_subprocess_exec(
+                sys.executable, WorkerPath,
+                stdin=asyncio.subprocess.PIPE, stdout=asyncio.subprocess.PIPE,
+                start_new_session=True)
+            # startup shouldn't count towards timeout of request
+            await self.process.stdout.readexactly(5)
+
+    async def kill(self):
+        if self.process is None:
+            return
+        try:
+            self.process.terminate()
+            await asyncio.wait_for(self.process.wait(), KillGrace)
+        except (ProcessLookupError, asyncio.TimeoutError):
+            pass
+        try:
+            os.killpg(self.process.pid, signal.SIGKILL)
+        except ProcessLookupError:
+            pass
+        await self.process.wait()
+        self.process = None
+
+    async def run(self, job: _Job):
+        await self.ensure_started()
+        payload = job.script.encode("utf-8")
+        self.process.stdin.write(struct.pack("=I", len(payload)) + payload)
+        await self.process.stdin.drain()
+        while True:
+            header = await self.process.stdout.readexactly(5)
+            kind, size = header[:1], struct.unpack("=I", header[1:])[0]
+            payload = await self.process.stdout.readexactly(size)
+            if kind == KindOutput:
+                job.results.put_nowait(payload)
+            elif kind == KindError:
+                job.results.put_nowait(ScriptError(payload.decode("utf-8", errors="replace")))
+                return
+            else:
+                job.results.put_nowait(None)
+                return
+
+
+class ScriptPool:
+    def __init__(self, size: int = os.cpu_count() or 1, timeout: float = DefaultTimeout,
+                 user_queue_limit: int = UserQueueLimit):
+        self.size = size
+        self.timeout = timeout
+        self.user_queue_limit = user_queue_limit
+        self.queues: Dict[Hashable, Deque[_Job]] = {}
+        self.turns: Deque[Hashable] = deque() # users with pending requests, in order of their turns
+        self.pending = asyncio.Condition()
+        self.lanes = []
+        self.lanes_down = 0
+
+    async def start(self):
+        for _ in range(self.size):
+            self.lanes.append(asyncio.create_task(self._serve(_Worker())))
+
+    async def close(self):
+        for lane in self.lanes:
+            lane.cancel()
+        await asyncio.gather(*self.lanes, return_exceptions=True)
+        self.lanes = []
+
+    async def run(self, user: Hashable, script: str, timeout: Optional[float] = None) -> AsyncIterator[bytes]:
+        """Output chunks as worker produces them, raises ScriptError on failure
+
+        Closing the iterator early, or cancelling task that iterates, cancels the run
+        """
+        job = _Job(script, timeout if timeout is not None else self.timeout)
+        async with self.pending:
+            queue = self.queues.setdefault(user, deque())
+            if len(queue) >= self.user_queue_limit:
+                raise QueueFull()
+            if len(queue) == 0:
+                self.turns.append(user)
+            queue.append(job)
+            self.pending.notify()
+
+        try:
+            while True:
+                item = await job.results.get()
+                if item is None:
+                    return
+                if isinstance(item, Exception):
+                    raise item
+                yield item
+        finally:
+            job.abandoned.set()
+
+    def _pop_job(self) -> Optional[_Job]:
+        """Job of the user whose turn it is, pending lock should be held"""
+        while len(self.turns) != 0:
+            user = self.turns.popleft()
+            queue = self.queues[user]
+            job = queue.popleft()
+            # user goes to the back of the line, even if they have more requests
+            if len(queue) != 0:
+                self.turns.append(user)
+            else:
+                del self.queues[user]
+            if not job.abandoned.is_set():
+                return job
+        return None
+
+    async def _next_job(self) -> _Job:
+        async with self.pending:
+            while True:
+                await self.pending.wait_for(lambda: len(self.turns) != 0)
+                job = self._pop_job()
+                if job is not None:
+                    return job
+
+    async def _start(self, worker: _Worker):
+        delay = StartDelay
+        is_down = False
+        try:
+            while True:
+                try:
+                    await worker.ensure_started()
+                    return
+                except (OSError, asyncio.IncompleteReadError) as e:
+                    print(f"script worker failed to start: {e!r}", file=sys.stderr)
+                    await worker.kill()
+                if not is_down:
+                    is_down = True
+                    self.lanes_down += 1
+                if self.lanes_down == self.size:
+                    async with self.pending:
+                        while (job := self._pop_job()) is not None:
+                            job.results.put_nowait(ScriptError("worker has died"))
+                await asyncio.sleep(delay)
+                delay = min(delay * 2, StartDelayLimit)
+        finally:
+            if is_down:
+                self.lanes_down -= 1
+
+    async def _serve(self, worker: _Worker):
+        try:
+            while True:
+                await self._start(worker)
+                job = await self._next_job()
+                running = asyncio.create_task(worker.run(job))
+                abandoned = asyncio.create_task(job.abandoned.wait())
+                done, _ = await asyncio.wait({running, abandoned}, timeout=job.timeout,
+                                             return_when=asyncio.FIRST_COMPLETED)
+                abandoned.cancel()
+                if running in done and running.exception() is None:
+                    continue
+
+                # worker is in unknown state after timeout or broken pipe, it's replaced
+                running.cancel()
+                await asyncio.gather(running, return_exceptions=True)
+                await worker.kill()
+                if len(done) == 0:
+                    job.results.put_nowait(ScriptTimeout(job.timeout))
+                elif running in done:
+                    job.results.put_nowait(ScriptError("worker has died"))
+        finally:
+            await worker.kill()
@@ -0,0 +1,70 @@
+"""Worker process of ScriptPool, runs hivemind scripts from stdin one after another until it's closed
+
+  It imports only hivemind, so that respawn after killed request is quick
+
+  Framing, sizes are native endian u32:
+    ready    - b"D" frame sent once hivemind is loaded
+    request  - size, utf-8 script
+    response - kind byte, size, payload, where kind is
+               b"O" for chunk of output, b"E" for error description and b"D" for the end of run
+
+  SIGTERM cancels the run, temporary files of hivemind are removed on the way out
+
+"""
+
+import os, sys, signal, struct
+
+import hivemind
+
+ChunkSize = 1500
+
+KindOutput = b"O"
+KindError = b"E"
+KindDone = b"D"
+
+
+class Cancelled(Exception):
+    """Raised by SIGTERM, it's Exception so that hivemind cleans up"""
+    pass
+
+
+def serve():
+    def cancel(signal_number, frame):
+        raise Cancelled()
+    signal.signal(signal.SIGTERM, cancel)
+
+    # hivemind prints while parsing, so frames get their own copy of stdout and prints go to stderr
+    frames = os.fdopen(os.dup(sys.stdout.fileno()), "wb")
+    os.dup2(sys.stderr.fileno(), sys.stdout.fileno())
+    requests = sys.stdin.buffer
+
+    def send(kind: bytes, payload: bytes):
+        frames.write(kind + struct.pack("=I", len(payload)) + payload)
+
+    send(KindDone, b"")
+    frames.flush()
+    try:
+        while True:
+            header = requests.read(4)
+            if len(header) != 4:
+                return
+            script = requests.read(struct.unpack("=I", header)[0]).decode("utf-8")
+            try:
+                output = hivemind.process(script)
+            except Cancelled:
+                raise
+            except Exception as e:
+                send(KindError, str(e).encode("utf-8"))
+                frames.flush()
+                continue
+            for offset in range(0, len(output), ChunkSize):
+                send(KindOutput, output[offset:offset + ChunkSize])
+                frames.flush()
+            send(KindDone, b"")
+            frames.flush()
+    except Cancelled:
+        pass
+
+
+if __name__ == "__main__":
+    serve()
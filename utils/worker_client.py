@@ -0,0 +1,59 @@
+"""Client for termite-daemon, which keeps termite workers resident behind unix domain socket
+
+  Framing is described in src/daemon.c, connection is kept open and reused between requests
+
+"""
+
+import os, socket, struct
+from typing import Tuple
+
+RequestMagic = b"TMRQ"
+ResponseMagic = b"TMRS"
+
+KindProgramPath = 0
+KindProgramSource = 1
+
+
+class WorkerClient:
+    def __init__(self, socket_path: str, timeout: float = 5.0):
+        self.socket_path = socket_path
+        self.timeout = timeout
+        self.connection = None
+
+    def close(self):
+        if self.connection is not None:
+            self.connection.close()
+            self.connection = None
+
+    def _receive(self, size: int) -> bytes:
+        result = bytearray()
+        while len(result) != size:
+            chunk = self.connection.recv(size - len(result))
+            if len(chunk) == 0:
+                raise Exception("[termite daemon closed connection]")
+            result += chunk
+        return bytes(result)
+
+    def _request(self, kind: int, program: bytes, instream: bytes, arg_string: str, budget: int) -> Tuple[int, bytes]:
+        if self.connection is None:
+            self.connection = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            self.connection.settimeout(self.timeout)
+            self.connection.connect(self.socket_path)
+        flags = arg_string.encode("ascii")
+        header = RequestMagic + struct.pack("=IIIII", kind, budget, len(flags), len(program), len(instream))
+        try:
+            self.connection.sendall(header + flags + program + instream)
+            magic, returncode, output_size = struct.unpack("=4siI", self._receive(12))
+            if magic != ResponseMagic:
+                raise Exception("[invalid termite daemon response]")
+            return (returncode, self._receive(output_size))
+        except Exception:
+            # connection state is unknown after failure, so it's never reused
+            self.close()
+            raise
+
+    def run_script(self, path: str, instream: bytes = b"", arg_string: str = "", budget: int = 0) -> Tuple[int, bytes]:
+        return self._request(KindProgramPath, os.path.abspath(path).encode("utf-8"), instream, arg_string, budget)
+
+    def run_code(self, code: bytes, instream: bytes = b"", arg_string: str = "", budget: int = 0) -> Tuple[int, bytes]:
+        return self._request(KindProgramSource, code, instream, arg_string, budget)